@@ -0,0 +1,55 @@
+#include "aliases.hpp"
+
+#include <algorithm>
+#include <set>
+#include <unordered_map>
+
+static std::unordered_map<std::string, Alias> aliases;
+// The same names kept sorted, so completion finds a prefix's range directly
+static std::set<std::string, std::less<>> sorted_names;
+
+// Characters that end a word or quote part of one
+static const char *const WORD_SPECIAL = " \t\n'\"\\$`|&;<>()";
+
+bool valid_alias_name(std::string_view s)
+{
+  return !s.empty() && s.find_first_of(WORD_SPECIAL) == std::string_view::npos &&
+         s.find_first_of("/=") == std::string_view::npos;
+}
+
+void set_alias(const std::string &name, std::string text)
+{
+  Alias a;
+  a.text = std::move(text);
+  a.chains = !a.text.empty() && (a.text.back() == ' ' || a.text.back() == '\t');
+  bool complete;
+  a.tokens = lex_all(a.text, complete);
+  aliases[name] = std::move(a);
+  sorted_names.insert(name);
+}
+
+const Alias *find_alias(const std::string &name)
+{
+  auto it = aliases.find(name);
+  return it == aliases.end() ? nullptr : &it->second;
+}
+
+bool remove_alias(const std::string &name)
+{
+  sorted_names.erase(name);
+  return aliases.erase(name) > 0;
+}
+
+void clear_aliases()
+{
+  aliases.clear();
+  sorted_names.clear();
+}
+
+std::vector<std::string> alias_names(std::string_view prefix)
+{
+  std::vector<std::string> names;
+  for (auto it = sorted_names.lower_bound(prefix); it != sorted_names.end() && it->starts_with(prefix); ++it)
+    names.push_back(*it);
+  return names;
+}
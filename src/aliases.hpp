@@ -0,0 +1,36 @@
+#pragma once
+
+#include "parse.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// An alias. Its text is split into tokens once, when it is defined, and the
+// parser splices those tokens into the stream wherever the alias is used,
+// so the text is never lexed again. Words stay unexpanded until they run.
+struct Alias
+{
+  std::string text;
+  std::vector<LexToken> tokens;
+  bool chains = false; // the text ends in a blank: the next word is checked too
+};
+
+// Helper: Whether s may name an alias
+bool valid_alias_name(std::string_view s);
+
+// Helper: Define or redefine an alias
+void set_alias(const std::string &name, std::string text);
+
+// Helper: Look up an alias; null if undefined
+const Alias *find_alias(const std::string &name);
+
+// Helper: Remove an alias; false if it was not defined
+bool remove_alias(const std::string &name);
+
+// Helper: Remove every alias
+void clear_aliases();
+
+// Helper: Alias names in sorted order, optionally only those starting with
+// prefix
+std::vector<std::string> alias_names(std::string_view prefix = "");
@@ -0,0 +1,266 @@
+#include "arrays.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <unordered_set>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+IndexedArray::IndexedArray(std::vector<ArrayElement> elements) : dense(std::move(elements))
+{
+  for (auto &e : dense)
+    count += e.index() != 0;
+  while (!dense.empty() && dense.back().index() == 0)
+    dense.pop_back();
+}
+
+size_t IndexedArray::end_index() const
+{
+  if (!is_sparse)
+    return dense.size();
+  return sparse.empty() ? 0 : sparse.rbegin()->first + 1;
+}
+
+const ArrayElement *IndexedArray::get(size_t i) const
+{
+  if (!is_sparse)
+    return i < dense.size() && dense[i].index() != 0 ? &dense[i] : nullptr;
+  auto it = sparse.find(i);
+  return it == sparse.end() ? nullptr : &it->second;
+}
+
+void IndexedArray::set(size_t i, ArrayElement e)
+{
+  if (e.index() == 0)
+  {
+    erase(i);
+    return;
+  }
+  // Growing by more than the array already holds would leave it mostly
+  // holes, so it goes sparse instead
+  if (!is_sparse && i >= dense.size() && i - dense.size() > std::max<size_t>(dense.size(), 64))
+  {
+    for (size_t k = 0; k < dense.size(); ++k)
+      if (dense[k].index() != 0)
+        sparse.emplace(k, std::move(dense[k]));
+    dense.clear();
+    dense.shrink_to_fit();
+    is_sparse = true;
+  }
+  if (is_sparse)
+  {
+    auto [it, added] = sparse.insert_or_assign(i, std::move(e));
+    count += added;
+    return;
+  }
+  if (i >= dense.size())
+    dense.resize(i + 1);
+  count += dense[i].index() == 0;
+  dense[i] = std::move(e);
+}
+
+void IndexedArray::erase(size_t i)
+{
+  if (is_sparse)
+  {
+    count -= sparse.erase(i);
+    return;
+  }
+  if (i >= dense.size() || dense[i].index() == 0)
+    return;
+  dense[i] = std::monostate{};
+  --count;
+  while (!dense.empty() && dense.back().index() == 0)
+    dense.pop_back();
+}
+
+void IndexedArray::reserve(size_t n)
+{
+  if (!is_sparse)
+    dense.reserve(n);
+}
+
+// Every key any associative array has held, stored once for the life of
+// the shell. Key text is packed into large chunks.
+class KeyPool
+{
+public:
+  const InternedKey *intern(std::string_view text, uint64_t hash)
+  {
+    InternedKey probe{hash, text};
+    auto it = index.find(&probe);
+    if (it != index.end())
+      return *it;
+    char *copy = allocate(text.size());
+    std::copy(text.begin(), text.end(), copy);
+    keys.push_back({hash, std::string_view(copy, text.size())});
+    index.insert(&keys.back());
+    return &keys.back();
+  }
+
+private:
+  char *allocate(size_t len)
+  {
+    if (len > left)
+    {
+      size_t size = std::max<size_t>(len, 1 << 16);
+      chunks.emplace_back(new char[size]);
+      next = chunks.back().get();
+      left = size;
+    }
+    char *p = next;
+    next += len;
+    left -= len;
+    return p;
+  }
+
+  struct Hash
+  {
+    size_t operator()(const InternedKey *k) const { return k->hash; }
+  };
+  struct Equal
+  {
+    bool operator()(const InternedKey *a, const InternedKey *b) const
+    {
+      return a->hash == b->hash && a->text == b->text;
+    }
+  };
+  std::unordered_set<const InternedKey *, Hash, Equal> index;
+  std::deque<InternedKey> keys;
+  std::vector<std::unique_ptr<char[]>> chunks;
+  char *next = nullptr;
+  size_t left = 0;
+};
+
+static KeyPool key_pool;
+
+static const size_t GROUP = 16;
+static const int8_t EMPTY = -128;
+static const int8_t DELETED = -2;
+
+// Helper: Bit mask of the bytes in a 16-byte control group equal to c
+static inline uint32_t match_ctrl(const int8_t *group, int8_t c)
+{
+#if defined(__x86_64__)
+  __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+#else
+  uint32_t mask = 0;
+  for (size_t i = 0; i < GROUP; ++i)
+    mask |= (uint32_t)(group[i] == c) << i;
+  return mask;
+#endif
+}
+
+// Helper: Bit mask of the free (empty or deleted) slots in a control group
+static inline uint32_t match_free(const int8_t *group)
+{
+#if defined(__x86_64__)
+  return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(group)));
+#else
+  uint32_t mask = 0;
+  for (size_t i = 0; i < GROUP; ++i)
+    mask |= (uint32_t)(group[i] < 0) << i;
+  return mask;
+#endif
+}
+
+static inline uint64_t hash_key(std::string_view key)
+{
+  return std::hash<std::string_view>{}(key);
+}
+
+// The low 7 hash bits go in the control byte, the rest pick the group.
+// Groups are probed triangularly, which visits every group of a
+// power-of-two table.
+size_t AssocArray::find(std::string_view key, uint64_t hash) const
+{
+  if (ctrl.empty())
+    return SIZE_MAX;
+  size_t mask = ctrl.size() - 1;
+  int8_t tag = hash & 0x7F;
+  size_t pos = (hash >> 7) & mask & ~(GROUP - 1);
+  for (size_t step = GROUP;; step += GROUP)
+  {
+    const int8_t *group = &ctrl[pos];
+    for (uint32_t m = match_ctrl(group, tag); m; m &= m - 1)
+    {
+      size_t i = pos + __builtin_ctz(m);
+      if (slots[i].key->hash == hash && slots[i].key->text == key)
+        return i;
+    }
+    if (match_ctrl(group, EMPTY))
+      return SIZE_MAX;
+    pos = (pos + step) & mask;
+  }
+}
+
+void AssocArray::insert_new(const InternedKey *key, std::string value)
+{
+  size_t mask = ctrl.size() - 1;
+  size_t pos = (key->hash >> 7) & mask & ~(GROUP - 1);
+  for (size_t step = GROUP;; step += GROUP)
+  {
+    uint32_t m = match_free(&ctrl[pos]);
+    if (m)
+    {
+      size_t i = pos + __builtin_ctz(m);
+      deleted -= ctrl[i] == DELETED;
+      ctrl[i] = key->hash & 0x7F;
+      slots[i] = {key, std::move(value)};
+      ++used;
+      return;
+    }
+    pos = (pos + step) & mask;
+  }
+}
+
+void AssocArray::rehash(size_t capacity)
+{
+  std::vector<int8_t> old_ctrl(capacity, EMPTY);
+  std::vector<Slot> old_slots(capacity);
+  old_ctrl.swap(ctrl);
+  old_slots.swap(slots);
+  used = deleted = 0;
+  for (size_t i = 0; i < old_ctrl.size(); ++i)
+    if (old_ctrl[i] >= 0)
+      insert_new(old_slots[i].key, std::move(old_slots[i].value));
+}
+
+const std::string *AssocArray::get(std::string_view key) const
+{
+  size_t i = find(key, hash_key(key));
+  return i == SIZE_MAX ? nullptr : &slots[i].value;
+}
+
+void AssocArray::set(std::string_view key, std::string value)
+{
+  uint64_t hash = hash_key(key);
+  size_t i = find(key, hash);
+  if (i != SIZE_MAX)
+  {
+    slots[i].value = std::move(value);
+    return;
+  }
+  // At most 7/8 of the slots may be in use or deleted, so every probe
+  // sequence ends at an empty slot. Deleted slots are reclaimed by
+  // rehashing at the same size when they are what fills the table.
+  size_t capacity = ctrl.size();
+  if ((used + deleted + 1) * 8 > capacity * 7)
+    rehash(capacity == 0 ? GROUP : (used + 1) * 16 > capacity * 7 ? capacity * 2 : capacity);
+  insert_new(key_pool.intern(key, hash), std::move(value));
+}
+
+bool AssocArray::erase(std::string_view key)
+{
+  size_t i = find(key, hash_key(key));
+  if (i == SIZE_MAX)
+    return false;
+  ctrl[i] = DELETED;
+  slots[i] = Slot{};
+  --used;
+  ++deleted;
+  return true;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+// An indexed array element: unset (a hole), its own string, or a view into
+// storage the array shares (the buffer mapfile read). A view is only copied
+// into a string of its own when the element is assigned.
+using ArrayElement = std::variant<std::monostate, std::string, std::string_view>;
+
+// Helper: The text of an array element
+inline std::string_view element_text(const ArrayElement &e)
+{
+  if (e.index() == 1)
+    return std::get<1>(e);
+  if (e.index() == 2)
+    return std::get<2>(e);
+  return {};
+}
+
+// An indexed array. Elements live in one contiguous vector, holes marked
+// unset, while the indices in use are dense; an assignment far past the
+// end switches to an ordered map so a[1000000]=x stays cheap.
+class IndexedArray
+{
+public:
+  IndexedArray() = default;
+  explicit IndexedArray(std::vector<ArrayElement> elements);
+
+  // Number of elements set
+  size_t size() const { return count; }
+  // One past the highest index set
+  size_t end_index() const;
+  // The element at i, or null if unset
+  const ArrayElement *get(size_t i) const;
+  void set(size_t i, ArrayElement e);
+  void erase(size_t i);
+  // Makes room for indices below n without reallocating
+  void reserve(size_t n);
+
+  // Calls f(index, element) for each set element in index order
+  template <typename F> void for_each(F &&f) const
+  {
+    if (!is_sparse)
+    {
+      for (size_t i = 0; i < dense.size(); ++i)
+        if (dense[i].index() != 0)
+          f(i, dense[i]);
+    }
+    else
+      for (auto &[i, e] : sparse)
+        f(i, e);
+  }
+
+  // Storage that view elements point into
+  std::shared_ptr<const void> backing;
+
+private:
+  std::vector<ArrayElement> dense;
+  std::map<size_t, ArrayElement> sparse;
+  bool is_sparse = false;
+  size_t count = 0;
+};
+
+// A key stored once in a pool shared by all associative arrays, with its
+// hash, so tables hold a pointer rather than a string of their own
+struct InternedKey
+{
+  uint64_t hash;
+  std::string_view text;
+};
+
+// An associative array: an open-addressing hash table in the style of a
+// Swiss table. A control byte per slot holds 7 bits of the key's hash (or
+// empty/deleted), and lookups compare 16 control bytes at once before
+// touching any key.
+class AssocArray
+{
+public:
+  size_t size() const { return used; }
+  // The value stored under key, or null
+  const std::string *get(std::string_view key) const;
+  void set(std::string_view key, std::string value);
+  bool erase(std::string_view key);
+
+  // Calls f(key, value) for each entry, in table order
+  template <typename F> void for_each(F &&f) const
+  {
+    for (size_t i = 0; i < ctrl.size(); ++i)
+      if (ctrl[i] >= 0)
+        f(slots[i].key->text, slots[i].value);
+  }
+
+private:
+  struct Slot
+  {
+    const InternedKey *key = nullptr;
+    std::string value;
+  };
+  // Slot holding key, or SIZE_MAX
+  size_t find(std::string_view key, uint64_t hash) const;
+  // Puts a key known to be absent into the first free slot on its probe
+  // sequence
+  void insert_new(const InternedKey *key, std::string value);
+  void rehash(size_t capacity);
+
+  std::vector<int8_t> ctrl; // one per slot: EMPTY, DELETED or hash bits
+  std::vector<Slot> slots;
+  size_t used = 0, deleted = 0;
+};
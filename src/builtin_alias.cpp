@@ -0,0 +1,69 @@
+#include "aliases.hpp"
+#include "builtins.hpp"
+
+// Helper: Print an alias as the command that defines it
+static void print_alias(OutBuffer &out, const std::string &name, const Alias &a)
+{
+  out.put("alias ");
+  out.put(name);
+  out.put("='");
+  for (char c : a.text)
+  {
+    if (c == '\'')
+      out.put("'\\''");
+    else
+      out.put(c);
+  }
+  out.put("'\n");
+}
+
+// Builtin: alias [-p] [NAME[=VALUE]...]
+int builtin_alias(std::vector<std::string> &args, Io &io)
+{
+  size_t i = 1;
+  if (i < args.size() && (args[i] == "-p" || args[i] == "--"))
+    ++i;
+  OutBuffer out(io);
+  if (i == args.size())
+  {
+    for (auto &name : alias_names())
+      print_alias(out, name, *find_alias(name));
+    return out.flush() ? 0 : 1;
+  }
+  int status = 0;
+  for (; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    size_t eq = arg.find('=');
+    std::string name = arg.substr(0, eq);
+    if (eq == std::string::npos)
+    {
+      if (const Alias *a = find_alias(name))
+        print_alias(out, name, *a);
+      else
+        status = builtin_error(io, "alias", name + ": not found");
+    }
+    else if (!valid_alias_name(name))
+      status = builtin_error(io, "alias", "'" + name + "': invalid alias name");
+    else
+      set_alias(name, arg.substr(eq + 1));
+  }
+  return out.flush() ? status : 1;
+}
+
+// Builtin: unalias [-a] NAME...
+int builtin_unalias(std::vector<std::string> &args, Io &io)
+{
+  if (args.size() < 2)
+    return builtin_error(io, "unalias", "usage: unalias [-a] name [name ...]", 2);
+  if (args[1] == "-a")
+  {
+    clear_aliases();
+    return 0;
+  }
+  int status = 0;
+  for (size_t i = 1; i < args.size(); ++i)
+    if (!remove_alias(args[i]))
+      status = builtin_error(io, "unalias", args[i] + ": not found");
+  return status;
+}
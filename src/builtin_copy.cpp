@@ -0,0 +1,446 @@
+#include "builtins.hpp"
+#include "walk.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <mutex>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct CopyOptions
+{
+  bool recursive = false;
+  bool preserve = false; // mode, ownership and timestamps
+  bool no_dereference = false;
+};
+
+// Shared state of one cp/mv run; the walk copies files on several threads
+struct CopyJob
+{
+  const char *name; // "cp" or "mv", for messages
+  Io &io;
+  CopyOptions opts{};
+  std::mutex m{};
+  int status = 0;
+  size_t errors = 0;
+  // Directories whose final mode and times are applied once their
+  // contents are in place
+  std::vector<std::pair<std::string, struct stat>> dirs{};
+
+  void fail(const std::string &message)
+  {
+    std::lock_guard<std::mutex> lock(m);
+    status = builtin_error(io, name, message);
+    ++errors;
+  }
+};
+
+// Helper: Apply a source's mode, ownership and timestamps to an open fd
+static void preserve_attributes(int fd, const struct stat &sb)
+{
+  // Ownership may only be kept by root; the mode is still applied
+  if (fchown(fd, sb.st_uid, sb.st_gid) != 0)
+    fchown(fd, -1, sb.st_gid);
+  fchmod(fd, sb.st_mode & 07777);
+  struct timespec times[2] = {sb.st_atim, sb.st_mtim};
+  futimens(fd, times);
+}
+
+// Helper: Copy one regular file's contents: a reflink when the filesystem
+// can share extents, otherwise copy_file_range by way of transfer_fd
+static bool copy_regular(CopyJob &job, int src_dirfd, const char *src_name, const std::string &src_path,
+                         const std::string &dest)
+{
+  int in = openat(src_dirfd, src_name, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+  if (in < 0)
+  {
+    job.fail("cannot open '" + src_path + "' for reading: " + strerror(errno));
+    return false;
+  }
+  struct stat sb;
+  fstat(in, &sb);
+  int out = open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, sb.st_mode & 0777);
+  if (out < 0)
+  {
+    job.fail("cannot create regular file '" + dest + "': " + strerror(errno));
+    close(in);
+    return false;
+  }
+  bool ok = true;
+  if (ioctl(out, FICLONE, in) != 0 && transfer_fd(in, out) < 0)
+  {
+    job.fail("error copying '" + src_path + "' to '" + dest + "': " + strerror(errno));
+    ok = false;
+  }
+  if (ok && job.opts.preserve)
+    preserve_attributes(out, sb);
+  close(in);
+  if (close(out) != 0 && ok)
+  {
+    job.fail("error writing '" + dest + "': " + strerror(errno));
+    ok = false;
+  }
+  return ok;
+}
+
+// Helper: Recreate a symlink at dest
+static bool copy_symlink(CopyJob &job, int src_dirfd, const char *src_name, const std::string &src_path,
+                         const std::string &dest, const struct stat &sb)
+{
+  std::vector<char> target(sb.st_size > 0 ? sb.st_size + 1 : PATH_MAX);
+  ssize_t len = readlinkat(src_dirfd, src_name, target.data(), target.size());
+  if (len < 0)
+  {
+    job.fail("cannot read symbolic link '" + src_path + "': " + strerror(errno));
+    return false;
+  }
+  std::string link(target.data(), len);
+  if (symlink(link.c_str(), dest.c_str()) != 0 && !(errno == EEXIST && unlink(dest.c_str()) == 0 &&
+                                                     symlink(link.c_str(), dest.c_str()) == 0))
+  {
+    job.fail("cannot create symbolic link '" + dest + "': " + strerror(errno));
+    return false;
+  }
+  if (job.opts.preserve)
+  {
+    lchown(dest.c_str(), sb.st_uid, sb.st_gid);
+    struct timespec times[2] = {sb.st_atim, sb.st_mtim};
+    utimensat(AT_FDCWD, dest.c_str(), times, AT_SYMLINK_NOFOLLOW);
+  }
+  return true;
+}
+
+// Helper: Copy one entry of any type. Directories are only created here;
+// their contents are the walk's business. Returns whether to descend.
+static bool copy_entry(CopyJob &job, int src_dirfd, const char *src_name, const std::string &src_path,
+                       const std::string &dest, bool follow)
+{
+  struct stat sb;
+  if (fstatat(src_dirfd, src_name, &sb, follow ? 0 : AT_SYMLINK_NOFOLLOW) != 0)
+  {
+    job.fail("cannot stat '" + src_path + "': " + strerror(errno));
+    return false;
+  }
+  if (S_ISDIR(sb.st_mode))
+  {
+    if (!job.opts.recursive)
+    {
+      job.fail("-r not specified; omitting directory '" + src_path + "'");
+      return false;
+    }
+    // Keep the directory writable while it is filled; its real mode is
+    // applied at the end
+    if (mkdir(dest.c_str(), (sb.st_mode & 07777) | S_IRWXU) != 0)
+    {
+      struct stat db;
+      if (errno != EEXIST || stat(dest.c_str(), &db) != 0 || !S_ISDIR(db.st_mode))
+      {
+        job.fail("cannot create directory '" + dest + "': " + strerror(errno));
+        return false;
+      }
+    }
+    else if (job.opts.preserve || (sb.st_mode & S_IRWXU) != S_IRWXU)
+    {
+      std::lock_guard<std::mutex> lock(job.m);
+      job.dirs.push_back({dest, sb});
+    }
+    return true;
+  }
+  if (S_ISLNK(sb.st_mode))
+    copy_symlink(job, src_dirfd, src_name, src_path, dest, sb);
+  else if (S_ISREG(sb.st_mode))
+    copy_regular(job, src_dirfd, src_name, src_path, dest);
+  else if (S_ISFIFO(sb.st_mode) && job.opts.recursive)
+  {
+    if (mkfifo(dest.c_str(), sb.st_mode & 07777) != 0)
+      job.fail("cannot create fifo '" + dest + "': " + strerror(errno));
+  }
+  else
+    job.fail("cannot copy special file '" + src_path + "'");
+  return false;
+}
+
+// Helper: Copy src to dest, walking directory trees on the parallel walker
+// so files are copied by several threads at once
+static void copy_tree(CopyJob &job, const std::string &src, const std::string &dest)
+{
+  struct stat sb, db;
+  bool follow = !job.opts.no_dereference;
+  if (fstatat(AT_FDCWD, src.c_str(), &sb, follow ? 0 : AT_SYMLINK_NOFOLLOW) != 0)
+  {
+    job.fail("cannot stat '" + src + "': " + strerror(errno));
+    return;
+  }
+  if (stat(dest.c_str(), &db) == 0 && db.st_dev == sb.st_dev && db.st_ino == sb.st_ino)
+  {
+    job.fail("'" + src + "' and '" + dest + "' are the same file");
+    return;
+  }
+  if (!S_ISDIR(sb.st_mode) || !job.opts.recursive)
+  {
+    copy_entry(job, AT_FDCWD, src.c_str(), src, dest, follow);
+    return;
+  }
+  // Refuse to copy a directory into itself, which would never finish
+  char src_real[PATH_MAX], dest_parent[PATH_MAX];
+  std::string parent = dest.substr(0, dest.find_last_of('/') == std::string::npos ? 0 : dest.find_last_of('/'));
+  if (realpath(src.c_str(), src_real) &&
+      realpath(parent.empty() ? (dest[0] == '/' ? "/" : ".") : parent.c_str(), dest_parent))
+  {
+    std::string inside = std::string(dest_parent) + "/";
+    std::string root = std::string(src_real) + "/";
+    if (inside.compare(0, root.size(), root) == 0)
+    {
+      job.fail("cannot copy a directory, '" + src + "', into itself, '" + dest + "'");
+      return;
+    }
+  }
+  WalkOptions wopts;
+  wopts.follow_roots = follow;
+  parallel_walk(
+      {src}, wopts,
+      [&](const WalkEntry &entry, unsigned) {
+        std::string rel = entry.path.substr(std::min(src.size(), entry.path.size()));
+        if (!rel.empty() && rel[0] != '/')
+          rel.insert(0, "/");
+        return copy_entry(job, entry.dirfd, entry.name, entry.path, dest + rel, entry.depth == 0 && follow);
+      },
+      [&](const std::string &path, int err) { job.fail("cannot access '" + path + "': " + strerror(err)); });
+}
+
+// Helper: Give copied directories their final mode (and with -p, owner and
+// times), deepest first so setting times is not undone by later changes
+static void finish_directories(CopyJob &job)
+{
+  std::sort(job.dirs.begin(), job.dirs.end(),
+            [](const auto &a, const auto &b) { return a.first.size() > b.first.size(); });
+  for (auto &[path, sb] : job.dirs)
+  {
+    if (job.opts.preserve)
+    {
+      if (lchown(path.c_str(), sb.st_uid, sb.st_gid) != 0)
+        lchown(path.c_str(), -1, sb.st_gid);
+      chmod(path.c_str(), sb.st_mode & 07777);
+      struct timespec times[2] = {sb.st_atim, sb.st_mtim};
+      utimensat(AT_FDCWD, path.c_str(), times, 0);
+    }
+    else
+    {
+      mode_t mask = umask(0);
+      umask(mask);
+      chmod(path.c_str(), sb.st_mode & 07777 & ~mask);
+    }
+  }
+  job.dirs.clear();
+}
+
+// Helper: Where each source goes: into dest if it is a directory, else to
+// dest itself (only allowed for a single source)
+static bool copy_destinations(CopyJob &job, const std::vector<std::string> &operands,
+                              std::vector<std::pair<std::string, std::string>> &pairs)
+{
+  if (operands.size() < 2)
+  {
+    builtin_error(job.io, job.name,
+                  operands.empty() ? "missing file operand" : "missing destination file operand after '" + operands[0] + "'");
+    return false;
+  }
+  const std::string &dest = operands.back();
+  struct stat db;
+  bool dest_is_dir = stat(dest.c_str(), &db) == 0 && S_ISDIR(db.st_mode);
+  if (!dest_is_dir && operands.size() > 2)
+  {
+    builtin_error(job.io, job.name, "target '" + dest + "' is not a directory");
+    return false;
+  }
+  for (size_t i = 0; i + 1 < operands.size(); ++i)
+  {
+    const std::string &src = operands[i];
+    if (!dest_is_dir)
+    {
+      pairs.push_back({src, dest});
+      continue;
+    }
+    size_t end = src.find_last_not_of('/');
+    std::string base = end == std::string::npos ? "/" : src.substr(0, end + 1);
+    base = base.substr(base.find_last_of('/') == std::string::npos ? 0 : base.find_last_of('/') + 1);
+    pairs.push_back({src, dest + (dest.back() == '/' ? "" : "/") + base});
+  }
+  return true;
+}
+
+// Builtin: cp [-r] [-p] [-a] SOURCE... DEST
+int builtin_cp(std::vector<std::string> &args, Io &io)
+{
+  CopyJob job{.name = "cp", .io = io};
+  std::vector<std::string> operands;
+  bool options_done = false;
+  for (size_t i = 1; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (options_done || arg.size() < 2 || arg[0] != '-')
+    {
+      operands.push_back(arg);
+      continue;
+    }
+    if (arg == "--")
+    {
+      options_done = true;
+      continue;
+    }
+    for (size_t j = 1; j < arg.size(); ++j)
+    {
+      switch (arg[j])
+      {
+      case 'r':
+      case 'R':
+        job.opts.recursive = job.opts.no_dereference = true;
+        break;
+      case 'p':
+        job.opts.preserve = true;
+        break;
+      case 'a':
+        job.opts.recursive = job.opts.preserve = job.opts.no_dereference = true;
+        break;
+      case 'P':
+        job.opts.no_dereference = true;
+        break;
+      case 'L':
+        job.opts.no_dereference = false;
+        break;
+      default:
+        return unsupported_option(args, io, std::string("invalid option -- '") + arg[j] + "'");
+      }
+    }
+  }
+  std::vector<std::pair<std::string, std::string>> pairs;
+  if (!copy_destinations(job, operands, pairs))
+    return 1;
+  for (auto &[src, dest] : pairs)
+    copy_tree(job, src, dest);
+  finish_directories(job);
+  return job.status;
+}
+
+// Helper: Delete a tree that has been copied elsewhere. Files go on the
+// walker's threads; directories are removed afterwards, deepest first.
+static bool remove_tree(CopyJob &job, const std::string &path)
+{
+  struct stat sb;
+  if (lstat(path.c_str(), &sb) != 0)
+    return false;
+  if (!S_ISDIR(sb.st_mode))
+    return unlink(path.c_str()) == 0;
+  std::vector<std::string> dirs;
+  std::mutex m;
+  bool ok = true;
+  parallel_walk(
+      {path}, WalkOptions{},
+      [&](const WalkEntry &entry, unsigned) {
+        if (entry.type == DT_DIR)
+        {
+          std::lock_guard<std::mutex> lock(m);
+          dirs.push_back(entry.path);
+          return true;
+        }
+        if (unlinkat(entry.dirfd, entry.name, 0) != 0)
+        {
+          // DT_UNKNOWN directories show up as EISDIR here
+          if (errno == EISDIR)
+          {
+            std::lock_guard<std::mutex> lock(m);
+            dirs.push_back(entry.path);
+            return true;
+          }
+          job.fail("cannot remove '" + entry.path + "': " + strerror(errno));
+          ok = false;
+        }
+        return false;
+      },
+      [&](const std::string &p, int err) {
+        job.fail("cannot remove '" + p + "': " + strerror(err));
+        ok = false;
+      });
+  std::sort(dirs.begin(), dirs.end(), [](const std::string &a, const std::string &b) { return a.size() > b.size(); });
+  for (auto &d : dirs)
+    if (rmdir(d.c_str()) != 0)
+    {
+      job.fail("cannot remove '" + d + "': " + strerror(errno));
+      ok = false;
+    }
+  return ok;
+}
+
+// Builtin: mv [-n] SOURCE... DEST
+int builtin_mv(std::vector<std::string> &args, Io &io)
+{
+  CopyJob job{.name = "mv", .io = io};
+  job.opts.recursive = job.opts.preserve = job.opts.no_dereference = true;
+  bool no_clobber = false;
+  std::vector<std::string> operands;
+  bool options_done = false;
+  for (size_t i = 1; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (options_done || arg.size() < 2 || arg[0] != '-')
+    {
+      operands.push_back(arg);
+      continue;
+    }
+    if (arg == "--")
+    {
+      options_done = true;
+      continue;
+    }
+    for (size_t j = 1; j < arg.size(); ++j)
+    {
+      if (arg[j] == 'n')
+        no_clobber = true;
+      else if (arg[j] == 'f')
+        no_clobber = false;
+      else
+        return unsupported_option(args, io, std::string("invalid option -- '") + arg[j] + "'");
+    }
+  }
+  std::vector<std::pair<std::string, std::string>> pairs;
+  if (!copy_destinations(job, operands, pairs))
+    return 1;
+  for (auto &[src, dest] : pairs)
+  {
+    struct stat sb, db;
+    if (lstat(src.c_str(), &sb) != 0)
+    {
+      job.fail("cannot stat '" + src + "': " + strerror(errno));
+      continue;
+    }
+    bool dest_exists = lstat(dest.c_str(), &db) == 0;
+    if (dest_exists && no_clobber)
+      continue;
+    if (dest_exists && db.st_dev == sb.st_dev && db.st_ino == sb.st_ino)
+    {
+      job.fail("'" + src + "' and '" + dest + "' are the same file");
+      continue;
+    }
+    if (renameat2(AT_FDCWD, src.c_str(), AT_FDCWD, dest.c_str(), no_clobber ? RENAME_NOREPLACE : 0) == 0)
+      continue;
+    if (errno != EXDEV)
+    {
+      job.fail("cannot move '" + src + "' to '" + dest + "': " + strerror(errno));
+      continue;
+    }
+    // Across filesystems: copy everything with attributes, then delete
+    size_t errors = job.errors;
+    copy_tree(job, src, dest);
+    finish_directories(job);
+    if (job.errors == errors)
+      remove_tree(job, src);
+  }
+  return job.status;
+}
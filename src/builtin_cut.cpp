@@ -0,0 +1,324 @@
+#include "builtins.hpp"
+#include "simd.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+// Selected fields or byte positions (1-based) from a LIST like "1,3-5,7-"
+struct CutList
+{
+  std::vector<std::pair<size_t, size_t>> ranges; // sorted, merged, inclusive
+  std::vector<char> selected;                    // fast lookup below open_from
+  size_t open_from = SIZE_MAX;                   // every index >= this is selected
+
+  bool contains(size_t i) const { return i >= open_from || (i < selected.size() && selected[i]); }
+};
+
+// Helper: Parse a cut LIST; returns an error message, or "" on success
+static std::string parse_cut_list(const std::string &spec, CutList &list)
+{
+  size_t start = 0;
+  while (start <= spec.size())
+  {
+    size_t comma = spec.find(',', start);
+    std::string part = spec.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+    start = comma == std::string::npos ? spec.size() + 1 : comma + 1;
+    size_t dash = part.find('-');
+    auto number = [](const std::string &s, size_t &n) {
+      if (s.empty() || s.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+      n = std::stoull(s);
+      return true;
+    };
+    size_t lo, hi;
+    if (dash == std::string::npos)
+    {
+      if (!number(part, lo))
+        return "invalid field value '" + part + "'";
+      hi = lo;
+    }
+    else
+    {
+      std::string a = part.substr(0, dash), b = part.substr(dash + 1);
+      if (a.empty() && b.empty())
+        return "invalid range with no endpoint: -";
+      if (a.empty())
+        lo = 1;
+      else if (!number(a, lo))
+        return "invalid field range";
+      if (b.empty())
+        hi = SIZE_MAX;
+      else if (!number(b, hi))
+        return "invalid field range";
+      if (hi < lo)
+        return "invalid decreasing range";
+    }
+    if (lo == 0)
+      return "fields and positions are numbered from 1";
+    list.ranges.push_back({lo, hi});
+  }
+  std::sort(list.ranges.begin(), list.ranges.end());
+  std::vector<std::pair<size_t, size_t>> merged;
+  for (auto &r : list.ranges)
+  {
+    if (!merged.empty() && (merged.back().second == SIZE_MAX || r.first <= merged.back().second + 1))
+      merged.back().second = std::max(merged.back().second, r.second);
+    else
+      merged.push_back(r);
+  }
+  list.ranges = merged;
+  size_t bound = 0;
+  for (auto &r : list.ranges)
+  {
+    if (r.second == SIZE_MAX)
+      list.open_from = std::min(list.open_from, r.first);
+    else
+      bound = std::max(bound, r.second);
+  }
+  list.selected.assign(std::min(bound, list.open_from) + 1, 0);
+  for (auto &r : list.ranges)
+    for (size_t i = r.first; i < list.selected.size() && i <= r.second; ++i)
+      list.selected[i] = 1;
+  return "";
+}
+
+struct CutOptions
+{
+  CutList list;
+  bool fields = false, suppress = false;
+  char delim = '\t';
+  std::string out_delim;
+  bool have_out_delim = false;
+};
+
+// Delimiters and newlines are indexed this many bytes at a time
+static const size_t CUT_INDEX_CHUNK = 1 << 16;
+
+// Helper: cut -f over a block of whole lines. Every delimiter and newline
+// is located with a vector scan first; fields are then copied out between
+// consecutive positions without looking at the bytes in between.
+static void cut_fields(const char *p, size_t len, const CutOptions &opts, OutBuffer &out,
+                       std::vector<uint32_t> &positions)
+{
+  const std::string_view out_delim = opts.out_delim;
+  const char *line_start = p, *field_start = p;
+  size_t field = 1;
+  bool printed = false, has_delim = false;
+  auto end_line = [&](const char *nl) {
+    if (!has_delim)
+    {
+      if (!opts.suppress)
+      {
+        out.put(std::string_view(line_start, nl - line_start));
+        out.put('\n');
+      }
+    }
+    else
+    {
+      if (opts.list.contains(field))
+      {
+        if (printed)
+          out.put(out_delim);
+        out.put(std::string_view(field_start, nl - field_start));
+      }
+      out.put('\n');
+    }
+    line_start = field_start = nl + 1;
+    field = 1;
+    printed = has_delim = false;
+  };
+  for (size_t base = 0; base < len; base += CUT_INDEX_CHUNK)
+  {
+    size_t chunk = std::min(CUT_INDEX_CHUNK, len - base);
+    size_t n = index_bytes(p + base, chunk, opts.delim, '\n', positions.data());
+    for (size_t k = 0; k < n; ++k)
+    {
+      const char *at = p + base + positions[k];
+      if (*at == '\n')
+      {
+        end_line(at);
+        continue;
+      }
+      has_delim = true;
+      if (opts.list.contains(field))
+      {
+        if (printed)
+          out.put(out_delim);
+        out.put(std::string_view(field_start, at - field_start));
+        printed = true;
+      }
+      ++field;
+      field_start = at + 1;
+    }
+  }
+  if (line_start < p + len)
+    end_line(p + len);
+}
+
+// Helper: cut -b/-c over a block of whole lines
+static void cut_bytes(const char *p, size_t len, const CutOptions &opts, OutBuffer &out,
+                      std::vector<uint32_t> &positions)
+{
+  const char *line_start = p;
+  auto end_line = [&](const char *nl) {
+    size_t line_len = nl - line_start;
+    bool printed = false;
+    for (auto &r : opts.list.ranges)
+    {
+      if (r.first > line_len)
+        break;
+      size_t hi = std::min(r.second, line_len);
+      if (printed && opts.have_out_delim)
+        out.put(opts.out_delim);
+      out.put(std::string_view(line_start + r.first - 1, hi - r.first + 1));
+      printed = true;
+    }
+    out.put('\n');
+    line_start = nl + 1;
+  };
+  for (size_t base = 0; base < len; base += CUT_INDEX_CHUNK)
+  {
+    size_t chunk = std::min(CUT_INDEX_CHUNK, len - base);
+    size_t n = index_bytes(p + base, chunk, '\n', '\n', positions.data());
+    for (size_t k = 0; k < n; ++k)
+      end_line(p + base + positions[k]);
+  }
+  if (line_start < p + len)
+    end_line(p + len);
+}
+
+// Builtin: cut -f LIST [-d DELIM] [-s] | -b LIST | -c LIST [--output-delimiter=STR] [FILE...]
+int builtin_cut(std::vector<std::string> &args, Io &io)
+{
+  CutOptions opts;
+  std::string list_spec;
+  bool have_list = false, have_delim = false;
+  std::vector<std::string> files;
+  bool options_done = false;
+  for (size_t i = 1; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (options_done || arg.size() < 2 || arg[0] != '-')
+    {
+      files.push_back(arg);
+      continue;
+    }
+    if (arg == "--")
+    {
+      options_done = true;
+      continue;
+    }
+    if (arg.compare(0, 2, "--") == 0)
+    {
+      size_t eq = arg.find('=');
+      std::string name = arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+      std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+      if (name == "output-delimiter" && eq != std::string::npos)
+      {
+        opts.out_delim = value;
+        opts.have_out_delim = true;
+      }
+      else if ((name == "delimiter" || name == "fields" || name == "bytes" || name == "characters") &&
+               eq != std::string::npos)
+      {
+        if (name == "delimiter")
+        {
+          if (value.size() != 1)
+            return builtin_error(io, "cut", "the delimiter must be a single character");
+          opts.delim = value[0];
+          have_delim = true;
+        }
+        else
+        {
+          if (have_list)
+            return builtin_error(io, "cut", "only one type of list may be specified");
+          list_spec = value;
+          have_list = true;
+          opts.fields = name == "fields";
+        }
+      }
+      else if (name == "only-delimited")
+        opts.suppress = true;
+      else
+        return unsupported_option(args, io, "unrecognized option '" + arg + "'");
+      continue;
+    }
+    for (size_t j = 1; j < arg.size(); ++j)
+    {
+      char opt = arg[j];
+      if (opt == 's')
+      {
+        opts.suppress = true;
+        continue;
+      }
+      if (opt == 'n')
+        continue;
+      if (opt != 'd' && opt != 'f' && opt != 'b' && opt != 'c')
+        return unsupported_option(args, io, std::string("invalid option -- '") + opt + "'");
+      std::string value;
+      if (j + 1 < arg.size())
+        value = arg.substr(j + 1);
+      else if (i + 1 < args.size())
+        value = args[++i];
+      else
+        return builtin_error(io, "cut", std::string("option requires an argument -- '") + opt + "'");
+      j = arg.size();
+      if (opt == 'd')
+      {
+        if (value.size() != 1)
+          return builtin_error(io, "cut", "the delimiter must be a single character");
+        opts.delim = value[0];
+        have_delim = true;
+      }
+      else
+      {
+        if (have_list)
+          return builtin_error(io, "cut", "only one type of list may be specified");
+        list_spec = value;
+        have_list = true;
+        opts.fields = opt == 'f';
+      }
+    }
+  }
+  if (!have_list)
+    return builtin_error(io, "cut", "you must specify a list of bytes, characters, or fields");
+  if (!opts.fields && (have_delim || opts.suppress))
+    return builtin_error(io, "cut", "an input delimiter may be specified only when operating on fields");
+  std::string err = parse_cut_list(list_spec, opts.list);
+  if (!err.empty())
+    return builtin_error(io, "cut", err);
+  if (opts.fields && !opts.have_out_delim)
+    opts.out_delim = std::string(1, opts.delim);
+  if (files.empty())
+    files.push_back("-");
+
+  OutBuffer out(io, 1 << 20);
+  std::vector<uint32_t> positions(CUT_INDEX_CHUNK);
+  int status = 0;
+  for (auto &file : files)
+  {
+    int fd = open_input(file, io);
+    if (fd < 0)
+    {
+      status = builtin_error(io, "cut", file + ": " + strerror(errno));
+      continue;
+    }
+    bool ok = read_line_blocks(fd, [&](const char *p, size_t len) {
+      if (opts.fields)
+        cut_fields(p, len, opts, out, positions);
+      else
+        cut_bytes(p, len, opts, out, positions);
+      return (input_ready(fd) || out.flush()) && out.ok();
+    });
+    if (!ok)
+      status = builtin_error(io, "cut", file + ": " + strerror(errno));
+    close_input(fd, io);
+    if (!out.ok())
+      return 1;
+  }
+  if (!out.flush())
+    return 1;
+  return status;
+}
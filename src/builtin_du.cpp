@@ -0,0 +1,249 @@
+#include "builtins.hpp"
+#include "walk.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unordered_set>
+
+// A directory (or file operand) whose usage du reports
+struct DuNode
+{
+  DuNode *parent;
+  std::string path;
+  int depth;
+  std::atomic<uint64_t> bytes{0}; // own size plus its non-directory entries
+  uint64_t total = 0;             // bytes plus every subdirectory's total
+  std::vector<DuNode *> children;
+
+  DuNode(DuNode *parent, std::string path, int depth) : parent(parent), path(std::move(path)), depth(depth) {}
+};
+
+// Hard-linked inodes already counted. Split into independently locked
+// shards so the walker threads rarely wait on one another.
+class InodeSet
+{
+public:
+  // Returns false if (dev, ino) was already present
+  bool insert(uint64_t dev, uint64_t ino)
+  {
+    uint64_t key = ino * 0x9E3779B97F4A7C15ull ^ dev;
+    Shard &shard = shards[(key >> 32) % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.m);
+    return shard.set.insert({dev, ino}).second;
+  }
+
+private:
+  struct Key
+  {
+    uint64_t dev, ino;
+    bool operator==(const Key &o) const { return dev == o.dev && ino == o.ino; }
+  };
+  struct KeyHash
+  {
+    size_t operator()(const Key &k) const { return k.ino * 0x9E3779B97F4A7C15ull ^ k.dev; }
+  };
+  struct Shard
+  {
+    std::mutex m;
+    std::unordered_set<Key, KeyHash> set;
+  };
+  static const size_t SHARDS = 64;
+  Shard shards[SHARDS];
+};
+
+// Helper: du -h size: one decimal below 10, rounded up like du does
+static std::string du_human_size(uint64_t bytes)
+{
+  static const char units[] = "KMGTPE";
+  if (bytes < 1024)
+    return std::to_string(bytes);
+  double value = bytes;
+  int unit = -1;
+  while (value >= 1024 && unit < 5)
+  {
+    value /= 1024;
+    ++unit;
+  }
+  char out[32];
+  if (value < 10)
+  {
+    value = std::ceil(value * 10) / 10;
+    if (value >= 10)
+      snprintf(out, sizeof(out), "%.0f%c", value, units[unit]);
+    else
+      snprintf(out, sizeof(out), "%.1f%c", value, units[unit]);
+  }
+  else
+  {
+    value = std::ceil(value);
+    if (value >= 1024 && unit < 5)
+      snprintf(out, sizeof(out), "1.0%c", units[unit + 1]);
+    else
+      snprintf(out, sizeof(out), "%.0f%c", value, units[unit]);
+  }
+  return out;
+}
+
+// Builtin: du [-s] [-h] [-d N] [--apparent-size] [FILE...]
+int builtin_du(std::vector<std::string> &args, Io &io)
+{
+  bool summarize = false, human = false, apparent = false;
+  int max_depth = -1;
+  std::vector<std::string> roots;
+  bool options_done = false;
+  for (size_t i = 1; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (options_done || arg.size() < 2 || arg[0] != '-')
+    {
+      roots.push_back(arg);
+      continue;
+    }
+    if (arg == "--")
+      options_done = true;
+    else if (arg == "--apparent-size")
+      apparent = true;
+    else if (arg == "--summarize")
+      summarize = true;
+    else if (arg == "--human-readable")
+      human = true;
+    else if (arg.compare(0, 12, "--max-depth=") == 0)
+    {
+      std::string value = arg.substr(12);
+      if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+        return builtin_error(io, "du", "invalid maximum depth '" + value + "'");
+      max_depth = std::stoi(value);
+    }
+    else if (arg[1] == '-')
+      return unsupported_option(args, io, "unrecognized option '" + arg + "'");
+    else
+      for (size_t j = 1; j < arg.size(); ++j)
+      {
+        char opt = arg[j];
+        if (opt == 's')
+          summarize = true;
+        else if (opt == 'h')
+          human = true;
+        else if (opt == 'd')
+        {
+          std::string value;
+          if (j + 1 < arg.size())
+            value = arg.substr(j + 1);
+          else if (i + 1 < args.size())
+            value = args[++i];
+          else
+            return builtin_error(io, "du", "option requires an argument -- 'd'");
+          if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+            return builtin_error(io, "du", "invalid maximum depth '" + value + "'");
+          max_depth = std::stoi(value);
+          break;
+        }
+        else
+          return unsupported_option(args, io, std::string("invalid option -- '") + opt + "'");
+      }
+  }
+  if (summarize && max_depth > 0)
+    return builtin_error(io, "du", "cannot both summarize and show all entries");
+  if (summarize)
+    max_depth = 0;
+  if (roots.empty())
+    roots.push_back(".");
+
+  WalkOptions opts;
+  unsigned workers = walk_threads(opts);
+  InodeSet seen;
+  // With several operands every inode counts once, so an operand inside
+  // another one (or named twice) is not added again
+  bool count_once = roots.size() > 1;
+  std::mutex err_mutex;
+  int status = 0;
+  OutBuffer out(io);
+  for (auto &root : roots)
+  {
+    // Nodes are created on the walker threads, each into its own list
+    std::vector<std::vector<std::unique_ptr<DuNode>>> created(workers);
+    DuNode *root_node = nullptr;
+    parallel_walk(
+        {root}, opts,
+        [&](const WalkEntry &entry, unsigned worker) {
+          struct statx sx;
+          unsigned mask = STATX_TYPE | STATX_NLINK | STATX_INO | (apparent ? STATX_SIZE : STATX_BLOCKS);
+          if (statx(entry.dirfd, entry.name, AT_SYMLINK_NOFOLLOW, mask, &sx) != 0)
+          {
+            std::lock_guard<std::mutex> lock(err_mutex);
+            status = builtin_error(io, "du", "cannot access '" + entry.path + "': " + strerror(errno));
+            return false;
+          }
+          uint64_t size = apparent ? sx.stx_size : sx.stx_blocks * 512;
+          bool dir = S_ISDIR(sx.stx_mode);
+          // A hard-linked file counts once, wherever it is found first; an
+          // entry already counted is skipped whole, with nothing reported
+          if ((count_once || (!dir && sx.stx_nlink > 1)) &&
+              !seen.insert(makedev(sx.stx_dev_major, sx.stx_dev_minor), sx.stx_ino))
+            return false;
+          auto *parent = static_cast<DuNode *>(entry.parent_data);
+          if (dir || !parent)
+          {
+            created[worker].push_back(std::make_unique<DuNode>(parent, entry.path, entry.depth));
+            DuNode *node = created[worker].back().get();
+            node->bytes.fetch_add(size, std::memory_order_relaxed);
+            if (entry.depth == 0)
+              root_node = node;
+            entry.data = node;
+            return dir;
+          }
+          parent->bytes.fetch_add(size, std::memory_order_relaxed);
+          return false;
+        },
+        [&](const std::string &path, int err) {
+          // The walker reports a root it cannot stat through here too
+          std::lock_guard<std::mutex> lock(err_mutex);
+          std::string what = root_node ? "cannot read directory '" : "cannot access '";
+          status = builtin_error(io, "du", what + path + "': " + strerror(err));
+        });
+    if (!root_node)
+      continue;
+
+    // Totals are summed bottom-up, deepest directories first
+    std::vector<DuNode *> nodes;
+    for (auto &list : created)
+      for (auto &n : list)
+        nodes.push_back(n.get());
+    std::sort(nodes.begin(), nodes.end(), [](const DuNode *a, const DuNode *b) { return a->depth > b->depth; });
+    for (DuNode *n : nodes)
+    {
+      n->total += n->bytes.load(std::memory_order_relaxed);
+      if (n->parent)
+      {
+        n->parent->total += n->total;
+        n->parent->children.push_back(n);
+      }
+    }
+
+    // Report directories after their contents, siblings in name order
+    auto print = [&](auto &self, DuNode *n) -> void {
+      std::sort(n->children.begin(), n->children.end(),
+                [](const DuNode *a, const DuNode *b) { return a->path < b->path; });
+      for (DuNode *child : n->children)
+        self(self, child);
+      if (max_depth >= 0 && n->depth > max_depth)
+        return;
+      out.put(human ? du_human_size(n->total) : std::to_string((n->total + 1023) / 1024));
+      out.put('\t');
+      out.put(n->path);
+      out.put('\n');
+    };
+    print(print, root_node);
+  }
+  if (!out.flush())
+    return 1;
+  return status;
+}
@@ -0,0 +1,286 @@
+#include "builtins.hpp"
+#include "walk.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <mutex>
+#include <sys/stat.h>
+
+// One test of a find expression; all tests must pass (implicit -a)
+struct FindTest
+{
+  enum Kind
+  {
+    Name,
+    IName,
+    Type,
+    Newer,
+    Size
+  } kind;
+  bool negate = false;
+  std::string pattern;     // -name, -iname
+  std::string types;       // -type, e.g. "f" or "f,d"
+  struct timespec mtime{}; // -newer
+  int size_cmp = 0;        // -size: -1 less than, 0 exactly, +1 more than
+  off_t size_units = 0, unit = 512;
+};
+
+// Entry being tested, stat'ed only when a test actually needs it
+struct FindCandidate
+{
+  const WalkEntry &entry;
+  bool have_stat = false, stat_failed = false;
+  struct stat sb{};
+
+  const struct stat *get_stat()
+  {
+    if (!have_stat)
+    {
+      have_stat = true;
+      stat_failed = fstatat(entry.dirfd, entry.name, &sb, AT_SYMLINK_NOFOLLOW) != 0;
+    }
+    return stat_failed ? nullptr : &sb;
+  }
+
+  char type_letter()
+  {
+    unsigned char t = entry.type;
+    if (t == DT_UNKNOWN)
+    {
+      const struct stat *st = get_stat();
+      if (!st)
+        return '?';
+      t = IFTODT(st->st_mode);
+    }
+    switch (t)
+    {
+    case DT_REG:
+      return 'f';
+    case DT_DIR:
+      return 'd';
+    case DT_LNK:
+      return 'l';
+    case DT_BLK:
+      return 'b';
+    case DT_CHR:
+      return 'c';
+    case DT_FIFO:
+      return 'p';
+    case DT_SOCK:
+      return 's';
+    default:
+      return '?';
+    }
+  }
+};
+
+static const char *base_name(const std::string &path)
+{
+  size_t end = path.find_last_not_of('/');
+  if (end == std::string::npos)
+    return "/";
+  size_t slash = path.rfind('/', end);
+  return path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+static bool run_test(const FindTest &test, FindCandidate &c)
+{
+  bool result = false;
+  switch (test.kind)
+  {
+  case FindTest::Name:
+  case FindTest::IName:
+  {
+    // Roots are matched on their last component, minus trailing slashes
+    std::string root_name;
+    const char *name = c.entry.name;
+    if (c.entry.depth == 0)
+    {
+      root_name = base_name(c.entry.path);
+      if (root_name.size() > 1)
+        root_name.erase(root_name.find_last_not_of('/') + 1);
+      name = root_name.c_str();
+    }
+    result = fnmatch(test.pattern.c_str(), name, test.kind == FindTest::IName ? FNM_CASEFOLD : 0) == 0;
+    break;
+  }
+  case FindTest::Type:
+    result = test.types.find(c.type_letter()) != std::string::npos;
+    break;
+  case FindTest::Newer:
+  {
+    const struct stat *st = c.get_stat();
+    result = st && (st->st_mtim.tv_sec > test.mtime.tv_sec ||
+                    (st->st_mtim.tv_sec == test.mtime.tv_sec && st->st_mtim.tv_nsec > test.mtime.tv_nsec));
+    break;
+  }
+  case FindTest::Size:
+  {
+    const struct stat *st = c.get_stat();
+    if (!st)
+      break;
+    // Sizes are rounded up to whole units, as find does
+    off_t units = (st->st_size + test.unit - 1) / test.unit;
+    result = test.size_cmp < 0 ? units < test.size_units
+             : test.size_cmp > 0 ? units > test.size_units
+                                 : units == test.size_units;
+    break;
+  }
+  }
+  return result != test.negate;
+}
+
+// Builtin: find [PATH...] [-name PAT] [-iname PAT] [-type T] [-newer FILE]
+//               [-size [+-]N[cwbkMG]] [-mindepth N] [-maxdepth N] [-print] [-print0]
+int builtin_find(std::vector<std::string> &args, Io &io)
+{
+  std::vector<std::string> roots;
+  size_t i = 1;
+  for (; i < args.size() && args[i][0] != '-' && args[i] != "!" && args[i] != "("; ++i)
+    roots.push_back(args[i]);
+  if (roots.empty())
+    roots.push_back(".");
+
+  std::vector<FindTest> tests;
+  int min_depth = 0, max_depth = -1;
+  char terminator = '\n';
+  bool negate_next = false;
+  for (; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (arg == "!" || arg == "-not")
+    {
+      negate_next = !negate_next;
+      continue;
+    }
+    if (arg == "-print" || arg == "-print0")
+    {
+      terminator = arg == "-print0" ? '\0' : '\n';
+      continue;
+    }
+    if (arg == "-a" || arg == "-and")
+      continue;
+    // Every other test implemented here takes a value; the rest (-o, -exec,
+    // -delete, parentheses...) are left to find itself
+    if (arg != "-name" && arg != "-iname" && arg != "-type" && arg != "-newer" && arg != "-size" &&
+        arg != "-mindepth" && arg != "-maxdepth")
+      return unsupported_option(args, io, "unknown predicate `" + arg + "'");
+    if (i + 1 >= args.size())
+      return builtin_error(io, "find", "missing argument to `" + arg + "'");
+    const std::string &value = args[++i];
+    FindTest test;
+    test.negate = negate_next;
+    negate_next = false;
+    if (arg == "-name" || arg == "-iname")
+    {
+      test.kind = arg == "-name" ? FindTest::Name : FindTest::IName;
+      test.pattern = value;
+    }
+    else if (arg == "-type")
+    {
+      test.kind = FindTest::Type;
+      for (size_t k = 0; k < value.size(); k += 2)
+      {
+        if (!strchr("fdlbcps", value[k]) || (k + 1 < value.size() && value[k + 1] != ','))
+          return builtin_error(io, "find", "Unknown argument to -type: " + value);
+        test.types += value[k];
+      }
+    }
+    else if (arg == "-newer")
+    {
+      test.kind = FindTest::Newer;
+      struct stat sb;
+      if (stat(value.c_str(), &sb) != 0)
+        return builtin_error(io, "find", "'" + value + "': " + strerror(errno));
+      test.mtime = sb.st_mtim;
+    }
+    else if (arg == "-size")
+    {
+      test.kind = FindTest::Size;
+      size_t k = 0;
+      if (k < value.size() && (value[k] == '+' || value[k] == '-'))
+        test.size_cmp = value[k++] == '+' ? 1 : -1;
+      size_t digits = k;
+      while (k < value.size() && isdigit((unsigned char)value[k]))
+        test.size_units = test.size_units * 10 + (value[k++] - '0');
+      if (k == digits)
+        return builtin_error(io, "find", "invalid argument `" + value + "' to `-size'");
+      if (k < value.size())
+      {
+        const char *suffix = strchr("cwbkMG", value[k]);
+        static const off_t units[] = {1, 2, 512, 1024, 1 << 20, 1 << 30};
+        if (!suffix || k + 1 != value.size())
+          return builtin_error(io, "find", "invalid argument `" + value + "' to `-size'");
+        test.unit = units[suffix - "cwbkMG"];
+      }
+    }
+    else
+    {
+      // -mindepth or -maxdepth
+      int n;
+      try
+      {
+        n = std::stoi(value);
+      }
+      catch (...)
+      {
+        n = -1;
+      }
+      if (n < 0)
+        return builtin_error(io, "find", "Expected a positive decimal integer argument to " + arg);
+      (arg == "-mindepth" ? min_depth : max_depth) = n;
+      continue;
+    }
+    tests.push_back(test);
+  }
+
+  // Matches are collected per worker and written in large pieces under a
+  // lock, so lines from different workers never interleave
+  WalkOptions opts;
+  std::vector<std::string> pending(walk_threads(opts));
+  std::mutex out_mutex;
+  bool write_failed = false;
+  auto flush = [&](std::string &buf) {
+    std::lock_guard<std::mutex> lock(out_mutex);
+    if (!write_failed && !io.write(buf))
+      write_failed = true;
+    buf.clear();
+  };
+  int status = 0;
+  std::mutex err_mutex;
+  parallel_walk(
+      roots, opts,
+      [&](const WalkEntry &entry, unsigned worker) {
+        if (entry.depth >= min_depth)
+        {
+          FindCandidate candidate{.entry = entry};
+          bool match = true;
+          for (auto &test : tests)
+            if (!run_test(test, candidate))
+            {
+              match = false;
+              break;
+            }
+          if (match)
+          {
+            std::string &buf = pending[worker];
+            buf += entry.path;
+            buf += terminator;
+            if (buf.size() >= (1 << 16))
+              flush(buf);
+          }
+        }
+        return max_depth < 0 || entry.depth < max_depth;
+      },
+      [&](const std::string &path, int err) {
+        std::lock_guard<std::mutex> lock(err_mutex);
+        status = builtin_error(io, "find", "'" + path + "': " + strerror(err));
+      });
+  for (auto &buf : pending)
+    if (!buf.empty())
+      flush(buf);
+  return write_failed ? 1 : status;
+}
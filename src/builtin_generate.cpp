@@ -0,0 +1,301 @@
+#include "builtins.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// A seq operand: its value, and how it was written, which decides the
+// default output precision and whether the integer fast path applies
+struct SeqNumber
+{
+  long double value = 0;
+  std::string digits; // set for plain non-negative integers
+  size_t width = 0;   // as written, leading zeros included
+  int precision = 0;  // digits after the decimal point
+};
+
+// Helper: Parse a seq operand
+static bool parse_seq_number(const std::string &s, SeqNumber &num)
+{
+  num = SeqNumber{};
+  if (s.empty())
+    return false;
+  char *end;
+  num.value = strtold(s.c_str(), &end);
+  if (*end != '\0' || std::isnan(num.value))
+    return false;
+  size_t dot = s.find('.');
+  if (dot != std::string::npos && s.find_first_of("eExXpP") == std::string::npos)
+    num.precision = s.size() - dot - 1;
+  // Plain non-negative integers of any length take the decimal fast path
+  if (s.find_first_not_of("0123456789") == std::string::npos)
+  {
+    size_t nonzero = s.find_first_not_of('0');
+    num.digits = nonzero == std::string::npos ? "0" : s.substr(nonzero);
+    num.width = s.size();
+  }
+  return true;
+}
+
+// Helper: Check that a seq -f format has exactly one floating-point
+// conversion, and give it the L modifier it needs for a long double
+static bool prepare_seq_format(const std::string &format, std::string &out)
+{
+  bool seen = false;
+  for (size_t i = 0; i < format.size(); ++i)
+  {
+    out += format[i];
+    if (format[i] != '%')
+      continue;
+    if (i + 1 < format.size() && format[i + 1] == '%')
+    {
+      out += format[++i];
+      continue;
+    }
+    if (seen)
+      return false;
+    seen = true;
+    size_t j = i + 1;
+    while (j < format.size() && strchr("-+ #0'", format[j]))
+      ++j;
+    while (j < format.size() && (isdigit((unsigned char)format[j]) || format[j] == '.'))
+      ++j;
+    if (j >= format.size() || !strchr("eEfFgGaA", format[j]))
+      return false;
+    out.append(format, i + 1, j - i - 1);
+    out += 'L';
+    out += format[j];
+    i = j;
+  }
+  return seen;
+}
+
+// Helper: Add a non-negative decimal number (as digits) to the number in
+// buf[start, end), growing it leftwards on a carry. Digits are ASCII.
+static void add_decimal(char *buf, size_t &start, size_t end, const std::string &addend)
+{
+  // Common case: a one-digit step that does not carry
+  if (addend.size() == 1 && buf[end - 1] + (addend[0] - '0') <= '9')
+  {
+    buf[end - 1] += addend[0] - '0';
+    return;
+  }
+  int carry = 0;
+  size_t pos = end;
+  for (size_t k = addend.size(); k > 0 || carry;)
+  {
+    --pos;
+    if (pos < start)
+    {
+      buf[pos] = '0';
+      start = pos;
+    }
+    int d = buf[pos] - '0' + carry;
+    if (k > 0)
+      d += addend[--k] - '0';
+    carry = d >= 10;
+    buf[pos] = '0' + d - 10 * carry;
+  }
+}
+
+// Builtin: seq [-s SEP] [-w] [-f FORMAT] [FIRST [INCREMENT]] LAST
+int builtin_seq(std::vector<std::string> &args, Io &io)
+{
+  std::string separator = "\n", format;
+  bool equal_width = false;
+  std::vector<std::string> operands;
+  for (size_t i = 1; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    // Negative numbers are operands, not options
+    if (arg.size() < 2 || arg[0] != '-' || isdigit((unsigned char)arg[1]) || arg[1] == '.')
+    {
+      operands.push_back(arg);
+      continue;
+    }
+    if (arg == "--")
+    {
+      operands.insert(operands.end(), args.begin() + i + 1, args.end());
+      break;
+    }
+    char opt = arg[1];
+    if (opt == 'w' && arg.size() == 2)
+    {
+      equal_width = true;
+      continue;
+    }
+    if (opt != 's' && opt != 'f')
+      return unsupported_option(args, io, std::string("invalid option -- '") + opt + "'");
+    std::string value;
+    if (arg.size() > 2)
+      value = arg.substr(2);
+    else if (i + 1 < args.size())
+      value = args[++i];
+    else
+      return builtin_error(io, "seq", std::string("option requires an argument -- '") + opt + "'");
+    (opt == 's' ? separator : format) = value;
+  }
+  if (operands.empty() || operands.size() > 3)
+    return builtin_error(io, "seq", operands.empty() ? "missing operand" : "extra operand '" + operands[3] + "'");
+  if (!format.empty() && equal_width)
+    return builtin_error(io, "seq", "format string may not be specified when printing equal width strings");
+
+  SeqNumber first, incr, last;
+  first.value = incr.value = 1;
+  first.digits = incr.digits = "1";
+  SeqNumber *targets[3];
+  if (operands.size() == 1)
+    targets[0] = &last;
+  else if (operands.size() == 2)
+    targets[0] = &first, targets[1] = &last;
+  else
+    targets[0] = &first, targets[1] = &incr, targets[2] = &last;
+  for (size_t k = 0; k < operands.size(); ++k)
+  {
+    if (!parse_seq_number(operands[k], *targets[k]))
+      return builtin_error(io, "seq", "invalid floating point argument: '" + operands[k] + "'");
+  }
+  if (incr.value == 0)
+    return builtin_error(io, "seq", "invalid Zero increment value: '" + (operands.size() == 3 ? operands[1] : "0") + "'");
+
+  // Fast path: non-negative integers counting up. The current number is
+  // kept as ASCII digits and the increment is added to it in place, so no
+  // number is ever formatted from binary and there is no size limit.
+  if (format.empty() && !first.digits.empty() && !incr.digits.empty() && !last.digits.empty())
+  {
+    size_t width = equal_width ? std::max(first.width, last.width) : 0;
+    std::string limit = std::string(width > last.digits.size() ? width - last.digits.size() : 0, '0') + last.digits;
+    // Room for the largest operand plus one carry digit, followed by the
+    // separator so each number goes out with a single copy
+    size_t digits_room = std::max({width, first.digits.size(), incr.digits.size(), last.digits.size()}) + 1;
+    std::vector<char> buf(digits_room + separator.size(), '0');
+    size_t end = digits_room, start = end - std::max(width, first.digits.size());
+    memcpy(buf.data() + end - first.digits.size(), first.digits.data(), first.digits.size());
+    memcpy(buf.data() + end, separator.data(), separator.size());
+    // Numbers are compared as padded digit strings: longer is larger
+    auto past_limit = [&]() {
+      size_t len = end - start;
+      return len != limit.size() ? len > limit.size() : memcmp(buf.data() + start, limit.data(), len) > 0;
+    };
+    // When the operands fit in 64 bits the loop just counts down instead
+    unsigned long long remaining = 0;
+    bool counted = first.digits.size() < 20 && incr.digits.size() < 20 && last.digits.size() < 20;
+    if (counted)
+    {
+      unsigned long long lo = std::stoull(first.digits), step = std::stoull(incr.digits), hi = std::stoull(last.digits);
+      remaining = lo > hi ? 0 : (hi - lo) / step + 1;
+    }
+    else if (!past_limit())
+      remaining = 1;
+    // Numbers are copied straight into a staging block rather than through
+    // OutBuffer. Each copy never straddles a flush, so the last separator
+    // can be swapped for the final newline in place.
+    std::vector<char> block(1 << 20);
+    size_t used = 0;
+    while (remaining > 0)
+    {
+      size_t n = end - start + separator.size();
+      if (used + n > block.size())
+      {
+        if (!io.write(block.data(), used))
+          return 1;
+        used = 0;
+      }
+      memcpy(block.data() + used, buf.data() + start, n);
+      used += n;
+      add_decimal(buf.data(), start, end, incr.digits);
+      remaining = counted ? remaining - 1 : !past_limit();
+    }
+    if (used == 0)
+      return 0;
+    used -= separator.size();
+    block[used++] = '\n';
+    return io.write(block.data(), used) ? 0 : 1;
+  }
+
+  OutBuffer out(io, 1 << 20);
+  // General path: value i is computed as first + i * incr, not by repeated
+  // addition, so rounding errors do not accumulate
+  std::string fmt;
+  if (!format.empty())
+  {
+    if (!prepare_seq_format(format, fmt))
+      return builtin_error(io, "seq", "format '" + format + "' has no % directive or more than one");
+  }
+  else
+  {
+    int precision = std::max(first.precision, incr.precision);
+    int width = 0;
+    if (equal_width)
+    {
+      char tmp[128];
+      for (const SeqNumber *num : {&first, &last})
+        width = std::max(width, snprintf(tmp, sizeof(tmp), "%.*Lf", precision, num->value));
+    }
+    fmt = "%0" + std::to_string(width) + "." + std::to_string(precision) + "Lf";
+  }
+  char num[512];
+  unsigned long long i = 0;
+  for (;; ++i)
+  {
+    long double value = first.value + i * incr.value;
+    if (incr.value > 0 ? value > last.value : value < last.value)
+      break;
+    if (i)
+      out.put(separator);
+    int len = snprintf(num, sizeof(num), fmt.c_str(), value);
+    out.put(std::string_view(num, std::min<size_t>(len, sizeof(num) - 1)));
+    if (!out.ok())
+      return 1;
+  }
+  if (i)
+    out.put('\n');
+  return out.flush() ? 0 : 1;
+}
+
+// Builtin: yes [STRING...]
+int builtin_yes(std::vector<std::string> &args, Io &io)
+{
+  std::string line;
+  for (size_t i = 1; i < args.size(); ++i)
+    line += (i > 1 ? " " : "") + args[i];
+  if (args.size() < 2)
+    line = "y";
+  line += '\n';
+  // Fill a buffer with whole copies of the line so every write is large
+  std::string block;
+  while (block.size() < (1 << 16))
+    block += line;
+  struct stat sb;
+  if (fstat(io.out, &sb) == 0 && S_ISFIFO(sb.st_mode))
+  {
+    // The block never changes, so the same pages can be handed to the
+    // pipe over and over without copying them
+    struct iovec iov = {const_cast<char *>(block.data()), block.size()};
+    while (true)
+    {
+      ssize_t n = vmsplice(io.out, &iov, 1, 0);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        break;
+      // A partial splice leaves the rest of this block to go first
+      if ((size_t)n < iov.iov_len)
+      {
+        if (!io.write(static_cast<char *>(iov.iov_base) + n, iov.iov_len - n))
+          return 1;
+      }
+    }
+    if (errno != EINVAL && errno != ENOSYS)
+      return 1;
+  }
+  while (io.write(block))
+    ;
+  return 1;
+}
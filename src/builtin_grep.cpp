@@ -0,0 +1,880 @@
+#include "builtins.hpp"
+#include "simd.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+using ByteSet = std::bitset<256>;
+
+// Regex syntax tree node
+struct ReNode
+{
+  enum Kind
+  {
+    Set,
+    Concat,
+    Alt,
+    Repeat,
+    Bol,
+    Eol,
+    Empty
+  } kind;
+  ByteSet set;
+  std::vector<std::unique_ptr<ReNode>> kids;
+  int min = 0, max = -1; // Repeat bounds, max -1 is unbounded
+};
+
+static std::unique_ptr<ReNode> make_node(ReNode::Kind kind)
+{
+  auto node = std::make_unique<ReNode>();
+  node->kind = kind;
+  return node;
+}
+
+// Helper: Node matching the byte c, either case of it when folding
+static std::unique_ptr<ReNode> literal_node(unsigned char c, bool fold)
+{
+  auto node = make_node(ReNode::Set);
+  node->set.set(c);
+  if (fold && isalpha(c))
+  {
+    node->set.set(tolower(c));
+    node->set.set(toupper(c));
+  }
+  return node;
+}
+
+// Thrown for a construct the parser knows but the matcher cannot do: word
+// boundaries and back-references
+struct UnsupportedRegex : std::runtime_error
+{
+  using std::runtime_error::runtime_error;
+};
+
+// Recursive-descent parser for POSIX basic (grep) and extended (grep -E)
+// regular expressions. Throws std::runtime_error with grep's message on
+// malformed patterns, and UnsupportedRegex for the GNU extensions it leaves
+// out.
+class ReParser
+{
+public:
+  ReParser(const std::string &re, bool extended, bool fold) : re(re), extended(extended), fold(fold) {}
+
+  std::unique_ptr<ReNode> parse()
+  {
+    auto node = parse_alt(0);
+    if (pos < re.size())
+      throw std::runtime_error(extended ? "Unmatched ) or \\)" : "Unmatched \\)");
+    return node;
+  }
+
+private:
+  const std::string &re;
+  size_t pos = 0;
+  bool extended, fold;
+
+  bool at(const char *op) const { return re.compare(pos, strlen(op), op) == 0; }
+  bool at_alt() const { return extended ? at("|") : at("\\|"); }
+  bool at_close() const { return extended ? at(")") : at("\\)"); }
+  bool at_open() const { return extended ? at("(") : at("\\("); }
+
+  std::unique_ptr<ReNode> parse_alt(int depth)
+  {
+    auto first = parse_concat(depth);
+    if (!at_alt())
+      return first;
+    auto alt = make_node(ReNode::Alt);
+    alt->kids.push_back(std::move(first));
+    while (at_alt())
+    {
+      pos += extended ? 1 : 2;
+      alt->kids.push_back(parse_concat(depth));
+    }
+    return alt;
+  }
+
+  std::unique_ptr<ReNode> parse_concat(int depth)
+  {
+    auto concat = make_node(ReNode::Concat);
+    while (pos < re.size() && !at_alt() && !(depth > 0 && at_close()))
+      concat->kids.push_back(parse_repeat(depth, concat->kids.empty()));
+    return concat;
+  }
+
+  // Parses the digits of an interval; returns -1 if there are none
+  int parse_number()
+  {
+    if (pos >= re.size() || !isdigit((unsigned char)re[pos]))
+      return -1;
+    int n = 0;
+    while (pos < re.size() && isdigit((unsigned char)re[pos]))
+    {
+      n = n * 10 + (re[pos++] - '0');
+      if (n > 255)
+        throw std::runtime_error("Regular expression too big");
+    }
+    return n;
+  }
+
+  // Tries to parse {n}, {n,}, {,m} or {n,m} at pos; restores pos if absent
+  bool parse_interval(int &min, int &max)
+  {
+    size_t saved = pos;
+    const char *open = extended ? "{" : "\\{", *close = extended ? "}" : "\\}";
+    if (!at(open))
+      return false;
+    pos += strlen(open);
+    min = parse_number();
+    max = min;
+    if (pos < re.size() && re[pos] == ',')
+    {
+      ++pos;
+      max = parse_number();
+    }
+    if (min < 0)
+      min = 0;
+    if (!at(close) || (max >= 0 && max < min))
+    {
+      if (!extended)
+        throw std::runtime_error("Invalid content of \\{\\}");
+      pos = saved; // An ERE brace that isn't an interval is literal
+      return false;
+    }
+    pos += strlen(close);
+    return true;
+  }
+
+  std::unique_ptr<ReNode> parse_repeat(int depth, bool first)
+  {
+    auto atom = parse_atom(depth, first);
+    while (pos < re.size())
+    {
+      int min, max;
+      if (re[pos] == '*')
+      {
+        ++pos;
+        min = 0;
+        max = -1;
+      }
+      else if (extended ? at("+") : at("\\+"))
+      {
+        pos += extended ? 1 : 2;
+        min = 1;
+        max = -1;
+      }
+      else if (extended ? at("?") : at("\\?"))
+      {
+        pos += extended ? 1 : 2;
+        min = 0;
+        max = 1;
+      }
+      else if (!parse_interval(min, max))
+        break;
+      auto rep = make_node(ReNode::Repeat);
+      rep->min = min;
+      rep->max = max;
+      rep->kids.push_back(std::move(atom));
+      atom = std::move(rep);
+    }
+    return atom;
+  }
+
+  std::unique_ptr<ReNode> literal(unsigned char c) { return literal_node(c, fold); }
+
+  std::unique_ptr<ReNode> parse_atom(int depth, bool first)
+  {
+    unsigned char c = re[pos];
+    if (at_open())
+    {
+      pos += extended ? 1 : 2;
+      auto group = parse_alt(depth + 1);
+      if (!at_close())
+        throw std::runtime_error(extended ? "Unmatched ( or \\(" : "Unmatched \\(");
+      pos += extended ? 1 : 2;
+      return group;
+    }
+    ++pos;
+    // A leading '*' has nothing to repeat and is literal
+    if (c == '*' && first)
+      return literal(c);
+    if (c == '.')
+    {
+      auto node = make_node(ReNode::Set);
+      node->set.set();
+      node->set.reset('\n');
+      return node;
+    }
+    if (c == '[')
+      return parse_bracket();
+    // In a BRE, ^ and $ are anchors only at the ends of an expression
+    if (c == '^' && (extended || first))
+      return make_node(ReNode::Bol);
+    if (c == '$' && (extended || pos == re.size() || at_alt() || at_close()))
+      return make_node(ReNode::Eol);
+    if (c == '\\')
+    {
+      if (pos >= re.size())
+        throw std::runtime_error("Trailing backslash");
+      unsigned char e = re[pos++];
+      if (isdigit(e))
+        throw UnsupportedRegex("back-references are not supported");
+      if (e == 'w' || e == 'W' || e == 's' || e == 'S')
+      {
+        auto node = make_node(ReNode::Set);
+        for (int b = 0; b < 256; ++b)
+          if (e == 'w' || e == 'W' ? (isalnum(b) || b == '_') : isspace(b))
+            node->set.set(b);
+        if (e == 'W' || e == 'S')
+          node->set.flip();
+        return node;
+      }
+      // GNU gives these a meaning (\b, \<, \`...); only escaped
+      // punctuation stands for itself
+      if (isalnum(e) || strchr("<>`'", e))
+        throw UnsupportedRegex(std::string("\\") + char(e) + " is not supported");
+      return literal(e);
+    }
+    return literal(c);
+  }
+
+  std::unique_ptr<ReNode> parse_bracket()
+  {
+    auto node = make_node(ReNode::Set);
+    bool negate = pos < re.size() && re[pos] == '^';
+    if (negate)
+      ++pos;
+    bool first = true;
+    while (true)
+    {
+      if (pos >= re.size())
+        throw std::runtime_error("Unmatched [, [^, [:, [., or [=");
+      unsigned char c = re[pos];
+      if (c == ']' && !first)
+      {
+        ++pos;
+        break;
+      }
+      first = false;
+      if (at("[:"))
+      {
+        size_t end = re.find(":]", pos + 2);
+        if (end == std::string::npos)
+          throw std::runtime_error("Unmatched [, [^, [:, [., or [=");
+        std::string name = re.substr(pos + 2, end - pos - 2);
+        static const std::map<std::string, int (*)(int)> classes = {
+            {"alpha", isalpha}, {"digit", isdigit}, {"alnum", isalnum}, {"upper", isupper},
+            {"lower", islower}, {"space", isspace}, {"blank", isblank}, {"punct", ispunct},
+            {"xdigit", isxdigit}, {"print", isprint}, {"graph", isgraph}, {"cntrl", iscntrl}};
+        auto it = classes.find(name);
+        if (it == classes.end())
+          throw std::runtime_error("Invalid character class name");
+        for (int b = 0; b < 256; ++b)
+          if (it->second(b))
+            node->set.set(b);
+        pos = end + 2;
+        continue;
+      }
+      ++pos;
+      unsigned char hi = c;
+      if (pos + 1 < re.size() && re[pos] == '-' && re[pos + 1] != ']')
+      {
+        hi = re[pos + 1];
+        pos += 2;
+        if (hi < c)
+          throw std::runtime_error("Invalid range end");
+      }
+      for (int b = c; b <= hi; ++b)
+        node->set.set(b);
+    }
+    if (fold)
+      for (int b = 'a'; b <= 'z'; ++b)
+        if (node->set[b] || node->set[toupper(b)])
+        {
+          node->set.set(b);
+          node->set.set(toupper(b));
+        }
+    if (negate)
+    {
+      node->set.flip();
+      node->set.reset('\n');
+    }
+    return node;
+  }
+};
+
+// Thompson NFA state
+struct NfaState
+{
+  enum Kind
+  {
+    Set,
+    Split,
+    Bol,
+    Eol,
+    Match
+  } kind;
+  ByteSet set;
+  std::vector<int> out;
+};
+
+// Regex matcher that determinizes its NFA lazily, one DFA state per set of
+// NFA states actually reached, and caches the transitions
+class LazyDfa
+{
+public:
+  explicit LazyDfa(const ReNode &root)
+  {
+    int match = add_state(NfaState::Match);
+    nfa_start = compile(root, match);
+    reset();
+  }
+
+  // Does any substring of [p, end) match?
+  bool match_line(const char *p, const char *end)
+  {
+    int s = 0;
+    while (!halt[s] && p != end)
+    {
+      int t = next[s * 256 + (unsigned char)*p];
+      s = t >= 0 ? t : step(s, (unsigned char)*p);
+      ++p;
+    }
+    if (halt[s])
+      return states[s].match;
+    return accepts_at_eol(s);
+  }
+
+private:
+  struct DfaState
+  {
+    std::vector<int> nfa;
+    bool match = false;
+    int eol_match = -1; // Unknown until first needed
+  };
+
+  std::vector<NfaState> nfa;
+  int nfa_start = 0;
+  std::vector<DfaState> states;
+  // Transitions (256 per state, -1 until computed) and whether a state ends
+  // the scan (it matches, or is dead), kept flat for the inner loop
+  std::vector<int> next;
+  std::vector<char> halt;
+  std::map<std::vector<int>, int> index;
+  std::vector<unsigned> visited;
+  unsigned generation = 0;
+  // The cache is flushed when it grows past this many states
+  static constexpr size_t max_states = 4096;
+
+  int add_state(NfaState::Kind kind, std::vector<int> out = {})
+  {
+    nfa.push_back(NfaState{kind, ByteSet(), std::move(out)});
+    return nfa.size() - 1;
+  }
+
+  // Builds the states for node, continuing at next; returns the entry state
+  int compile(const ReNode &node, int next)
+  {
+    switch (node.kind)
+    {
+    case ReNode::Set:
+    {
+      int s = add_state(NfaState::Set, {next});
+      nfa[s].set = node.set;
+      return s;
+    }
+    case ReNode::Bol:
+      return add_state(NfaState::Bol, {next});
+    case ReNode::Eol:
+      return add_state(NfaState::Eol, {next});
+    case ReNode::Concat:
+      for (auto it = node.kids.rbegin(); it != node.kids.rend(); ++it)
+        next = compile(**it, next);
+      return next;
+    case ReNode::Alt:
+    {
+      std::vector<int> outs;
+      for (auto &kid : node.kids)
+        outs.push_back(compile(*kid, next));
+      return add_state(NfaState::Split, outs);
+    }
+    case ReNode::Repeat:
+    {
+      const ReNode &kid = *node.kids[0];
+      int tail = next;
+      if (node.max < 0)
+      {
+        int loop = add_state(NfaState::Split);
+        int body = compile(kid, loop);
+        nfa[loop].out = {body, next};
+        tail = loop;
+      }
+      else
+        for (int i = node.min; i < node.max; ++i)
+          tail = add_state(NfaState::Split, {compile(kid, tail), next});
+      for (int i = 0; i < node.min; ++i)
+        tail = compile(kid, tail);
+      return tail;
+    }
+    default:
+      return next;
+    }
+  }
+
+  // Adds the epsilon closure of s to set. Consuming states, Eol assertions
+  // (still pending until the end of line) and Match are kept.
+  void closure(int s, bool at_bol, bool at_eol, std::vector<int> &set)
+  {
+    std::vector<int> stack = {s};
+    while (!stack.empty())
+    {
+      int id = stack.back();
+      stack.pop_back();
+      if (visited[id] == generation)
+        continue;
+      visited[id] = generation;
+      const NfaState &st = nfa[id];
+      switch (st.kind)
+      {
+      case NfaState::Split:
+        for (auto it = st.out.rbegin(); it != st.out.rend(); ++it)
+          stack.push_back(*it);
+        break;
+      case NfaState::Bol:
+        if (at_bol)
+          stack.push_back(st.out[0]);
+        break;
+      case NfaState::Eol:
+        set.push_back(id);
+        if (at_eol)
+          stack.push_back(st.out[0]);
+        break;
+      default:
+        set.push_back(id);
+        break;
+      }
+    }
+  }
+
+  int intern(std::vector<int> set)
+  {
+    std::sort(set.begin(), set.end());
+    auto it = index.find(set);
+    if (it != index.end())
+      return it->second;
+    DfaState state;
+    for (int id : set)
+      if (nfa[id].kind == NfaState::Match)
+        state.match = true;
+    halt.push_back(state.match || set.empty());
+    next.resize(next.size() + 256, -1);
+    state.nfa = set;
+    states.push_back(std::move(state));
+    index.emplace(std::move(set), states.size() - 1);
+    return states.size() - 1;
+  }
+
+  // Clears the cache, leaving only the start state (index 0)
+  void reset()
+  {
+    states.clear();
+    index.clear();
+    next.clear();
+    halt.clear();
+    visited.assign(nfa.size(), 0);
+    std::vector<int> set;
+    ++generation;
+    closure(nfa_start, true, false, set);
+    intern(set);
+  }
+
+  int step(int from, unsigned char c)
+  {
+    std::vector<int> set;
+    ++generation;
+    for (int id : states[from].nfa)
+      if (nfa[id].kind == NfaState::Set && nfa[id].set[c])
+        closure(nfa[id].out[0], false, false, set);
+    // Unanchored search: a match may also begin at the next byte
+    closure(nfa_start, false, false, set);
+    if (states.size() >= max_states)
+    {
+      reset();
+      return intern(set);
+    }
+    int to = intern(set);
+    next[from * 256 + c] = to;
+    return to;
+  }
+
+  bool accepts_at_eol(int s)
+  {
+    DfaState &state = states[s];
+    if (state.eol_match < 0)
+    {
+      std::vector<int> set;
+      ++generation;
+      for (int id : state.nfa)
+        if (nfa[id].kind == NfaState::Eol)
+          closure(nfa[id].out[0], false, true, set);
+      state.eol_match = std::any_of(set.begin(), set.end(), [&](int id) { return nfa[id].kind == NfaState::Match; });
+    }
+    return state.eol_match;
+  }
+};
+
+// Finds the next line in [p, end) that matches, as [line_start, line_end)
+// with line_end at the newline (or end)
+class LineMatcher
+{
+public:
+  virtual ~LineMatcher() = default;
+  virtual bool find(const char *p, const char *end, const char *&line_start, const char *&line_end) = 0;
+};
+
+// Fixed-string matcher: searches the whole block with the SIMD literal
+// finder and only then locates the surrounding line
+class LiteralMatcher : public LineMatcher
+{
+public:
+  // The needle must not contain a newline
+  LiteralMatcher(std::string needle, bool fold) : needle(std::move(needle)), fold(fold)
+  {
+    if (fold)
+      for (auto &c : this->needle)
+        c = tolower((unsigned char)c);
+  }
+
+  bool find(const char *p, const char *end, const char *&line_start, const char *&line_end) override
+  {
+    const char *hit = find_literal(p, end - p, needle.data(), needle.size(), fold);
+    if (!hit)
+      return false;
+    const char *nl = static_cast<const char *>(memrchr(p, '\n', hit - p));
+    line_start = nl ? nl + 1 : p;
+    nl = static_cast<const char *>(memchr(hit, '\n', end - hit));
+    line_end = nl ? nl : end;
+    return true;
+  }
+
+private:
+  std::string needle;
+  bool fold;
+};
+
+// Helper: If set matches exactly one byte (or, when folding, one letter in
+// either case), store it lowercased in c
+static bool single_byte(const ByteSet &set, bool fold, char &c)
+{
+  c = 0;
+  if (set.count() == 1)
+  {
+    for (int b = 0; b < 256; ++b)
+      if (set[b])
+        c = b;
+    return !fold || !isalpha((unsigned char)c);
+  }
+  if (fold && set.count() == 2)
+    for (int b = 'a'; b <= 'z'; ++b)
+      if (set[b] && set[toupper(b)])
+      {
+        c = b;
+        return true;
+      }
+  return false;
+}
+
+// Helper: Longest run of single bytes in the top-level concatenation, a
+// literal every matching line must contain
+static std::string required_literal(const ReNode &root, bool fold)
+{
+  std::string best, run;
+  if (root.kind != ReNode::Concat)
+    return best;
+  for (auto &kid : root.kids)
+  {
+    char c;
+    if (kid->kind == ReNode::Set && single_byte(kid->set, fold, c))
+      run += c;
+    else if (kid->kind != ReNode::Bol && kid->kind != ReNode::Eol)
+      run.clear();
+    if (run.size() > best.size())
+      best = run;
+  }
+  return best;
+}
+
+class RegexMatcher : public LineMatcher
+{
+public:
+  RegexMatcher(const ReNode &root, bool fold) : dfa(root), must(required_literal(root, fold)), fold(fold) {}
+
+  bool find(const char *p, const char *end, const char *&line_start, const char *&line_end) override
+  {
+    while (p < end)
+    {
+      // Skip straight to lines containing the required literal, if any
+      if (!must.empty())
+      {
+        const char *hit = find_literal(p, end - p, must.data(), must.size(), fold);
+        if (!hit)
+          return false;
+        const char *nl = static_cast<const char *>(memrchr(p, '\n', hit - p));
+        p = nl ? nl + 1 : p;
+      }
+      const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+      const char *e = nl ? nl : end;
+      if (dfa.match_line(p, e))
+      {
+        line_start = p;
+        line_end = e;
+        return true;
+      }
+      p = e + 1;
+    }
+    return false;
+  }
+
+private:
+  LazyDfa dfa;
+  std::string must;
+  bool fold;
+};
+
+// Builtin: grep [-cvinlqFEG] [-e] PATTERN [FILE...]
+int builtin_grep(std::vector<std::string> &args, Io &io)
+{
+  bool count = false, invert = false, fold = false, number = false, list = false, quiet = false;
+  bool fixed = false, extended = false, have_pattern = false;
+  // Each -e adds a pattern; a line is selected if any of them matches
+  std::vector<std::string> patterns;
+  std::vector<std::string> files;
+  bool options_done = false;
+  for (size_t i = 1; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (options_done || arg.size() < 2 || arg[0] != '-')
+    {
+      if (!have_pattern)
+      {
+        patterns.push_back(arg);
+        have_pattern = true;
+      }
+      else
+        files.push_back(arg);
+      continue;
+    }
+    if (arg == "--")
+    {
+      options_done = true;
+      continue;
+    }
+    for (size_t j = 1; j < arg.size(); ++j)
+    {
+      switch (arg[j])
+      {
+      case 'c':
+        count = true;
+        break;
+      case 'v':
+        invert = true;
+        break;
+      case 'i':
+        fold = true;
+        break;
+      case 'n':
+        number = true;
+        break;
+      case 'l':
+        list = true;
+        break;
+      case 'q':
+        quiet = true;
+        break;
+      case 'F':
+        fixed = true;
+        break;
+      case 'E':
+        extended = true;
+        break;
+      case 'G':
+        extended = false;
+        break;
+      case 'e':
+        if (j + 1 < arg.size())
+          patterns.push_back(arg.substr(j + 1));
+        else if (i + 1 < args.size())
+          patterns.push_back(args[++i]);
+        else
+          return builtin_error(io, "grep", "option requires an argument -- 'e'", 2);
+        have_pattern = true;
+        j = arg.size();
+        break;
+      default:
+        return unsupported_option(args, io, std::string("invalid option -- '") + arg[j] + "'", 2);
+      }
+    }
+  }
+  if (!have_pattern)
+    return builtin_error(io, "grep", "usage: grep [-cvinlqFEG] PATTERN [FILE...]", 2);
+
+  std::unique_ptr<LineMatcher> matcher;
+  const char *meta = extended ? "\\.[]*^$+?(){}|" : "\\.[]*^$";
+  if (patterns.size() == 1 && (fixed || patterns[0].find_first_of(meta) == std::string::npos))
+    matcher = std::make_unique<LiteralMatcher>(patterns[0], fold);
+  else
+  {
+    try
+    {
+      // Several patterns are matched as one alternation
+      auto root = make_node(ReNode::Alt);
+      for (auto &pattern : patterns)
+      {
+        if (!fixed)
+        {
+          root->kids.push_back(ReParser(pattern, extended, fold).parse());
+          continue;
+        }
+        auto literal = make_node(ReNode::Concat);
+        for (char c : pattern)
+          literal->kids.push_back(literal_node(c, fold));
+        root->kids.push_back(std::move(literal));
+      }
+      if (root->kids.size() == 1)
+        root = std::move(root->kids[0]);
+      matcher = std::make_unique<RegexMatcher>(*root, fold);
+    }
+    catch (const UnsupportedRegex &e)
+    {
+      return unsupported_option(args, io, e.what(), 2);
+    }
+    catch (const std::runtime_error &e)
+    {
+      return builtin_error(io, "grep", e.what(), 2);
+    }
+  }
+
+  if (files.empty())
+    files.push_back("-");
+  bool with_names = files.size() > 1;
+  bool error = false, any_selected = false;
+  OutBuffer out(io);
+  for (auto &file : files)
+  {
+    int fd = open_input(file, io);
+    if (fd < 0)
+    {
+      out.flush();
+      builtin_error(io, "grep", file + ": " + strerror(errno), 2);
+      error = true;
+      continue;
+    }
+    const std::string &name = file == "-" ? "(standard input)" : file;
+    size_t selected = 0, lineno = 0;
+    bool stop = false;
+    auto select = [&](const char *ls, const char *le) {
+      ++selected;
+      ++lineno;
+      if (quiet || list)
+      {
+        stop = true;
+        return;
+      }
+      if (count)
+        return;
+      if (with_names)
+      {
+        out.put(name);
+        out.put(':');
+      }
+      if (number)
+      {
+        out.put(std::to_string(lineno));
+        out.put(':');
+      }
+      out.put(std::string_view(ls, le - ls));
+      out.put('\n');
+      // Output that has gone ends the search, as SIGPIPE would
+      if (!out.ok())
+        stop = true;
+    };
+    bool ok = read_line_blocks(fd, [&](const char *p, size_t len) {
+      const char *end = p + len;
+      while (p < end && !stop)
+      {
+        const char *ls = end, *le = end;
+        bool found = matcher->find(p, end, ls, le);
+        if (invert)
+        {
+          // Every line before the next match is selected
+          if (count && !number)
+          {
+            size_t n = count_byte(p, ls - p, '\n');
+            if (ls == end && ls > p && end[-1] != '\n')
+              ++n;
+            selected += n;
+            lineno += n;
+          }
+          else
+            for (const char *q = p; q < ls && !stop;)
+            {
+              const char *nl = static_cast<const char *>(memchr(q, '\n', ls - q));
+              const char *e = nl ? nl : ls;
+              select(q, e);
+              q = e + 1;
+            }
+          if (found)
+            ++lineno;
+        }
+        else
+        {
+          // Keep line numbers right across blocks
+          if (number)
+            lineno += count_byte(p, ls - p, '\n');
+          if (found)
+            select(ls, le);
+        }
+        p = found && le < end ? le + 1 : end;
+      }
+      if (!input_ready(fd) && !out.flush())
+        stop = true;
+      return !stop;
+    });
+    close_input(fd, io);
+    if (!ok)
+    {
+      out.flush();
+      builtin_error(io, "grep", file + ": " + strerror(errno), 2);
+      error = true;
+    }
+    if (selected > 0)
+      any_selected = true;
+    if (quiet && any_selected)
+      return 0;
+    if (!out.ok())
+      return 2;
+    if (list && selected > 0)
+    {
+      out.put(name);
+      out.put('\n');
+    }
+    else if (count)
+    {
+      if (with_names)
+      {
+        out.put(name);
+        out.put(':');
+      }
+      out.put(std::to_string(selected));
+      out.put('\n');
+    }
+  }
+  if (error && !(quiet && any_selected))
+    return 2;
+  return any_selected ? 0 : 1;
+}
@@ -0,0 +1,457 @@
+#include "builtins.hpp"
+#include "ring.hpp"
+#include "simd.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Count operand of head -n/-c and tail -n/-c
+struct LineCount
+{
+  bool bytes = false; // -c rather than -n
+  char sign = 0;      // '+' (from the start) or '-' (all but), 0 otherwise
+  size_t n = 10;
+};
+
+// Helper: Parse a count such as "10", "+5", "-3" or "2K" into count
+static bool parse_line_count(const std::string &s, LineCount &count)
+{
+  size_t i = 0;
+  count.sign = 0;
+  if (i < s.size() && (s[i] == '+' || s[i] == '-'))
+    count.sign = s[i++];
+  size_t digits = i;
+  size_t n = 0;
+  for (; i < s.size() && isdigit((unsigned char)s[i]); ++i)
+    n = n * 10 + (s[i] - '0');
+  if (i == digits)
+    return false;
+  if (i < s.size())
+  {
+    static const char suffixes[] = "bKMGT";
+    static const size_t multipliers[] = {512, 1024, 1024 * 1024, 1024 * 1024 * 1024, 1024ull * 1024 * 1024 * 1024};
+    const char *suffix = strchr(suffixes, s[i]);
+    if (!suffix || i + 1 != s.size())
+      return false;
+    n *= multipliers[suffix - suffixes];
+  }
+  count.n = n;
+  return true;
+}
+
+// Helper: Offset where the last n lines of [p, p + len) start. A final
+// newline ends the last line rather than starting an empty one.
+static size_t last_lines_start(const char *p, size_t len, size_t n)
+{
+  if (n == 0)
+    return len;
+  size_t scan = len && p[len - 1] == '\n' ? len - 1 : len;
+  const char *nl = rfind_nth_byte(p, scan, '\n', n);
+  return nl ? nl + 1 - p : 0;
+}
+
+// Helper: Offset just past the first n lines of [p, p + len)
+static size_t first_lines_end(const char *p, size_t len, size_t n)
+{
+  if (n == 0)
+    return 0;
+  const char *nl = find_nth_byte(p, len, '\n', n);
+  return nl ? nl + 1 - p : len;
+}
+
+// Helper: Range [start, end) of a whole buffer that head or tail prints
+static void select_range(const char *p, size_t len, const LineCount &count, bool tail, size_t &start, size_t &end)
+{
+  start = 0;
+  end = len;
+  if (count.bytes)
+  {
+    size_t n = std::min(count.n, len);
+    if (!tail)
+      end = count.sign == '-' ? len - n : n;
+    else
+      start = count.sign == '+' ? std::min(count.n ? count.n - 1 : 0, len) : len - n;
+  }
+  else if (!tail)
+    end = count.sign == '-' ? last_lines_start(p, len, count.n) : first_lines_end(p, len, count.n);
+  else
+    start = count.sign == '+' ? first_lines_end(p, len, count.n ? count.n - 1 : 0) : last_lines_start(p, len, count.n);
+}
+
+// Helper: Read the rest of fd into a string
+static bool slurp(int fd, std::string &out)
+{
+  return read_blocks(fd, [&](const char *p, size_t len) {
+    out.append(p, len);
+    return true;
+  });
+}
+
+// Helper: head of one fd, from its offset on. Regular files are mapped and
+// only their first lines are touched; other input is streamed until the count runs out.
+static bool head_fd(int fd, Io &io, const LineCount &count, bool &read_ok)
+{
+  read_ok = true;
+  MappedFile map;
+  std::string all;
+  if (map.map(fd) || count.sign == '-')
+  {
+    if (!map.data())
+    {
+      read_ok = slurp(fd, all);
+      if (!read_ok)
+        return true;
+    }
+    const char *p = map.data() ? map.data() : all.data();
+    size_t len = map.data() ? map.size() : all.size();
+    size_t start, end;
+    select_range(p, len, count, false, start, end);
+    // Like GNU head, leave a seekable fd just past what was printed, for
+    // whoever reads it next
+    if (map.data())
+      lseek(fd, end, SEEK_CUR);
+    return io.write(p + start, end - start);
+  }
+  size_t left = count.n;
+  bool write_ok = true;
+  if (left == 0)
+    return true;
+  read_ok = read_blocks(fd, [&](const char *p, size_t len) {
+    size_t take;
+    if (count.bytes)
+    {
+      take = std::min(left, len);
+      left -= take;
+    }
+    else
+    {
+      const char *nl = find_nth_byte(p, len, '\n', left);
+      take = nl ? nl + 1 - p : len;
+      if (nl)
+        left = 0;
+    }
+    write_ok = io.write(p, take);
+    return write_ok && left > 0;
+  });
+  return write_ok;
+}
+
+// Helper: tail of one fd, from its offset on. Regular files are mapped
+// and scanned backwards from the end, so the cost follows the size of the
+// output, not the file. Other input keeps a bounded window of its end.
+// offset gets how far into a regular file the output went, for -f.
+static bool tail_fd(int fd, Io &io, const LineCount &count, bool &read_ok, off_t &offset)
+{
+  read_ok = true;
+  MappedFile map;
+  if (map.map(fd))
+  {
+    size_t start, end;
+    select_range(map.data(), map.size(), count, true, start, end);
+    offset = lseek(fd, map.size(), SEEK_CUR);
+    return io.write(map.data() + start, end - start);
+  }
+  struct stat sb;
+  offset = fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) ? sb.st_size : 0;
+  bool write_ok = true;
+  if (count.sign == '+')
+  {
+    // Skip from the front, then pass everything after through
+    size_t skip = count.n ? count.n - 1 : 0;
+    read_ok = read_blocks(fd, [&](const char *p, size_t len) {
+      size_t from = 0;
+      if (skip && count.bytes)
+      {
+        from = std::min(skip, len);
+        skip -= from;
+      }
+      else if (skip)
+      {
+        const char *nl = find_nth_byte(p, len, '\n', skip);
+        from = nl ? nl + 1 - p : len;
+        if (nl)
+          skip = 0;
+      }
+      write_ok = io.write(p + from, len - from);
+      return write_ok;
+    });
+    return write_ok;
+  }
+  // Keep the end of the stream, trimming the window whenever it has grown
+  // well past what the count needs
+  std::string window;
+  size_t trim_at = 1 << 22;
+  read_ok = read_blocks(fd, [&](const char *p, size_t len) {
+    window.append(p, len);
+    if (window.size() >= trim_at)
+    {
+      size_t start, end;
+      select_range(window.data(), window.size(), count, true, start, end);
+      window.erase(0, start);
+      trim_at = std::max<size_t>(1 << 22, 2 * window.size());
+    }
+    return true;
+  });
+  size_t start, end;
+  select_range(window.data(), window.size(), count, true, start, end);
+  return io.write(window.data() + start, end - start);
+}
+
+// Helper: Parse the options shared by head and tail. Returns false, with
+// the status to exit with, after reporting an error or after running the
+// PATH executable for an option not implemented here.
+static bool parse_head_tail_args(const char *name, std::vector<std::string> &args, Io &io, LineCount &count,
+                                 bool &follow, bool &quiet, std::vector<std::string> &files, int &status)
+{
+  bool options_done = false;
+  for (size_t i = 1; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (options_done || arg.size() < 2 || arg[0] != '-')
+    {
+      files.push_back(arg);
+      continue;
+    }
+    if (arg == "--")
+    {
+      options_done = true;
+      continue;
+    }
+    // Obsolete -N form
+    if (isdigit((unsigned char)arg[1]))
+    {
+      if (!parse_line_count(arg.substr(1), count))
+      {
+        status = builtin_error(io, name, "invalid number of lines: '" + arg.substr(1) + "'");
+        return false;
+      }
+      count.bytes = false;
+      continue;
+    }
+    for (size_t j = 1; j < arg.size(); ++j)
+    {
+      char opt = arg[j];
+      if (opt == 'f' && strcmp(name, "tail") == 0)
+        follow = true;
+      else if (opt == 'q')
+        quiet = true;
+      else if (opt == 'n' || opt == 'c')
+      {
+        std::string value;
+        if (j + 1 < arg.size())
+          value = arg.substr(j + 1);
+        else if (i + 1 < args.size())
+          value = args[++i];
+        else
+        {
+          status = builtin_error(io, name, std::string("option requires an argument -- '") + opt + "'");
+          return false;
+        }
+        if (!parse_line_count(value, count))
+        {
+          std::string what = opt == 'n' ? "lines" : "bytes";
+          status = builtin_error(io, name, "invalid number of " + what + ": '" + value + "'");
+          return false;
+        }
+        count.bytes = opt == 'c';
+        break;
+      }
+      else
+      {
+        status = unsupported_option(args, io, std::string("invalid option -- '") + opt + "'");
+        return false;
+      }
+    }
+  }
+  if (files.empty())
+    files.push_back("-");
+  return true;
+}
+
+// Builtin: head [-n [-]N] [-c [-]N] [-q] [FILE...]
+int builtin_head(std::vector<std::string> &args, Io &io)
+{
+  LineCount count;
+  bool follow = false, quiet = false;
+  std::vector<std::string> files;
+  int status = 0;
+  if (!parse_head_tail_args("head", args, io, count, follow, quiet, files, status))
+    return status;
+  bool headers = files.size() > 1 && !quiet;
+  for (size_t k = 0; k < files.size(); ++k)
+  {
+    int fd = open_input(files[k], io);
+    if (fd < 0)
+    {
+      status = builtin_error(io, "head", "cannot open '" + files[k] + "' for reading: " + strerror(errno));
+      continue;
+    }
+    if (headers)
+      io.write(std::string(k ? "\n" : "") + "==> " + (files[k] == "-" ? "standard input" : files[k]) + " <==\n");
+    bool read_ok;
+    bool write_ok = head_fd(fd, io, count, read_ok);
+    if (!read_ok)
+      status = builtin_error(io, "head", "error reading '" + files[k] + "': " + strerror(errno));
+    close_input(fd, io);
+    if (!write_ok)
+      return 1;
+  }
+  return status;
+}
+
+// A file tail -f keeps reading
+struct FollowedFile
+{
+  std::string name;
+  int fd;
+  off_t offset;
+  int wd = -1;
+};
+
+// Helper: Print whatever was appended to a followed file since its offset
+static bool follow_catch_up(FollowedFile &f, Io &io, bool headers, const FollowedFile *&last_printed)
+{
+  struct stat sb;
+  if (fstat(f.fd, &sb) != 0)
+    return true;
+  if (sb.st_size < f.offset)
+  {
+    builtin_error(io, "tail", f.name + ": file truncated");
+    f.offset = 0;
+  }
+  if (sb.st_size == f.offset)
+    return true;
+  if (headers && last_printed != &f)
+  {
+    if (!io.write("\n==> " + f.name + " <==\n"))
+      return false;
+    last_printed = &f;
+  }
+  if (lseek(f.fd, f.offset, SEEK_SET) < 0)
+    return true;
+  ssize_t moved = transfer_fd(f.fd, io.out, sb.st_size - f.offset);
+  if (moved < 0)
+    return false;
+  f.offset += moved;
+  return true;
+}
+
+// Helper: tail -f: wait on inotify for writes to the files and copy out
+// what was appended. Returns when the files are gone or output fails.
+static int follow_files(std::vector<FollowedFile> &files, Io &io, bool headers)
+{
+  const FollowedFile *last_printed = files.empty() ? nullptr : &files.back();
+  int ino = inotify_init1(IN_CLOEXEC);
+  if (ino < 0)
+    return builtin_error(io, "tail", std::string("inotify cannot be used: ") + strerror(errno));
+  size_t watching = 0;
+  for (auto &f : files)
+  {
+    f.wd = inotify_add_watch(ino, ("/proc/self/fd/" + std::to_string(f.fd)).c_str(),
+                             IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (f.wd >= 0)
+      ++watching;
+  }
+  alignas(inotify_event) char buf[4096];
+  int status = 0;
+  // A fused stage's ring raises no poll event when its reader goes, so it
+  // is looked at directly, and more often
+  ByteRing *ring = ring_for(io.out);
+  while (watching > 0)
+  {
+    // Wake up now and then to notice a closed output pipe
+    struct pollfd pfd[2] = {{ino, POLLIN, 0}, {io.out, 0, 0}};
+    int ready = poll(pfd, 2, ring ? 100 : 1000);
+    if (ready < 0 && errno != EINTR)
+      break;
+    if ((pfd[1].revents & (POLLERR | POLLHUP)) || (ring && ring->reader_closed()))
+      break;
+    if (ready <= 0 || !(pfd[0].revents & POLLIN))
+      continue;
+    ssize_t n = read(ino, buf, sizeof(buf));
+    if (n <= 0)
+      continue;
+    bool output_failed = false;
+    for (ssize_t off = 0; off < n;)
+    {
+      auto *ev = reinterpret_cast<inotify_event *>(buf + off);
+      off += sizeof(inotify_event) + ev->len;
+      for (auto &f : files)
+      {
+        if (f.wd != ev->wd)
+          continue;
+        if (ev->mask & (IN_MODIFY | IN_ATTRIB))
+          output_failed |= !follow_catch_up(f, io, headers, last_printed);
+        // The kernel drops the watch once the file is deleted
+        if (ev->mask & IN_IGNORED)
+        {
+          f.wd = -1;
+          --watching;
+        }
+      }
+    }
+    if (output_failed)
+    {
+      status = 1;
+      break;
+    }
+  }
+  close(ino);
+  return status;
+}
+
+// Builtin: tail [-n [+]N] [-c [+]N] [-f] [-q] [FILE...]
+int builtin_tail(std::vector<std::string> &args, Io &io)
+{
+  LineCount count;
+  bool follow = false, quiet = false;
+  std::vector<std::string> names;
+  int status = 0;
+  if (!parse_head_tail_args("tail", args, io, count, follow, quiet, names, status))
+    return status;
+  bool headers = names.size() > 1 && !quiet;
+  std::vector<FollowedFile> followed;
+  for (size_t k = 0; k < names.size(); ++k)
+  {
+    int fd = open_input(names[k], io);
+    if (fd < 0)
+    {
+      status = builtin_error(io, "tail", "cannot open '" + names[k] + "' for reading: " + strerror(errno));
+      continue;
+    }
+    std::string label = names[k] == "-" ? "standard input" : names[k];
+    if (headers)
+      io.write(std::string(k ? "\n" : "") + "==> " + label + " <==\n");
+    bool read_ok;
+    off_t offset = 0;
+    bool write_ok = tail_fd(fd, io, count, read_ok, offset);
+    if (!read_ok)
+      status = builtin_error(io, "tail", "error reading '" + names[k] + "': " + strerror(errno));
+    struct stat sb;
+    // Only regular files can be followed; pipes have already ended
+    if (write_ok && follow && fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode))
+      followed.push_back(FollowedFile{label, fd, offset});
+    else
+      close_input(fd, io);
+    if (!write_ok)
+    {
+      for (auto &f : followed)
+        close_input(f.fd, io);
+      return 1;
+    }
+  }
+  if (!followed.empty())
+  {
+    int follow_status = follow_files(followed, io, headers);
+    if (follow_status)
+      status = follow_status;
+  }
+  for (auto &f : followed)
+    close_input(f.fd, io);
+  return status;
+}
@@ -0,0 +1,483 @@
+#include "builtins.hpp"
+#include "walk.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <pwd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+struct LsOptions
+{
+  bool all = false, long_format = false, one_per_line = false, recursive = false, reverse = false;
+  enum Sort
+  {
+    ByName,
+    ByTime,
+    BySize
+  } sort = ByName;
+  unsigned statx_mask = 0; // fields the chosen options actually need
+};
+
+// One name to list, with whatever metadata the options asked for
+struct LsEntry
+{
+  std::string name;
+  unsigned char type = DT_UNKNOWN;
+  struct statx sx{};
+  bool have_stat = false;
+  std::string link_target{};
+};
+
+// Directories with at least this many entries have their metadata fetched
+// on several threads, so round trips to a slow filesystem overlap
+static const size_t LS_PARALLEL_THRESHOLD = 512;
+
+// Helper: Fetch the requested statx fields for entries[begin, end)
+static void stat_entries(int dirfd, std::vector<LsEntry> &entries, size_t begin, size_t end, const LsOptions &opts)
+{
+  for (size_t i = begin; i < end; ++i)
+  {
+    LsEntry &e = entries[i];
+    // AT_STATX_DONT_SYNC lets network filesystems answer from their cache
+    if (statx(dirfd, e.name.c_str(), AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, opts.statx_mask, &e.sx) != 0)
+      continue;
+    e.have_stat = true;
+    if (e.type == DT_UNKNOWN)
+      e.type = IFTODT(e.sx.stx_mode);
+    if (opts.long_format && e.type == DT_LNK)
+    {
+      char target[PATH_MAX];
+      ssize_t len = readlinkat(dirfd, e.name.c_str(), target, sizeof(target));
+      if (len >= 0)
+        e.link_target.assign(target, len);
+    }
+  }
+}
+
+// Helper: Fill in metadata for a directory's entries, split over a small
+// pool of threads when the directory is large
+static void stat_all(int dirfd, std::vector<LsEntry> &entries, const LsOptions &opts)
+{
+  if (!opts.statx_mask)
+    return;
+  unsigned threads = std::min<size_t>(std::max(1u, std::min(8u, std::thread::hardware_concurrency())),
+                                      entries.size() / LS_PARALLEL_THRESHOLD + 1);
+  if (threads <= 1)
+  {
+    stat_entries(dirfd, entries, 0, entries.size(), opts);
+    return;
+  }
+  std::vector<std::thread> pool;
+  size_t per = (entries.size() + threads - 1) / threads;
+  for (unsigned t = 0; t < threads; ++t)
+  {
+    size_t begin = t * per, end = std::min(entries.size(), begin + per);
+    if (begin < end)
+      pool.emplace_back(stat_entries, dirfd, std::ref(entries), begin, end, std::cref(opts));
+  }
+  for (auto &t : pool)
+    t.join();
+}
+
+static bool timestamp_less(const struct statx_timestamp &a, const struct statx_timestamp &b)
+{
+  return a.tv_sec != b.tv_sec ? a.tv_sec < b.tv_sec : a.tv_nsec < b.tv_nsec;
+}
+
+// Helper: Order entries as the sort options say; ties fall back to the name
+static void sort_entries(std::vector<LsEntry> &entries, const LsOptions &opts)
+{
+  std::sort(entries.begin(), entries.end(), [&](const LsEntry &a, const LsEntry &b) {
+    if (opts.sort == LsOptions::ByTime && timestamp_less(a.sx.stx_mtime, b.sx.stx_mtime) !=
+                                              timestamp_less(b.sx.stx_mtime, a.sx.stx_mtime))
+      return timestamp_less(b.sx.stx_mtime, a.sx.stx_mtime) != opts.reverse;
+    if (opts.sort == LsOptions::BySize && a.sx.stx_size != b.sx.stx_size)
+      return (a.sx.stx_size > b.sx.stx_size) != opts.reverse;
+    return (strcmp(a.name.c_str(), b.name.c_str()) < 0) != opts.reverse;
+  });
+}
+
+// Helper: "drwxr-xr-x" for a mode
+static std::string mode_string(mode_t mode)
+{
+  std::string s = "?rwxrwxrwx";
+  switch (mode & S_IFMT)
+  {
+  case S_IFREG:
+    s[0] = '-';
+    break;
+  case S_IFDIR:
+    s[0] = 'd';
+    break;
+  case S_IFLNK:
+    s[0] = 'l';
+    break;
+  case S_IFCHR:
+    s[0] = 'c';
+    break;
+  case S_IFBLK:
+    s[0] = 'b';
+    break;
+  case S_IFIFO:
+    s[0] = 'p';
+    break;
+  case S_IFSOCK:
+    s[0] = 's';
+    break;
+  }
+  for (int i = 0; i < 9; ++i)
+    if (!(mode & (0400 >> i)))
+      s[i + 1] = '-';
+  if (mode & S_ISUID)
+    s[3] = s[3] == 'x' ? 's' : 'S';
+  if (mode & S_ISGID)
+    s[6] = s[6] == 'x' ? 's' : 'S';
+  if (mode & S_ISVTX)
+    s[9] = s[9] == 'x' ? 't' : 'T';
+  return s;
+}
+
+// Caches uid and gid lookups across a whole ls run
+struct NameCache
+{
+  std::unordered_map<uid_t, std::string> users;
+  std::unordered_map<gid_t, std::string> groups;
+
+  const std::string &user(uid_t uid)
+  {
+    auto it = users.find(uid);
+    if (it != users.end())
+      return it->second;
+    struct passwd *pw = getpwuid(uid);
+    return users[uid] = pw ? pw->pw_name : std::to_string(uid);
+  }
+
+  const std::string &group(gid_t gid)
+  {
+    auto it = groups.find(gid);
+    if (it != groups.end())
+      return it->second;
+    struct group *gr = getgrgid(gid);
+    return groups[gid] = gr ? gr->gr_name : std::to_string(gid);
+  }
+};
+
+// Helper: Print entries in -l format, columns aligned across the listing
+static void print_long(const std::vector<LsEntry> &entries, OutBuffer &out, NameCache &names, bool total)
+{
+  size_t nlink_w = 0, user_w = 0, group_w = 0, size_w = 0;
+  unsigned long long blocks = 0;
+  std::vector<std::string> sizes;
+  for (auto &e : entries)
+  {
+    if (!e.have_stat)
+    {
+      sizes.emplace_back();
+      continue;
+    }
+    const struct statx &sx = e.sx;
+    nlink_w = std::max(nlink_w, std::to_string(sx.stx_nlink).size());
+    user_w = std::max(user_w, names.user(sx.stx_uid).size());
+    group_w = std::max(group_w, names.group(sx.stx_gid).size());
+    if (S_ISCHR(sx.stx_mode) || S_ISBLK(sx.stx_mode))
+      sizes.push_back(std::to_string(sx.stx_rdev_major) + ", " + std::to_string(sx.stx_rdev_minor));
+    else
+      sizes.push_back(std::to_string(sx.stx_size));
+    size_w = std::max(size_w, sizes.back().size());
+    // Blocks are reported in 1K units, rounded up per file
+    blocks += (sx.stx_blocks + 1) / 2;
+  }
+  if (total)
+  {
+    out.put("total " + std::to_string(blocks));
+    out.put('\n');
+  }
+  time_t now = time(nullptr);
+  const time_t six_months = 31556952 / 2;
+  auto pad_left = [&](const std::string &s, size_t w) {
+    for (size_t i = s.size(); i < w; ++i)
+      out.put(' ');
+    out.put(s);
+  };
+  auto pad_right = [&](const std::string &s, size_t w) {
+    out.put(s);
+    for (size_t i = s.size(); i < w; ++i)
+      out.put(' ');
+  };
+  for (size_t k = 0; k < entries.size(); ++k)
+  {
+    const LsEntry &e = entries[k];
+    if (!e.have_stat)
+    {
+      out.put("?????????? ? ? ? ? ? ");
+      out.put(e.name);
+      out.put('\n');
+      continue;
+    }
+    const struct statx &sx = e.sx;
+    out.put(mode_string(sx.stx_mode));
+    out.put(' ');
+    pad_left(std::to_string(sx.stx_nlink), nlink_w);
+    out.put(' ');
+    pad_right(names.user(sx.stx_uid), user_w);
+    out.put(' ');
+    pad_right(names.group(sx.stx_gid), group_w);
+    out.put(' ');
+    pad_left(sizes[k], size_w);
+    out.put(' ');
+    time_t mtime = sx.stx_mtime.tv_sec;
+    struct tm tm;
+    localtime_r(&mtime, &tm);
+    char date[64];
+    bool recent = mtime > now - six_months && mtime <= now;
+    strftime(date, sizeof(date), recent ? "%b %e %H:%M" : "%b %e  %Y", &tm);
+    out.put(date);
+    out.put(' ');
+    out.put(e.name);
+    if (e.type == DT_LNK && !e.link_target.empty())
+    {
+      out.put(" -> ");
+      out.put(e.link_target);
+    }
+    out.put('\n');
+  }
+}
+
+// Helper: Print names in columns filling the terminal width, top to bottom
+// then left to right
+static void print_columns(const std::vector<LsEntry> &entries, OutBuffer &out, size_t width)
+{
+  size_t n = entries.size();
+  if (n == 0)
+    return;
+  size_t cols = 1, rows = n;
+  std::vector<size_t> col_widths;
+  for (size_t try_cols = std::min(n, std::max<size_t>(1, width / 3)); try_cols > 1; --try_cols)
+  {
+    size_t try_rows = (n + try_cols - 1) / try_cols;
+    // Skip layouts that leave whole columns empty
+    if ((try_cols - 1) * try_rows >= n)
+      continue;
+    std::vector<size_t> widths(try_cols, 0);
+    for (size_t i = 0; i < n; ++i)
+      widths[i / try_rows] = std::max(widths[i / try_rows], entries[i].name.size());
+    size_t total = 0;
+    for (size_t c = 0; c < try_cols; ++c)
+      total += widths[c] + (c + 1 < try_cols ? 2 : 0);
+    if (total <= width)
+    {
+      cols = try_cols;
+      rows = try_rows;
+      col_widths = widths;
+      break;
+    }
+  }
+  for (size_t r = 0; r < rows; ++r)
+  {
+    for (size_t c = 0; c < cols; ++c)
+    {
+      size_t i = c * rows + r;
+      if (i >= n)
+        break;
+      out.put(entries[i].name);
+      if (c + 1 < cols && (c + 1) * rows + r < n)
+        for (size_t pad = entries[i].name.size(); pad < col_widths[c] + 2; ++pad)
+          out.put(' ');
+    }
+    out.put('\n');
+  }
+}
+
+// Helper: Print a set of entries in the chosen format
+static void print_entries(const std::vector<LsEntry> &entries, const LsOptions &opts, OutBuffer &out,
+                          NameCache &names, size_t term_width, bool total)
+{
+  if (opts.long_format)
+    print_long(entries, out, names, total);
+  else if (opts.one_per_line || term_width == 0)
+    for (auto &e : entries)
+    {
+      out.put(e.name);
+      out.put('\n');
+    }
+  else
+    print_columns(entries, out, term_width);
+}
+
+// Helper: List one directory (and with -R, everything below it)
+static int list_directory(int parent_fd, const std::string &name, const std::string &path, const LsOptions &opts,
+                          OutBuffer &out, NameCache &names, size_t term_width, bool header, bool &first_block, Io &io)
+{
+  int fd = openat(parent_fd, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    out.flush();
+    return builtin_error(io, "ls", "cannot open directory '" + path + "': " + strerror(errno), 2);
+  }
+  std::vector<LsEntry> entries;
+  if (opts.all)
+    for (const char *dot : {".", ".."})
+      entries.push_back(LsEntry{.name = dot, .type = DT_DIR});
+  bool ok = read_dir(fd, [&](const char *entry_name, unsigned char type, ino_t) {
+    if (opts.all || entry_name[0] != '.')
+      entries.push_back(LsEntry{.name = entry_name, .type = type});
+  });
+  int status = 0;
+  if (!ok)
+  {
+    out.flush();
+    status = builtin_error(io, "ls", "reading directory '" + path + "': " + strerror(errno), 2);
+  }
+  stat_all(fd, entries, opts);
+  sort_entries(entries, opts);
+  if (header)
+  {
+    if (!first_block)
+      out.put('\n');
+    out.put(path);
+    out.put(":\n");
+  }
+  first_block = false;
+  print_entries(entries, opts, out, names, term_width, true);
+  if (opts.recursive)
+  {
+    for (auto &e : entries)
+    {
+      if (e.name == "." || e.name == "..")
+        continue;
+      if (e.type == DT_UNKNOWN)
+      {
+        struct stat sb;
+        if (fstatat(fd, e.name.c_str(), &sb, AT_SYMLINK_NOFOLLOW) == 0)
+          e.type = IFTODT(sb.st_mode);
+      }
+      if (e.type != DT_DIR)
+        continue;
+      std::string child = path + (path.back() == '/' ? "" : "/") + e.name;
+      int child_status = list_directory(fd, e.name, child, opts, out, names, term_width, true, first_block, io);
+      if (child_status)
+        status = child_status;
+    }
+  }
+  close(fd);
+  return status;
+}
+
+// Builtin: ls [-l] [-a] [-1] [-t] [-S] [-r] [-R] [FILE...]
+int builtin_ls(std::vector<std::string> &args, Io &io)
+{
+  LsOptions opts;
+  std::vector<std::string> operands;
+  bool options_done = false;
+  for (size_t i = 1; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (options_done || arg.size() < 2 || arg[0] != '-')
+    {
+      operands.push_back(arg);
+      continue;
+    }
+    if (arg == "--")
+    {
+      options_done = true;
+      continue;
+    }
+    for (size_t j = 1; j < arg.size(); ++j)
+    {
+      switch (arg[j])
+      {
+      case 'l':
+        opts.long_format = true;
+        break;
+      case 'a':
+        opts.all = true;
+        break;
+      case '1':
+        opts.one_per_line = true;
+        break;
+      case 't':
+        opts.sort = LsOptions::ByTime;
+        break;
+      case 'S':
+        opts.sort = LsOptions::BySize;
+        break;
+      case 'r':
+        opts.reverse = true;
+        break;
+      case 'R':
+        opts.recursive = true;
+        break;
+      default:
+        return unsupported_option(args, io, std::string("invalid option -- '") + arg[j] + "'", 2);
+      }
+    }
+  }
+  // Only fetch what will be shown or sorted on; a plain listing needs no
+  // metadata at all beyond getdents64's d_type
+  if (opts.long_format)
+    opts.statx_mask = STATX_BASIC_STATS;
+  else if (opts.sort == LsOptions::ByTime)
+    opts.statx_mask = STATX_TYPE | STATX_MTIME;
+  else if (opts.sort == LsOptions::BySize)
+    opts.statx_mask = STATX_TYPE | STATX_SIZE;
+  if (operands.empty())
+    operands.push_back(".");
+
+  // Columns only for a terminal, as ls does
+  size_t term_width = 0;
+  struct winsize ws;
+  if (isatty(io.out))
+    term_width = ioctl(io.out, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 ? ws.ws_col : 80;
+
+  int status = 0;
+  OutBuffer out(io, 1 << 16);
+  NameCache names;
+  // Operands that are not directories are listed first, together
+  std::vector<LsEntry> files;
+  std::vector<LsEntry> dirs;
+  LsOptions operand_opts = opts;
+  operand_opts.statx_mask |= STATX_TYPE | STATX_MODE;
+  for (auto &operand : operands)
+  {
+    std::vector<LsEntry> one{LsEntry{.name = operand}};
+    stat_entries(AT_FDCWD, one, 0, 1, operand_opts);
+    if (!one[0].have_stat)
+    {
+      status = builtin_error(io, "ls", "cannot access '" + operand + "': " + strerror(errno), 2);
+      continue;
+    }
+    // Symlinks named on the command line are followed to directories
+    struct stat sb;
+    if (S_ISDIR(one[0].sx.stx_mode) ||
+        (S_ISLNK(one[0].sx.stx_mode) && !opts.long_format && stat(operand.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode)))
+      dirs.push_back(one[0]);
+    else
+      files.push_back(one[0]);
+  }
+  sort_entries(files, opts);
+  sort_entries(dirs, opts);
+  print_entries(files, opts, out, names, term_width, false);
+  bool first_block = files.empty();
+  bool headers = operands.size() > 1 || opts.recursive;
+  for (auto &d : dirs)
+  {
+    int dir_status =
+        list_directory(AT_FDCWD, d.name, d.name, opts, out, names, term_width, headers, first_block, io);
+    if (dir_status)
+      status = dir_status;
+  }
+  if (!out.flush())
+    return 2;
+  return status;
+}
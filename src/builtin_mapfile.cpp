@@ -0,0 +1,173 @@
+#include "builtins.hpp"
+#include "simd.hpp"
+#include "vars.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Records are indexed this many bytes at a time
+static const size_t MAPFILE_INDEX_CHUNK = 1 << 16;
+
+// Helper: Read everything left on fd into one string. The rest of a regular
+// file is read straight into place in one call; more data than expected (a
+// pipe, or a file that grew) is appended a block at a time.
+static bool slurp_fd(int fd, std::string &out)
+{
+  struct stat sb;
+  if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode))
+  {
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset >= 0 && sb.st_size > offset)
+      out.resize(sb.st_size - offset);
+  }
+  size_t used = 0;
+  char block[1 << 16];
+  while (true)
+  {
+    bool in_place = used < out.size();
+    ssize_t n = in_place ? ::read(fd, out.data() + used, out.size() - used) : ::read(fd, block, sizeof(block));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+    {
+      out.resize(used);
+      return n == 0;
+    }
+    if (!in_place)
+      out.append(block, n);
+    used += n;
+  }
+}
+
+// Builtin: mapfile [-t] [-d DELIM] [-n COUNT] [-O ORIGIN] [-s COUNT] [-u FD] [ARRAY]
+int builtin_mapfile(std::vector<std::string> &args, Io &io)
+{
+  const std::string &cmd = args[0];
+  bool trim = false, have_origin = false;
+  char delim = '\n';
+  size_t count = 0, origin = 0, skip = 0;
+  int fd = io.in;
+  size_t i = 1;
+  for (; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (arg.size() < 2 || arg[0] != '-')
+      break;
+    if (arg == "--")
+    {
+      ++i;
+      break;
+    }
+    for (size_t j = 1; j < arg.size(); ++j)
+    {
+      char opt = arg[j];
+      if (opt == 't')
+      {
+        trim = true;
+        continue;
+      }
+      if (!strchr("dnOsu", opt))
+        return builtin_error(io, cmd, std::string("-") + opt + ": invalid option", 2);
+      std::string value;
+      if (j + 1 < arg.size())
+        value = arg.substr(j + 1);
+      else if (i + 1 < args.size())
+        value = args[++i];
+      else
+        return builtin_error(io, cmd, std::string("-") + opt + ": option requires an argument", 2);
+      j = arg.size();
+      if (opt == 'd')
+      {
+        delim = value.empty() ? '\0' : value[0];
+        continue;
+      }
+      if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+        return builtin_error(io, cmd, value + ": invalid number", 1);
+      size_t n = std::stoull(value);
+      if (opt == 'n')
+        count = n;
+      else if (opt == 'O')
+        origin = n, have_origin = true;
+      else if (opt == 's')
+        skip = n;
+      else
+        fd = n;
+    }
+  }
+  std::string name = i < args.size() ? args[i] : "MAPFILE";
+  if (!valid_name(name))
+    return builtin_error(io, cmd, "'" + name + "': not a valid identifier");
+
+  // -O keeps the elements below the origin; otherwise the array starts over
+  IndexedArray array;
+  Variable *old = find_var(name);
+  if (have_origin && old)
+  {
+    if (old->kind == Variable::Indexed)
+      array = old->elements;
+    else if (old->kind == Variable::Scalar)
+      array.set(0, old->value);
+  }
+  size_t index = origin;
+  auto add = [&](ArrayElement e) { array.set(index++, std::move(e)); };
+
+  if (count > 0)
+  {
+    // A bounded read must leave the rest of the input alone, so records
+    // are taken one at a time
+    std::string record;
+    for (size_t taken = 0; taken < skip + count;)
+    {
+      int result = read_record(fd, delim, SIZE_MAX, -1, record);
+      if (result < 0)
+        return builtin_error(io, cmd, std::string("read error: ") + strerror(errno));
+      if (result == 0 && record.empty())
+        break;
+      if (result == 1 && !trim)
+        record += delim;
+      if (taken++ >= skip)
+        add(record);
+      if (result == 0)
+        break;
+    }
+  }
+  else
+  {
+    // Everything is read into one buffer the array keeps, and a single
+    // vector scan finds every delimiter. Elements are views into the
+    // buffer, so loading costs no per-line allocation.
+    auto data = std::make_shared<std::string>();
+    if (!slurp_fd(fd, *data))
+      return builtin_error(io, cmd, std::string("read error: ") + strerror(errno));
+    const char *p = data->data();
+    size_t len = data->size(), start = 0, seen = 0;
+    array.reserve(index + count_byte(p, len, delim) + 1);
+    std::vector<uint32_t> positions(MAPFILE_INDEX_CHUNK);
+    for (size_t base = 0; base < len; base += MAPFILE_INDEX_CHUNK)
+    {
+      size_t chunk = std::min(MAPFILE_INDEX_CHUNK, len - base);
+      size_t n = index_bytes(p + base, chunk, delim, delim, positions.data());
+      for (size_t k = 0; k < n; ++k)
+      {
+        size_t end = base + positions[k];
+        if (seen++ >= skip)
+          add(std::string_view(p + start, end - start + !trim));
+        start = end + 1;
+      }
+    }
+    if (start < len && seen >= skip)
+      add(std::string_view(p + start, len - start));
+    // Views into an earlier buffer stay valid by chaining it to this one
+    if (array.backing)
+      array.backing = std::make_shared<std::pair<std::shared_ptr<const void>, std::shared_ptr<const std::string>>>(
+          array.backing, data);
+    else
+      array.backing = data;
+  }
+  set_array(name, std::move(array));
+  return 0;
+}
@@ -0,0 +1,189 @@
+#include "builtins.hpp"
+#include "vars.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Builtin: read [-r] [-d DELIM] [-n COUNT] [-t TIMEOUT] [-a ARRAY] [-p PROMPT] [NAME...]
+int builtin_read(std::vector<std::string> &args, Io &io)
+{
+  bool raw = false;
+  char delim = '\n';
+  size_t count = SIZE_MAX;
+  int timeout_ms = -1;
+  std::string array_name, prompt;
+  std::vector<std::string> names;
+  size_t i = 1;
+  for (; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (arg.size() < 2 || arg[0] != '-')
+      break;
+    if (arg == "--")
+    {
+      ++i;
+      break;
+    }
+    for (size_t j = 1; j < arg.size(); ++j)
+    {
+      char opt = arg[j];
+      if (opt == 'r')
+      {
+        raw = true;
+        continue;
+      }
+      if (!strchr("dntap", opt))
+        return builtin_error(io, "read", std::string("-") + opt + ": invalid option", 2);
+      std::string value;
+      if (j + 1 < arg.size())
+        value = arg.substr(j + 1);
+      else if (i + 1 < args.size())
+        value = args[++i];
+      else
+        return builtin_error(io, "read", std::string("-") + opt + ": option requires an argument", 2);
+      j = arg.size();
+      if (opt == 'd')
+        delim = value.empty() ? '\0' : value[0];
+      else if (opt == 'n')
+      {
+        if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+          return builtin_error(io, "read", value + ": invalid number", 2);
+        count = std::stoull(value);
+      }
+      else if (opt == 't')
+      {
+        char *end;
+        double seconds = strtod(value.c_str(), &end);
+        if (value.empty() || *end != '\0' || !(seconds >= 0))
+          return builtin_error(io, "read", value + ": invalid timeout specification", 2);
+        timeout_ms = (int)std::min(std::ceil(seconds * 1000), (double)INT32_MAX);
+      }
+      else if (opt == 'a')
+        array_name = value;
+      else
+        prompt = value;
+    }
+  }
+  names.assign(args.begin() + i, args.end());
+  for (auto &name : names)
+    if (!valid_name(name))
+      return builtin_error(io, "read", "'" + name + "': not a valid identifier");
+  if (!array_name.empty() && !valid_name(array_name))
+    return builtin_error(io, "read", "'" + array_name + "': not a valid identifier");
+
+  // -t 0 only asks whether input is waiting
+  if (timeout_ms == 0)
+  {
+    pollfd pfd = {io.in, POLLIN, 0};
+    return poll(&pfd, 1, 0) == 1 ? 0 : 1;
+  }
+
+  bool tty = isatty(io.in);
+  if (!prompt.empty() && tty)
+  {
+    Io err_io{io.in, io.err, io.err};
+    err_io.write(prompt);
+  }
+  // A terminal hands over input a line at a time unless canonical mode is
+  // off for the duration of a -n or -d read
+  termios saved;
+  bool restore = false;
+  if (tty && (count != SIZE_MAX || delim != '\n') && tcgetattr(io.in, &saved) == 0)
+  {
+    termios tio = saved;
+    tio.c_lflag &= ~ICANON;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    restore = tcsetattr(io.in, TCSANOW, &tio) == 0;
+  }
+
+  // Backslashes quote the next byte unless -r; quoted bytes never split
+  // fields, and a quoted newline joins the next line on
+  std::string line, chunk;
+  std::vector<char> escaped;
+  int result;
+  while (true)
+  {
+    result = read_record(io.in, delim, count - line.size(), timeout_ms, chunk);
+    if (result < 0)
+      break;
+    if (raw)
+    {
+      line += chunk;
+      break;
+    }
+    bool more = false;
+    for (size_t k = 0; k < chunk.size(); ++k)
+    {
+      if (chunk[k] != '\\')
+      {
+        line += chunk[k];
+        escaped.resize(line.size());
+        continue;
+      }
+      // Backslash-newline is a line continuation whatever the delimiter
+      if (k + 1 < chunk.size() && chunk[k + 1] == '\n')
+      {
+        ++k;
+        continue;
+      }
+      if (k + 1 < chunk.size())
+      {
+        line += chunk[++k];
+        escaped.resize(line.size(), 1);
+        continue;
+      }
+      // A trailing backslash quotes the delimiter itself
+      if (result == 1 && line.size() + 1 < count)
+      {
+        more = true;
+        if (delim != '\n')
+        {
+          line += delim;
+          escaped.resize(line.size(), 1);
+        }
+      }
+    }
+    if (!more)
+      break;
+  }
+  if (restore)
+    tcsetattr(io.in, TCSANOW, &saved);
+  if (result == -1)
+    return builtin_error(io, "read", std::string("read error: ") + strerror(errno));
+
+  // Partial input is still assigned at end of input or on a timeout
+  std::string_view ifs = current_ifs();
+  const std::vector<char> *mask = escaped.empty() ? nullptr : &escaped;
+  if (!array_name.empty())
+  {
+    FieldSplitter split(line, ifs, mask);
+    std::vector<ArrayElement> fields;
+    std::string field;
+    while (split.next(field))
+      fields.emplace_back(field);
+    set_array(array_name, IndexedArray(std::move(fields)));
+  }
+  else if (names.empty())
+    set_var("REPLY", line);
+  else
+  {
+    FieldSplitter split(line, ifs, mask);
+    for (size_t k = 0; k + 1 < names.size(); ++k)
+    {
+      std::string field;
+      split.next(field);
+      set_var(names[k], field);
+    }
+    set_var(names.back(), split.rest());
+  }
+  if (result == -2)
+    return 128 + SIGALRM;
+  return result == 1 ? 0 : 1;
+}
@@ -0,0 +1,632 @@
+#include "builtins.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <queue>
+#include <thread>
+#include <unistd.h>
+
+// One -k key: fields and characters are 1-based, an end field of 0 means
+// the end of the line and an end char of 0 the end of the end field
+struct SortKey
+{
+  size_t start_field = 1, start_char = 1, end_field = 0, end_char = 0;
+  bool numeric = false, reverse = false, skip_blanks = false;
+};
+
+struct SortOptions
+{
+  std::vector<SortKey> keys;
+  char separator = 0; // 0 means fields are separated by runs of blanks
+  bool unique = false, reverse = false;
+};
+
+static bool is_blank(char c)
+{
+  return c == ' ' || c == '\t';
+}
+
+// Helper: Start of field (1-based) in line, or line.size() if missing
+static size_t field_start(std::string_view line, size_t field, char sep)
+{
+  size_t pos = 0;
+  for (size_t f = 1; f < field && pos < line.size(); ++f)
+  {
+    if (sep)
+    {
+      size_t next = line.find(sep, pos);
+      pos = next == std::string_view::npos ? line.size() : next + 1;
+    }
+    else
+    {
+      // Without -t a field's leading blanks belong to it
+      while (pos < line.size() && is_blank(line[pos]))
+        ++pos;
+      while (pos < line.size() && !is_blank(line[pos]))
+        ++pos;
+    }
+  }
+  return std::min(pos, line.size());
+}
+
+// Helper: End of the field starting at pos
+static size_t field_end(std::string_view line, size_t pos, char sep)
+{
+  if (sep)
+  {
+    size_t next = line.find(sep, pos);
+    return next == std::string_view::npos ? line.size() : next;
+  }
+  while (pos < line.size() && is_blank(line[pos]))
+    ++pos;
+  while (pos < line.size() && !is_blank(line[pos]))
+    ++pos;
+  return pos;
+}
+
+static std::string_view extract_key(std::string_view line, const SortKey &key, char sep)
+{
+  size_t begin = field_start(line, key.start_field, sep);
+  if (key.skip_blanks)
+    while (begin < line.size() && is_blank(line[begin]))
+      ++begin;
+  begin = std::min(begin + key.start_char - 1, line.size());
+  size_t end = line.size();
+  if (key.end_field)
+  {
+    size_t f = field_start(line, key.end_field, sep);
+    if (key.end_char)
+    {
+      if (key.skip_blanks)
+        while (f < line.size() && is_blank(line[f]))
+          ++f;
+      end = std::min(f + key.end_char, line.size());
+    }
+    else
+      end = field_end(line, f, sep);
+  }
+  if (end < begin)
+    end = begin;
+  return line.substr(begin, end - begin);
+}
+
+// Helper: Leading numeric value of s as sort -n reads it; 0 if none
+static double parse_number(std::string_view s)
+{
+  size_t i = 0;
+  while (i < s.size() && is_blank(s[i]))
+    ++i;
+  bool negative = i < s.size() && s[i] == '-';
+  if (negative)
+    ++i;
+  double value = 0, scale = 0;
+  for (; i < s.size(); ++i)
+  {
+    char c = s[i];
+    if (c >= '0' && c <= '9')
+    {
+      value = value * 10 + (c - '0');
+      if (scale)
+        scale *= 10;
+    }
+    else if (c == '.' && !scale)
+      scale = 1;
+    else
+      break;
+  }
+  if (scale)
+    value /= scale;
+  return negative ? -value : value;
+}
+
+static int compare_bytes(std::string_view a, std::string_view b)
+{
+  int c = memcmp(a.data(), b.data(), std::min(a.size(), b.size()));
+  if (c)
+    return c;
+  return (a.size() > b.size()) - (a.size() < b.size());
+}
+
+static int compare_key(std::string_view a, std::string_view b, const SortKey &key)
+{
+  int c;
+  if (key.numeric)
+  {
+    double x = parse_number(a), y = parse_number(b);
+    c = (x > y) - (x < y);
+  }
+  else
+    c = compare_bytes(a, b);
+  return key.reverse ? -c : c;
+}
+
+// Compares by keys from index first onwards, then by the whole line as a
+// last resort (skipped under -u, where lines with equal keys are duplicates)
+static int compare_lines(std::string_view a, std::string_view b, const SortOptions &opts, size_t first = 0)
+{
+  for (size_t k = first; k < opts.keys.size(); ++k)
+  {
+    const SortKey &key = opts.keys[k];
+    int c = compare_key(extract_key(a, key, opts.separator), extract_key(b, key, opts.separator), key);
+    if (c)
+      return c;
+  }
+  if (opts.unique && !opts.keys.empty())
+    return 0;
+  int c = compare_bytes(a, b);
+  return opts.reverse ? -c : c;
+}
+
+// Helper: Sort v with up to one thread per core: each thread sorts a slice,
+// then slices are merged pairwise, also in parallel
+template <typename Less> static void parallel_sort(std::vector<uint32_t> &v, Less less, bool stable)
+{
+  auto sort_range = [&](uint32_t *first, uint32_t *last) {
+    if (stable)
+      std::stable_sort(first, last, less);
+    else
+      std::sort(first, last, less);
+  };
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, v.size() / 16384);
+  if (threads <= 1)
+  {
+    sort_range(v.data(), v.data() + v.size());
+    return;
+  }
+  std::vector<size_t> bounds;
+  for (size_t t = 0; t <= threads; ++t)
+    bounds.push_back(v.size() * t / threads);
+  std::vector<std::thread> pool;
+  for (size_t t = 0; t < threads; ++t)
+    pool.emplace_back(sort_range, v.data() + bounds[t], v.data() + bounds[t + 1]);
+  for (auto &th : pool)
+    th.join();
+  std::vector<uint32_t> tmp(v.size());
+  while (bounds.size() > 2)
+  {
+    std::vector<size_t> merged = {0};
+    pool.clear();
+    for (size_t i = 0; i + 1 < bounds.size(); i += 2)
+    {
+      size_t lo = bounds[i], mid = bounds[i + 1], hi = i + 2 < bounds.size() ? bounds[i + 2] : mid;
+      pool.emplace_back([&, lo, mid, hi] {
+        std::merge(v.begin() + lo, v.begin() + mid, v.begin() + mid, v.begin() + hi, tmp.begin() + lo, less);
+      });
+      merged.push_back(hi);
+    }
+    for (auto &th : pool)
+      th.join();
+    v.swap(tmp);
+    bounds.swap(merged);
+  }
+}
+
+// Lines gathered up to the memory budget, with the primary key of every
+// line extracted once into parallel arrays for the comparison loop
+struct SortChunk
+{
+  std::vector<std::unique_ptr<char[]>> arena; // Copies of piped input
+  std::vector<std::string_view> lines;
+  size_t bytes = 0;
+
+  std::vector<std::string_view> keys;
+  std::vector<uint64_t> prefixes; // First 8 key bytes, big-endian
+  std::vector<double> numbers;
+
+  void clear()
+  {
+    arena.clear();
+    lines.clear();
+    keys.clear();
+    prefixes.clear();
+    numbers.clear();
+    bytes = 0;
+  }
+
+  // Returns the line indexes in sorted order
+  std::vector<uint32_t> sort(const SortOptions &opts)
+  {
+    SortKey whole;
+    const SortKey &primary = opts.keys.empty() ? whole : opts.keys[0];
+    size_t n = lines.size();
+    keys.resize(n);
+    if (primary.numeric)
+      numbers.resize(n);
+    else
+      prefixes.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+      keys[i] = opts.keys.empty() ? lines[i] : extract_key(lines[i], primary, opts.separator);
+      if (primary.numeric)
+        numbers[i] = parse_number(keys[i]);
+      else
+      {
+        unsigned char bytes[8] = {};
+        memcpy(bytes, keys[i].data(), std::min<size_t>(8, keys[i].size()));
+        uint64_t p = 0;
+        for (unsigned char b : bytes)
+          p = p << 8 | b;
+        prefixes[i] = p;
+      }
+    }
+    std::vector<uint32_t> order(n);
+    for (size_t i = 0; i < n; ++i)
+      order[i] = i;
+    size_t rest = opts.keys.empty() ? 0 : 1;
+    auto less = [&](uint32_t x, uint32_t y) {
+      int c;
+      if (primary.numeric)
+        c = (numbers[x] > numbers[y]) - (numbers[x] < numbers[y]);
+      else if (prefixes[x] != prefixes[y])
+        c = prefixes[x] < prefixes[y] ? -1 : 1;
+      else
+        c = compare_bytes(keys[x], keys[y]);
+      if (primary.reverse)
+        c = -c;
+      if (c == 0)
+        c = compare_lines(lines[x], lines[y], opts, rest);
+      return c < 0;
+    };
+    parallel_sort(order, less, opts.unique);
+    return order;
+  }
+};
+
+// Helper: Add every line of [p, p + len) to the chunk; the bytes must stay
+// alive as long as the chunk does
+static void add_lines(SortChunk &chunk, const char *p, size_t len)
+{
+  const char *end = p + len;
+  while (p < end)
+  {
+    const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+    const char *e = nl ? nl : end;
+    chunk.lines.emplace_back(p, e - p);
+    chunk.bytes += (e - p) + sizeof(std::string_view) + 24;
+    p = e + 1;
+  }
+}
+
+// Buffered line reader over a spilled run
+class RunReader
+{
+public:
+  explicit RunReader(int fd) : fd(fd), buf(1 << 20) {}
+  ~RunReader() { close(fd); }
+
+  // The returned view is valid until the next call
+  bool next(std::string_view &line)
+  {
+    while (true)
+    {
+      const char *nl = static_cast<const char *>(memchr(buf.data() + pos, '\n', len - pos));
+      if (nl)
+      {
+        line = std::string_view(buf.data() + pos, nl - (buf.data() + pos));
+        pos = nl - buf.data() + 1;
+        return true;
+      }
+      memmove(buf.data(), buf.data() + pos, len - pos);
+      len -= pos;
+      pos = 0;
+      if (len == buf.size())
+        buf.resize(buf.size() * 2);
+      ssize_t n = read(fd, buf.data() + len, buf.size() - len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false; // Runs always end with a newline
+      len += n;
+    }
+  }
+
+private:
+  int fd;
+  std::vector<char> buf;
+  size_t pos = 0, len = 0;
+};
+
+// Helper: Parse a -k spec like "2", "2,2", "2n", "3.2,3.4r"
+static bool parse_key(const std::string &spec, SortKey &key)
+{
+  size_t i = 0;
+  auto number = [&](size_t &out) {
+    size_t start = i;
+    out = 0;
+    while (i < spec.size() && isdigit((unsigned char)spec[i]))
+      out = out * 10 + (spec[i++] - '0');
+    return i > start;
+  };
+  auto modifiers = [&] {
+    for (; i < spec.size() && isalpha((unsigned char)spec[i]); ++i)
+    {
+      if (spec[i] == 'n')
+        key.numeric = true;
+      else if (spec[i] == 'r')
+        key.reverse = true;
+      else if (spec[i] == 'b')
+        key.skip_blanks = true;
+      else
+        return false;
+    }
+    return true;
+  };
+  if (!number(key.start_field) || key.start_field == 0)
+    return false;
+  if (i < spec.size() && spec[i] == '.' && (++i, !number(key.start_char) || key.start_char == 0))
+    return false;
+  if (!modifiers())
+    return false;
+  if (i < spec.size() && spec[i] == ',')
+  {
+    ++i;
+    if (!number(key.end_field) || key.end_field == 0)
+      return false;
+    if (i < spec.size() && spec[i] == '.' && (++i, !number(key.end_char)))
+      return false;
+    if (!modifiers())
+      return false;
+  }
+  return i == spec.size();
+}
+
+// Helper: Parse a -S size like "100M"; returns 0 when invalid
+static size_t parse_size(const std::string &s)
+{
+  char *end;
+  double v = strtod(s.c_str(), &end);
+  size_t mult = 1024; // Plain numbers are KiB, as in GNU sort
+  switch (*end)
+  {
+  case 'b':
+    mult = 1;
+    break;
+  case 'K':
+  case 'k':
+    break;
+  case 'M':
+  case 'm':
+    mult = 1 << 20;
+    break;
+  case 'G':
+  case 'g':
+    mult = 1 << 30;
+    break;
+  case '\0':
+    break;
+  default:
+    return 0;
+  }
+  return v > 0 ? size_t(v * mult) : 0;
+}
+
+// Builtin: sort [-nru] [-t SEP] [-k KEY]... [-S SIZE] [-T DIR] [FILE...]
+// Sorts in memory with a parallel sort; input beyond the -S budget is
+// written out as sorted runs and k-way merged
+int builtin_sort(std::vector<std::string> &args, Io &io)
+{
+  SortOptions opts;
+  bool numeric = false, skip_blanks = false;
+  std::vector<std::string> key_specs, files;
+  size_t budget = size_t(256) << 20;
+  std::string tmpdir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+  for (size_t i = 1; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (arg.size() < 2 || arg[0] != '-')
+    {
+      files.push_back(arg);
+      continue;
+    }
+    for (size_t j = 1; j < arg.size(); ++j)
+    {
+      char c = arg[j];
+      if (c == 'n')
+        numeric = true;
+      else if (c == 'r')
+        opts.reverse = true;
+      else if (c == 'u')
+        opts.unique = true;
+      else if (c == 'b')
+        skip_blanks = true;
+      else if (c == 't' || c == 'k' || c == 'S' || c == 'T')
+      {
+        std::string value;
+        if (j + 1 < arg.size())
+          value = arg.substr(j + 1);
+        else if (i + 1 < args.size())
+          value = args[++i];
+        else
+          return builtin_error(io, "sort", std::string("option requires an argument -- '") + c + "'", 2);
+        if (c == 't')
+        {
+          if (value.size() != 1)
+            return builtin_error(io, "sort", "multi-character tab '" + value + "'", 2);
+          opts.separator = value[0];
+        }
+        else if (c == 'k')
+          key_specs.push_back(value);
+        else if (c == 'S' && !(budget = parse_size(value)))
+          return builtin_error(io, "sort", "invalid -S argument '" + value + "'", 2);
+        else if (c == 'T')
+          tmpdir = value;
+        break;
+      }
+      else
+        return unsupported_option(args, io, std::string("invalid option -- '") + c + "'", 2);
+    }
+  }
+  for (auto &spec : key_specs)
+  {
+    SortKey key;
+    if (!parse_key(spec, key))
+      return unsupported_option(args, io, "invalid key specification '" + spec + "'", 2);
+    // A key without its own modifiers takes the global ones
+    if (!key.numeric && !key.reverse && !key.skip_blanks)
+    {
+      key.numeric = numeric;
+      key.reverse = opts.reverse;
+      key.skip_blanks = skip_blanks;
+    }
+    opts.keys.push_back(key);
+  }
+  if (opts.keys.empty() && (numeric || opts.reverse || skip_blanks))
+  {
+    SortKey whole;
+    whole.numeric = numeric;
+    whole.reverse = opts.reverse;
+    whole.skip_blanks = skip_blanks;
+    opts.keys.push_back(whole);
+  }
+  if (files.empty())
+    files.push_back("-");
+
+  SortChunk chunk;
+  std::vector<std::unique_ptr<MappedFile>> mappings;
+  std::vector<int> runs;
+  int status = 0;
+
+  // Writes sorted lines, dropping key-equal neighbours under -u
+  auto emit = [&](OutBuffer &out, std::string_view line, std::string_view &prev, bool &have_prev) {
+    if (opts.unique && have_prev && compare_lines(prev, line, opts) == 0)
+      return;
+    out.put(line);
+    out.put('\n');
+    prev = line;
+    have_prev = true;
+  };
+  auto spill = [&]() {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/sortXXXXXX", tmpdir.c_str());
+    int fd = mkstemp(path);
+    if (fd < 0)
+      return false;
+    unlink(path);
+    {
+      Io run_io{-1, fd, io.err};
+      OutBuffer out(run_io, 1 << 20);
+      std::string_view prev;
+      bool have_prev = false;
+      for (uint32_t i : chunk.sort(opts))
+        emit(out, chunk.lines[i], prev, have_prev);
+      if (!out.flush())
+      {
+        close(fd);
+        return false;
+      }
+    }
+    lseek(fd, 0, SEEK_SET);
+    runs.push_back(fd);
+    chunk.clear();
+    return true;
+  };
+
+  bool spill_failed = false;
+  for (auto &file : files)
+  {
+    int fd = open_input(file, io);
+    if (fd < 0)
+    {
+      status = builtin_error(io, "sort", "cannot read: " + file + ": " + strerror(errno), 2);
+      continue;
+    }
+    auto mapping = std::make_unique<MappedFile>();
+    if (mapping->map(fd))
+    {
+      // Lines point into the mapping; slice it at line boundaries so each
+      // chunk stays within the budget
+      const char *p = mapping->data(), *end = p + mapping->size();
+      while (p < end && !spill_failed)
+      {
+        const char *slice_end = end;
+        if (size_t(end - p) > budget)
+        {
+          const char *nl = static_cast<const char *>(memchr(p + budget, '\n', end - p - budget));
+          slice_end = nl ? nl + 1 : end;
+        }
+        add_lines(chunk, p, slice_end - p);
+        p = slice_end;
+        if (chunk.bytes >= budget && !spill())
+          spill_failed = true;
+      }
+      lseek(fd, mapping->size(), SEEK_CUR);
+      mappings.push_back(std::move(mapping));
+    }
+    else
+    {
+      bool ok = read_line_blocks(fd, [&](const char *p, size_t len) {
+        auto copy = std::make_unique<char[]>(len);
+        memcpy(copy.get(), p, len);
+        add_lines(chunk, copy.get(), len);
+        chunk.arena.push_back(std::move(copy));
+        if (chunk.bytes >= budget && !spill())
+          spill_failed = true;
+        return !spill_failed;
+      });
+      if (!ok)
+        status = builtin_error(io, "sort", "read failed: " + file + ": " + strerror(errno), 2);
+    }
+    close_input(fd, io);
+  }
+  if (spill_failed)
+  {
+    for (int fd : runs)
+      close(fd);
+    return builtin_error(io, "sort", "cannot write temporary file in " + tmpdir + ": " + strerror(errno), 2);
+  }
+
+  OutBuffer out(io, 1 << 20);
+  std::string_view prev;
+  bool have_prev = false;
+  if (runs.empty())
+  {
+    for (uint32_t i : chunk.sort(opts))
+      emit(out, chunk.lines[i], prev, have_prev);
+    return status;
+  }
+  if (!chunk.lines.empty() && !spill())
+  {
+    for (int fd : runs)
+      close(fd);
+    return builtin_error(io, "sort", "cannot write temporary file in " + tmpdir + ": " + strerror(errno), 2);
+  }
+
+  // K-way merge of the runs; ties go to the earlier run to keep -u stable
+  std::vector<std::unique_ptr<RunReader>> readers;
+  std::vector<std::string_view> heads(runs.size());
+  for (int fd : runs)
+    readers.push_back(std::make_unique<RunReader>(fd));
+  auto greater = [&](size_t a, size_t b) {
+    int c = compare_lines(heads[a], heads[b], opts);
+    return c != 0 ? c > 0 : a > b;
+  };
+  std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(greater);
+  for (size_t r = 0; r < readers.size(); ++r)
+    if (readers[r]->next(heads[r]))
+      heap.push(r);
+  // prev must outlive its run's buffer, so keep a copy under -u
+  std::string prev_copy;
+  while (!heap.empty())
+  {
+    size_t r = heap.top();
+    heap.pop();
+    if (!opts.unique || !have_prev || compare_lines(prev, heads[r], opts) != 0)
+    {
+      out.put(heads[r]);
+      out.put('\n');
+      if (opts.unique)
+      {
+        prev_copy.assign(heads[r]);
+        prev = prev_copy;
+        have_prev = true;
+      }
+    }
+    if (readers[r]->next(heads[r]))
+      heap.push(r);
+  }
+  return status;
+}
@@ -0,0 +1,495 @@
+#include "builtins.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Builtin: cat [FILE...]
+int builtin_cat(std::vector<std::string> &args, Io &io)
+{
+  std::vector<std::string> files(args.begin() + 1, args.end());
+  // No options are implemented here; -n, -A and the rest go to cat itself
+  for (auto &file : files)
+    if (file.size() > 1 && file[0] == '-')
+      return unsupported_option(args, io, "invalid option -- '" + file.substr(1) + "'");
+  if (files.empty())
+    files.push_back("-");
+  int status = 0;
+  for (auto &file : files)
+  {
+    int fd = open_input(file, io);
+    if (fd < 0)
+    {
+      status = builtin_error(io, "cat", file + ": " + strerror(errno));
+      continue;
+    }
+    if (transfer_fd(fd, io.out) < 0)
+      status = builtin_error(io, "cat", file + ": " + strerror(errno));
+    close_input(fd, io);
+  }
+  return status;
+}
+
+// Helper: Move exactly len bytes out of a pipe into fd, splicing where the
+// kernel allows it and copying through buf otherwise. A negative fd just
+// discards the bytes. Returns false if writing to fd failed.
+static bool drain_pipe(int pipe_fd, int fd, size_t len, std::vector<char> &buf)
+{
+  bool ok = fd >= 0;
+  while (len > 0 && ok)
+  {
+    ssize_t n = splice(pipe_fd, nullptr, fd, nullptr, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    len -= n;
+  }
+  while (len > 0)
+  {
+    ssize_t n = read(pipe_fd, buf.data(), std::min(len, buf.size()));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    len -= n;
+    if (ok)
+    {
+      Io out{pipe_fd, fd, 2};
+      ok = out.write(buf.data(), n);
+    }
+  }
+  return ok;
+}
+
+// Helper: Copy io.in to every fd in outs. When the input is a pipe, tee(2)
+// duplicates its pages into one scratch pipe per extra output and each is
+// spliced to its destination, the input itself going to outs[0]. On a
+// write error fail(k) is called, and must set outs[k] to -1; the input is
+// still read to the end while any output is left.
+static void distribute(Io &io, std::vector<int> &outs, const std::function<void(size_t)> &fail)
+{
+  auto all_failed = [&]() { return std::all_of(outs.begin(), outs.end(), [](int fd) { return fd < 0; }); };
+  if (outs.size() == 1)
+  {
+    // A single output: a plain transfer, nothing to duplicate
+    if (transfer_fd(io.in, outs[0]) < 0)
+      fail(0);
+    return;
+  }
+  std::vector<char> buf(1 << 17);
+  struct stat sb;
+  bool zero_copy = fstat(io.in, &sb) == 0 && S_ISFIFO(sb.st_mode);
+  std::vector<int> scratch;
+  int chunk = 1 << 20;
+  for (size_t k = 1; zero_copy && k < outs.size(); ++k)
+  {
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) < 0)
+    {
+      zero_copy = false;
+      break;
+    }
+    fcntl(p[1], F_SETPIPE_SZ, chunk);
+    int size = fcntl(p[1], F_GETPIPE_SZ);
+    if (size > 0)
+      chunk = std::min(chunk, size);
+    scratch.push_back(p[0]);
+    scratch.push_back(p[1]);
+  }
+  // Equal capacities make every tee(2) of a chunk return the same length
+  for (size_t k = 1; k < scratch.size(); k += 2)
+    if (fcntl(scratch[k], F_SETPIPE_SZ, chunk) < 0)
+      zero_copy = false;
+
+  std::vector<ssize_t> pending(outs.size(), 0);
+  while (zero_copy)
+  {
+    bool aligned = true;
+    for (size_t k = 1; k < outs.size() && aligned; ++k)
+    {
+      ssize_t copied;
+      do
+        copied = tee(io.in, scratch[2 * (k - 1) + 1], chunk, 0);
+      while (copied < 0 && errno == EINTR);
+      pending[k] = copied;
+      aligned = copied >= 0 && copied == pending[1];
+    }
+    if (!aligned)
+    {
+      // Nothing has been consumed from the input yet: discard the partial
+      // duplicates and let the plain copy loop below take over
+      for (size_t k = 1; k < outs.size(); ++k)
+        if (pending[k] > 0)
+          drain_pipe(scratch[2 * (k - 1)], -1, pending[k], buf);
+      zero_copy = false;
+      break;
+    }
+    size_t n = pending[1];
+    if (n == 0)
+      break;
+    if (!drain_pipe(io.in, outs[0], n, buf) && outs[0] >= 0)
+      fail(0);
+    for (size_t k = 1; k < outs.size(); ++k)
+      if (!drain_pipe(scratch[2 * (k - 1)], outs[k], n, buf) && outs[k] >= 0)
+        fail(k);
+    if (all_failed())
+      break;
+  }
+  for (int fd : scratch)
+    close(fd);
+
+  if (!zero_copy)
+  {
+    while (!all_failed())
+    {
+      ssize_t n = io.read(buf.data(), buf.size());
+      if (n <= 0)
+        break;
+      for (size_t k = 0; k < outs.size(); ++k)
+      {
+        if (outs[k] < 0)
+          continue;
+        Io out{io.in, outs[k], io.err};
+        if (!out.write(buf.data(), n))
+          fail(k);
+      }
+    }
+  }
+}
+
+// Builtin: tee [-a] [FILE...]
+int builtin_tee(std::vector<std::string> &args, Io &io)
+{
+  bool append = false;
+  size_t i = 1;
+  for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; ++i)
+  {
+    if (args[i] == "-a" || args[i] == "--append")
+      append = true;
+    else
+      return unsupported_option(args, io, "invalid option -- '" + args[i].substr(1) + "'");
+  }
+  int status = 0;
+  std::vector<int> outs = {io.out};
+  std::vector<std::string> names = {"standard output"};
+  for (; i < args.size(); ++i)
+  {
+    int fd = open(args[i].c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+    if (fd < 0)
+    {
+      status = builtin_error(io, "tee", args[i] + ": " + strerror(errno));
+      continue;
+    }
+    outs.push_back(fd);
+    names.push_back(args[i]);
+  }
+
+  auto fail = [&](size_t k) {
+    // A reader of standard output that has gone stops tee altogether, as
+    // SIGPIPE would, rather than leaving it to copy on into the files
+    bool broken = k == 0 && errno == EPIPE;
+    status = builtin_error(io, "tee", names[k] + ": " + strerror(errno));
+    for (size_t j = 0; j < outs.size(); ++j)
+      if ((j == k || broken) && outs[j] >= 0)
+      {
+        if (j > 0)
+          close(outs[j]);
+        outs[j] = -1;
+      }
+  };
+  distribute(io, outs, fail);
+  for (size_t k = 1; k < outs.size(); ++k)
+    if (outs[k] >= 0)
+      close(outs[k]);
+  return status;
+}
+
+// Helper: Copy lines from every fd in ins to io.out as they arrive, each
+// line written whole, so lines from different sources never mix. A last
+// line without a newline is written when its source ends, terminated
+// unless no other source is left to follow it. Returns false, leaving the
+// rest unread, if writing failed.
+static bool merge_lines(const std::vector<int> &ins, Io &io)
+{
+  std::vector<pollfd> fds;
+  for (int fd : ins)
+    fds.push_back({fd, POLLIN, 0});
+  std::vector<std::string> partial(ins.size());
+  std::vector<char> buf(1 << 16);
+  size_t open_count = ins.size();
+  while (open_count > 0)
+  {
+    if (poll(fds.data(), fds.size(), -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    for (size_t k = 0; k < fds.size(); ++k)
+    {
+      if (fds[k].fd < 0 || fds[k].revents == 0)
+        continue;
+      ssize_t n = read(fds[k].fd, buf.data(), buf.size());
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+      {
+        if (!partial[k].empty() && open_count > 1)
+          partial[k] += '\n';
+        if (!partial[k].empty() && !io.write(partial[k]))
+          return false;
+        // poll skips negative fds
+        fds[k].fd = -1;
+        --open_count;
+        continue;
+      }
+      std::string_view chunk(buf.data(), n);
+      size_t end = chunk.rfind('\n') + 1;
+      if (end > 0)
+      {
+        bool ok;
+        if (partial[k].empty())
+          ok = io.write(chunk.data(), end);
+        else
+        {
+          partial[k].append(chunk.substr(0, end));
+          ok = io.write(partial[k]);
+          partial[k].clear();
+        }
+        if (!ok)
+          return false;
+      }
+      partial[k].append(chunk.substr(end));
+    }
+  }
+  return true;
+}
+
+// Helper: Create count pipes, read ends in reads and write ends in writes;
+// false, with none left open, if one could not be created
+static bool make_pipes(size_t count, std::vector<int> &reads, std::vector<int> &writes)
+{
+  for (size_t k = 0; k < count; ++k)
+  {
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) < 0)
+    {
+      for (int fd : reads)
+        close(fd);
+      for (int fd : writes)
+        close(fd);
+      reads.clear();
+      writes.clear();
+      return false;
+    }
+    reads.push_back(p[0]);
+    writes.push_back(p[1]);
+  }
+  return true;
+}
+
+// Helper: Wait for each child, returning the first failing status in
+// order, or 0
+static int wait_all(const std::vector<pid_t> &pids)
+{
+  int status = 0;
+  for (pid_t pid : pids)
+  {
+    int s = wait_status(pid);
+    if (status == 0)
+      status = s;
+  }
+  return status;
+}
+
+// Builtin: fanin COMMAND...
+// Runs every COMMAND at once, with stdin from /dev/null, and merges their
+// output into stdout a line at a time
+int builtin_fanin(std::vector<std::string> &args, Io &io)
+{
+  if (args.size() < 2)
+    return builtin_error(io, "fanin", "usage: fanin COMMAND...", 2);
+  size_t n = args.size() - 1;
+  std::vector<int> reads, writes;
+  if (!make_pipes(n, reads, writes))
+    return builtin_error(io, "fanin", std::string("pipe: ") + strerror(errno));
+  int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  std::vector<int> all = reads;
+  all.insert(all.end(), writes.begin(), writes.end());
+  all.push_back(null_fd);
+  std::vector<pid_t> pids;
+  for (size_t k = 0; k < n; ++k)
+  {
+    pid_t pid = spawn_script(args[k + 1], Io{null_fd, writes[k], io.err}, all);
+    if (pid < 0)
+      builtin_error(io, "fanin", std::string("fork: ") + strerror(errno));
+    else
+      pids.push_back(pid);
+  }
+  for (int fd : writes)
+    close(fd);
+  close(null_fd);
+  bool ok = merge_lines(reads, io);
+  // Closing early makes the commands fail their writes, as in a pipeline
+  for (int fd : reads)
+    close(fd);
+  int status = wait_all(pids);
+  if (pids.size() < n)
+    return 1;
+  return ok ? status : 1;
+}
+
+// Builtin: fanout COMMAND...
+// Copies stdin to every COMMAND, zero-copy when stdin is a pipe, and
+// merges their output into stdout a line at a time
+int builtin_fanout(std::vector<std::string> &args, Io &io)
+{
+  if (args.size() < 2)
+    return builtin_error(io, "fanout", "usage: fanout COMMAND...", 2);
+  size_t n = args.size() - 1;
+  std::vector<int> in_reads, in_writes, out_reads, out_writes;
+  if (!make_pipes(n, in_reads, in_writes))
+    return builtin_error(io, "fanout", std::string("pipe: ") + strerror(errno));
+  if (!make_pipes(n, out_reads, out_writes))
+  {
+    for (int fd : in_reads)
+      close(fd);
+    for (int fd : in_writes)
+      close(fd);
+    return builtin_error(io, "fanout", std::string("pipe: ") + strerror(errno));
+  }
+  std::vector<int> all;
+  for (auto *fds : {&in_reads, &in_writes, &out_reads, &out_writes})
+    all.insert(all.end(), fds->begin(), fds->end());
+  std::vector<pid_t> pids;
+  for (size_t k = 0; k < n; ++k)
+  {
+    pid_t pid = spawn_script(args[k + 1], Io{in_reads[k], out_writes[k], io.err}, all);
+    if (pid < 0)
+      builtin_error(io, "fanout", std::string("fork: ") + strerror(errno));
+    else
+      pids.push_back(pid);
+  }
+  // The commands' output is merged in a child of its own, so feeding them
+  // never waits on draining them
+  pid_t merger = fork();
+  if (merger == 0)
+  {
+    restore_child_signals();
+    for (auto *fds : {&in_reads, &in_writes, &out_writes})
+      for (int fd : *fds)
+        close(fd);
+    _exit(merge_lines(out_reads, io) ? 0 : 1);
+  }
+  for (auto *fds : {&in_reads, &out_reads, &out_writes})
+    for (int fd : *fds)
+      close(fd);
+  if (merger < 0)
+    builtin_error(io, "fanout", std::string("fork: ") + strerror(errno));
+
+  // A command that stops reading early just stops being fed
+  struct sigaction ignore = {}, saved;
+  ignore.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &ignore, &saved);
+  int status = 0;
+  distribute(io, in_writes, [&](size_t k) {
+    if (errno != EPIPE)
+      status = builtin_error(io, "fanout", args[k + 1] + ": " + strerror(errno));
+    close(in_writes[k]);
+    in_writes[k] = -1;
+  });
+  sigaction(SIGPIPE, &saved, nullptr);
+  for (int fd : in_writes)
+    if (fd >= 0)
+      close(fd);
+
+  int command_status = wait_all(pids);
+  int merge_status = merger > 0 ? wait_status(merger) : 1;
+  if (status == 0)
+    status = pids.size() < n ? 1 : command_status != 0 ? command_status : merge_status;
+  return status;
+}
+
+// Builtin: pv [-q] [-f] [FILE...]
+// Copies its input to stdout and reports progress and throughput on stderr
+int builtin_pv(std::vector<std::string> &args, Io &io)
+{
+  bool quiet = false, force = false;
+  std::vector<std::string> files;
+  for (size_t i = 1; i < args.size(); ++i)
+  {
+    if (args[i] == "-q")
+      quiet = true;
+    else if (args[i] == "-f")
+      force = true;
+    else if (args[i].size() > 1 && args[i][0] == '-')
+      return unsupported_option(args, io, "invalid option -- '" + args[i].substr(1) + "'");
+    else
+      files.push_back(args[i]);
+  }
+  if (files.empty())
+    files.push_back("-");
+  bool report = !quiet && (force || isatty(io.err));
+
+  // A known total size lets us show a percentage
+  off_t expected = 0;
+  for (auto &file : files)
+  {
+    struct stat sb;
+    int ok = file == "-" ? fstat(io.in, &sb) : stat(file.c_str(), &sb);
+    if (ok != 0 || !S_ISREG(sb.st_mode))
+    {
+      expected = 0;
+      break;
+    }
+    expected += sb.st_size;
+  }
+
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now(), last_report = start;
+  size_t total = 0;
+  auto show = [&](bool final) {
+    double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    char line[128];
+    std::string rate = format_size(elapsed > 0 ? total / elapsed : 0);
+    int len = snprintf(line, sizeof(line), "\r%8s %6.1fs [%7s/s]", format_size(total).c_str(), elapsed, rate.c_str());
+    if (expected > 0)
+      len += snprintf(line + len, sizeof(line) - len, " %3d%%", int(100.0 * total / expected));
+    Io err_io{io.in, io.err, io.err};
+    err_io.write(line, len);
+    if (final)
+      err_io.write("\n");
+  };
+  auto progress = [&](size_t n) {
+    total += n;
+    if (report && clock::now() - last_report >= std::chrono::seconds(1))
+    {
+      last_report = clock::now();
+      show(false);
+    }
+  };
+
+  int status = 0;
+  for (auto &file : files)
+  {
+    int fd = open_input(file, io);
+    if (fd < 0)
+    {
+      status = builtin_error(io, "pv", file + ": " + strerror(errno));
+      continue;
+    }
+    if (transfer_fd(fd, io.out, -1, progress) < 0)
+      status = builtin_error(io, "pv", file + ": " + strerror(errno));
+    close_input(fd, io);
+  }
+  if (report)
+    show(true);
+  return status;
+}
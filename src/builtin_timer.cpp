@@ -0,0 +1,236 @@
+#include "builtins.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Helper: Parse a duration like "1.5", "90s", "2m", "1h" or "inf" into
+// seconds; false if it is not one
+static bool parse_duration(const std::string &s, double &seconds)
+{
+  if (s.empty())
+    return false;
+  char *end;
+  seconds = strtod(s.c_str(), &end);
+  if (end == s.c_str() || std::isnan(seconds) || seconds < 0)
+    return false;
+  if (*end != '\0')
+  {
+    if (end[1] != '\0')
+      return false;
+    switch (*end)
+    {
+    case 's':
+      break;
+    case 'm':
+      seconds *= 60;
+      break;
+    case 'h':
+      seconds *= 60 * 60;
+      break;
+    case 'd':
+      seconds *= 24 * 60 * 60;
+      break;
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+// Helper: A one-shot timer spec for a positive duration. Anything under a
+// nanosecond still arms the timer, since an all-zero spec disarms it, and
+// "inf" is clamped to something the kernel accepts.
+static itimerspec duration_timer(double seconds)
+{
+  itimerspec spec{};
+  seconds = std::min(seconds, 1e15);
+  spec.it_value.tv_sec = (time_t)seconds;
+  spec.it_value.tv_nsec = (long)((seconds - spec.it_value.tv_sec) * 1e9);
+  if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+    spec.it_value.tv_nsec = 1;
+  return spec;
+}
+
+// Helper: Parse a signal given as a name ("TERM", "SIGTERM") or a number
+static int parse_signal(const std::string &s)
+{
+  if (!s.empty() && s.find_first_not_of("0123456789") == std::string::npos)
+  {
+    int sig = std::stoi(s.substr(0, 4));
+    return sig < NSIG ? sig : -1;
+  }
+  std::string name = s.compare(0, 3, "SIG") == 0 ? s.substr(3) : s;
+  for (int sig = 1; sig < NSIG; ++sig)
+  {
+    const char *abbrev = sigabbrev_np(sig);
+    if (abbrev && name == abbrev)
+      return sig;
+  }
+  return -1;
+}
+
+// Builtin: sleep DURATION...
+int builtin_sleep(std::vector<std::string> &args, Io &io)
+{
+  if (args.size() < 2)
+    return builtin_error(io, "sleep", "missing operand");
+  // Several operands add up, as with coreutils sleep
+  double total = 0;
+  for (size_t i = 1; i < args.size(); ++i)
+  {
+    double seconds;
+    if (!parse_duration(args[i], seconds))
+      return builtin_error(io, "sleep", "invalid time interval '" + args[i] + "'");
+    total += seconds;
+  }
+  if (total <= 0)
+    return 0;
+  int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (tfd < 0)
+    return builtin_error(io, "sleep", std::string("cannot create timer: ") + strerror(errno));
+  itimerspec spec = duration_timer(total);
+  timerfd_settime(tfd, 0, &spec, nullptr);
+  uint64_t expirations;
+  while (::read(tfd, &expirations, sizeof(expirations)) < 0 && errno == EINTR)
+    ;
+  close(tfd);
+  return 0;
+}
+
+// Builtin: timeout [-s SIGNAL] [-k DURATION] [--preserve-status] [--foreground] DURATION COMMAND [ARG...]
+int builtin_timeout(std::vector<std::string> &args, Io &io)
+{
+  int sig = SIGTERM;
+  double kill_after = 0;
+  bool preserve = false, foreground = false;
+  size_t i = 1;
+  for (; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (arg.size() < 2 || arg[0] != '-')
+      break;
+    if (arg == "--")
+    {
+      ++i;
+      break;
+    }
+    if (arg == "--preserve-status")
+    {
+      preserve = true;
+      continue;
+    }
+    if (arg == "--foreground")
+    {
+      foreground = true;
+      continue;
+    }
+    std::string value;
+    char opt;
+    if (arg.compare(0, 9, "--signal=") == 0)
+      opt = 's', value = arg.substr(9);
+    else if (arg.compare(0, 13, "--kill-after=") == 0)
+      opt = 'k', value = arg.substr(13);
+    else if (arg[1] == 's' || arg[1] == 'k')
+    {
+      opt = arg[1];
+      if (arg.size() > 2)
+        value = arg.substr(2);
+      else if (i + 1 < args.size())
+        value = args[++i];
+      else
+        return builtin_error(io, "timeout", std::string("option requires an argument -- '") + opt + "'", 125);
+    }
+    else if (arg[1] == '-')
+      return unsupported_option(args, io, "unrecognized option '" + arg + "'", 125);
+    else
+      return unsupported_option(args, io, std::string("invalid option -- '") + arg[1] + "'", 125);
+    if (opt == 's' && (sig = parse_signal(value)) < 0)
+      return builtin_error(io, "timeout", value + ": invalid signal", 125);
+    if (opt == 'k' && !parse_duration(value, kill_after))
+      return builtin_error(io, "timeout", "invalid time interval '" + value + "'", 125);
+  }
+  if (i + 1 >= args.size())
+    return builtin_error(io, "timeout", i < args.size() ? "missing operand after '" + args[i] + "'" : "missing operand", 125);
+  double duration;
+  if (!parse_duration(args[i], duration))
+    return builtin_error(io, "timeout", "invalid time interval '" + args[i] + "'", 125);
+  std::vector<std::string> command(args.begin() + i + 1, args.end());
+  CommandTarget target = resolve_command(command[0]);
+  if (!target.function && !target.builtin && target.path.empty())
+    return builtin_error(io, "timeout", "failed to run command '" + command[0] + "': No such file or directory", 127);
+
+  // This process waits on the timer and on the child's pidfd together;
+  // there is no separate watchdog process. A duration of 0 never fires.
+  // Without a timer the command is not run at all, rather than run unbounded.
+  int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (tfd < 0)
+    return builtin_error(io, "timeout", std::string("cannot create timer: ") + strerror(errno), 125);
+
+  // The child leads its own process group so the signal reaches everything
+  // it starts, unless --foreground keeps it on the terminal
+  pid_t pid = spawn_command(target, command, io, !foreground);
+  if (pid < 0)
+  {
+    close(tfd);
+    return builtin_error(io, "timeout", std::string("fork failed: ") + strerror(errno), 125);
+  }
+  int pidfd = syscall(SYS_pidfd_open, pid, 0);
+  if (duration > 0)
+  {
+    itimerspec spec = duration_timer(duration);
+    timerfd_settime(tfd, 0, &spec, nullptr);
+  }
+  bool timed_out = false, killed = false;
+  int ws = 0;
+  while (true)
+  {
+    // Without pidfds (kernels before 5.3) the child is polled for instead
+    pollfd fds[2] = {{tfd, POLLIN, 0}, {pidfd, POLLIN, 0}};
+    int ready = poll(fds, 2, pidfd >= 0 ? -1 : 10);
+    if (ready < 0 && errno != EINTR)
+      break;
+    if (pidfd < 0 || fds[1].revents)
+    {
+      pid_t done = waitpid(pid, &ws, pidfd >= 0 ? 0 : WNOHANG);
+      if (done == pid || (done < 0 && errno != EINTR))
+        break;
+    }
+    if (ready <= 0 || !(fds[0].revents & POLLIN))
+      continue;
+    uint64_t expirations;
+    if (::read(tfd, &expirations, sizeof(expirations)) < 0)
+      continue;
+    int send = timed_out ? SIGKILL : sig;
+    // -s KILL kills on the first expiry, and reports it the same way
+    killed = send == SIGKILL;
+    timed_out = true;
+    pid_t to = foreground ? pid : -pid;
+    kill(to, send);
+    // A stopped child would never see the signal
+    if (send != SIGKILL && send != SIGCONT)
+      kill(to, SIGCONT);
+    if (!killed && kill_after > 0)
+    {
+      itimerspec spec = duration_timer(kill_after);
+      timerfd_settime(tfd, 0, &spec, nullptr);
+    }
+  }
+  close(tfd);
+  if (pidfd >= 0)
+    close(pidfd);
+
+  int status = WIFSIGNALED(ws) ? 128 + WTERMSIG(ws) : WEXITSTATUS(ws);
+  if (killed)
+    return 128 + SIGKILL;
+  if (timed_out && !preserve)
+    return 124;
+  return status;
+}
@@ -0,0 +1,230 @@
+#include "builtins.hpp"
+#include "expand.hpp"
+#include "vars.hpp"
+
+// Helper: Quote a value the way declare -p prints it
+static void put_quoted(OutBuffer &out, std::string_view value)
+{
+  out.put('"');
+  for (char c : value)
+  {
+    if (c == '"' || c == '\\' || c == '$' || c == '`')
+      out.put('\\');
+    out.put(c);
+  }
+  out.put('"');
+}
+
+// Helper: Print a variable as the declare command that would recreate it
+static void print_declaration(OutBuffer &out, const std::string &name, const Variable &var)
+{
+  std::string flags;
+  if (var.kind == Variable::Indexed)
+    flags += 'a';
+  else if (var.kind == Variable::Assoc)
+    flags += 'A';
+  if (var.exported)
+    flags += 'x';
+  out.put("declare -");
+  out.put(flags.empty() ? "-" : flags);
+  out.put(' ');
+  out.put(name);
+  if (var.kind == Variable::Scalar)
+  {
+    out.put('=');
+    put_quoted(out, var.value);
+  }
+  else if (var.kind == Variable::Indexed)
+  {
+    out.put("=(");
+    bool first = true;
+    var.elements.for_each([&](size_t i, const ArrayElement &e) {
+      if (!first)
+        out.put(' ');
+      first = false;
+      out.put('[');
+      out.put(std::to_string(i));
+      out.put("]=");
+      put_quoted(out, element_text(e));
+    });
+    out.put(')');
+  }
+  else
+  {
+    out.put("=(");
+    var.assoc.for_each([&](std::string_view key, const std::string &value) {
+      out.put('[');
+      if (valid_name(key) || key.find_first_not_of("0123456789") == std::string_view::npos)
+        out.put(key);
+      else
+        put_quoted(out, key);
+      out.put("]=");
+      put_quoted(out, value);
+      out.put(' ');
+    });
+    out.put(')');
+  }
+  out.put('\n');
+}
+
+// Builtin: declare [-aAxp] [NAME[=VALUE]...]
+int builtin_declare(std::vector<std::string> &args, Io &io)
+{
+  const std::string &cmd = args[0];
+  bool print = false, exported = false;
+  Variable::Kind kind = Variable::Scalar;
+  size_t i = 1;
+  for (; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (arg.size() < 2 || arg[0] != '-')
+      break;
+    if (arg == "--")
+    {
+      ++i;
+      break;
+    }
+    for (size_t j = 1; j < arg.size(); ++j)
+    {
+      switch (arg[j])
+      {
+      case 'a':
+        kind = Variable::Indexed;
+        break;
+      case 'A':
+        kind = Variable::Assoc;
+        break;
+      case 'x':
+        exported = true;
+        break;
+      case 'p':
+        print = true;
+        break;
+      default:
+        return builtin_error(io, cmd, std::string("-") + arg[j] + ": invalid option", 2);
+      }
+    }
+  }
+
+  OutBuffer out(io);
+  if (i == args.size() && (print || (kind == Variable::Scalar && !exported)))
+  {
+    for (auto &name : var_names())
+    {
+      const Variable &var = *find_var(name);
+      if ((kind == Variable::Scalar || var.kind == kind) && (!exported || var.exported))
+        print_declaration(out, name, var);
+    }
+    return out.flush() ? 0 : 1;
+  }
+
+  int status = 0;
+  for (; i < args.size(); ++i)
+  {
+    Assignment a;
+    bool assigns = parse_assignment(args[i], a);
+    if (!assigns)
+      a.name = args[i];
+    if (!valid_name(a.name))
+    {
+      status = builtin_error(io, cmd, "'" + args[i] + "': not a valid identifier");
+      continue;
+    }
+    if (print)
+    {
+      if (Variable *var = find_var(a.name))
+        print_declaration(out, a.name, *var);
+      else
+        status = builtin_error(io, cmd, a.name + ": not found");
+      continue;
+    }
+    std::string err;
+    if (kind != Variable::Scalar)
+      err = declare_array(a.name, kind);
+    if (err.empty() && assigns)
+      err = apply_assignment(a);
+    else if (err.empty() && !find_var(a.name))
+      set_var(a.name, "");
+    if (!err.empty())
+    {
+      status = builtin_error(io, cmd, err);
+      continue;
+    }
+    if (exported)
+      export_var(a.name);
+  }
+  return out.flush() ? status : 1;
+}
+
+// Builtin: local [-aAx] [NAME[=VALUE]...]
+int builtin_local(std::vector<std::string> &args, Io &io)
+{
+  if (!in_scope())
+    return builtin_error(io, "local", "can only be used in a function");
+  size_t i = 1;
+  while (i < args.size() && args[i].size() > 1 && args[i][0] == '-')
+    ++i;
+  if (i == args.size())
+    return 0;
+  // Each name is saved for the function's return; declare does the rest
+  for (; i < args.size(); ++i)
+  {
+    Assignment a;
+    std::string name = parse_assignment(args[i], a) ? a.name : args[i];
+    if (valid_name(name))
+      make_local(name);
+  }
+  return builtin_declare(args, io);
+}
+
+// Builtin: unset [-v | -f] NAME[SUBSCRIPT]...
+int builtin_unset(std::vector<std::string> &args, Io &io)
+{
+  size_t i = 1;
+  bool functions = false;
+  if (i < args.size() && (args[i] == "-v" || args[i] == "-f" || args[i] == "--"))
+    functions = args[i++] == "-f";
+  int status = 0;
+  for (; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (functions)
+    {
+      unset_function(arg);
+      continue;
+    }
+    size_t open = arg.find('[');
+    std::string name = arg.substr(0, open);
+    if (!valid_name(name) || (open != std::string::npos && arg.back() != ']'))
+    {
+      status = builtin_error(io, "unset", "'" + arg + "': not a valid identifier");
+      continue;
+    }
+    if (open == std::string::npos)
+    {
+      unset_var(name);
+      continue;
+    }
+    // NAME[SUB] removes one element and leaves the rest of the array
+    std::string subscript = expand_text(std::string_view(arg).substr(open + 1, arg.size() - open - 2));
+    Variable *var = find_var(name);
+    if (!var)
+      continue;
+    if (var->kind == Variable::Assoc)
+    {
+      var->assoc.erase(subscript);
+      continue;
+    }
+    size_t index;
+    if (!parse_index(subscript, var->elements, index))
+    {
+      status = builtin_error(io, "unset", arg + ": bad array subscript");
+      continue;
+    }
+    if (var->kind == Variable::Indexed)
+      var->elements.erase(index);
+    else if (index == 0)
+      unset_var(name);
+  }
+  return status;
+}
@@ -0,0 +1,153 @@
+#include "builtins.hpp"
+#include "simd.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+
+struct WcCounts
+{
+  size_t lines = 0, words = 0, chars = 0, bytes = 0;
+};
+
+// Builtin: wc [-lwmc] [FILE...]
+int builtin_wc(std::vector<std::string> &args, Io &io)
+{
+  bool lines = false, words = false, chars = false, bytes = false;
+  std::vector<std::string> files;
+  for (size_t i = 1; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (arg == "--lines")
+      lines = true;
+    else if (arg == "--words")
+      words = true;
+    else if (arg == "--chars")
+      chars = true;
+    else if (arg == "--bytes")
+      bytes = true;
+    else if (arg.size() > 1 && arg[0] == '-')
+    {
+      for (size_t j = 1; j < arg.size(); ++j)
+      {
+        switch (arg[j])
+        {
+        case 'l':
+          lines = true;
+          break;
+        case 'w':
+          words = true;
+          break;
+        case 'm':
+          chars = true;
+          break;
+        case 'c':
+          bytes = true;
+          break;
+        default:
+          return unsupported_option(args, io, std::string("invalid option -- '") + arg[j] + "'");
+        }
+      }
+    }
+    else
+      files.push_back(arg);
+  }
+  if (!lines && !words && !chars && !bytes)
+    lines = words = bytes = true;
+  bool from_stdin = files.empty();
+  if (from_stdin)
+    files.push_back("-");
+
+  int status = 0;
+  std::vector<WcCounts> results(files.size());
+  std::vector<bool> opened(files.size(), false);
+  // Column width follows GNU wc: wide enough for the total size of the
+  // regular files, or 7 when any input size is unknown
+  size_t width_bytes = 0;
+  bool unknown_size = false;
+  for (size_t f = 0; f < files.size(); ++f)
+  {
+    int fd = open_input(files[f], io);
+    if (fd < 0)
+    {
+      status = builtin_error(io, "wc", files[f] + ": " + strerror(errno));
+      continue;
+    }
+    struct stat sb;
+    bool regular = fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode);
+    if (regular)
+      width_bytes += sb.st_size;
+    else
+      unknown_size = true;
+
+    WcCounts &c = results[f];
+    if (bytes && !lines && !words && !chars && regular && fd != io.in)
+      c.bytes = sb.st_size; // Byte count alone needs no scan
+    else
+    {
+      bool prev_space = true;
+      bool ok = read_blocks(fd, [&](const char *p, size_t len) {
+        c.bytes += len;
+        if (lines)
+          c.lines += count_byte(p, len, '\n');
+        if (words)
+          c.words += count_words(p, len, prev_space);
+        if (chars)
+          c.chars += count_utf8_chars(p, len);
+        return true;
+      });
+      if (!ok)
+        status = builtin_error(io, "wc", files[f] + ": " + strerror(errno));
+    }
+    opened[f] = true;
+    close_input(fd, io);
+  }
+
+  int selected = lines + words + chars + bytes;
+  int width = 1;
+  if (unknown_size)
+    width = 7;
+  for (size_t n = width_bytes; n >= 10; n /= 10)
+    ++width;
+  if (selected == 1 && files.size() == 1)
+    width = 1;
+
+  OutBuffer out(io);
+  auto print = [&](const WcCounts &c, const std::string &name) {
+    std::string line;
+    auto field = [&](size_t v) {
+      std::string num = std::to_string(v);
+      if (!line.empty())
+        line += ' ';
+      if (num.size() < size_t(width))
+        line.append(width - num.size(), ' ');
+      line += num;
+    };
+    if (lines)
+      field(c.lines);
+    if (words)
+      field(c.words);
+    if (chars)
+      field(c.chars);
+    if (bytes)
+      field(c.bytes);
+    if (!from_stdin)
+      line += " " + name;
+    out.put(line);
+    out.put('\n');
+  };
+  WcCounts total;
+  for (size_t f = 0; f < files.size(); ++f)
+  {
+    if (!opened[f])
+      continue;
+    print(results[f], files[f]);
+    total.lines += results[f].lines;
+    total.words += results[f].words;
+    total.chars += results[f].chars;
+    total.bytes += results[f].bytes;
+  }
+  if (files.size() > 1)
+    print(total, "total");
+  return status;
+}
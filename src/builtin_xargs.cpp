@@ -0,0 +1,361 @@
+#include "builtins.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// Splits input into items across block boundaries: on a single delimiter
+// byte (-0, -d), or on blanks and newlines with quotes and backslashes, as
+// xargs does by default
+class ItemSplitter
+{
+public:
+  explicit ItemSplitter(int delim) : delim(delim) {}
+
+  // Feeds a block, calling emit for every completed item. Returns false on
+  // an unterminated quote.
+  template <typename Emit> bool feed(const char *p, size_t len, Emit &&emit)
+  {
+    const char *end = p + len;
+    if (delim >= 0)
+    {
+      while (p < end)
+      {
+        const char *d = static_cast<const char *>(memchr(p, delim, end - p));
+        if (!d)
+        {
+          item.append(p, end);
+          return true;
+        }
+        item.append(p, d);
+        emit(item);
+        item.clear();
+        p = d + 1;
+      }
+      return true;
+    }
+    for (; p < end; ++p)
+    {
+      char c = *p;
+      if (escape)
+      {
+        item += c;
+        escape = false;
+        in_item = true;
+      }
+      else if (quote)
+      {
+        if (c == quote)
+          quote = 0;
+        else if (c == '\n')
+          return false;
+        else
+          item += c;
+      }
+      else if (c == ' ' || c == '\t' || c == '\n')
+      {
+        if (in_item)
+        {
+          emit(item);
+          item.clear();
+          in_item = false;
+        }
+      }
+      else if (c == '\'' || c == '"')
+      {
+        quote = c;
+        in_item = true;
+      }
+      else if (c == '\\')
+        escape = true;
+      else
+      {
+        item += c;
+        in_item = true;
+      }
+    }
+    return true;
+  }
+
+  // Emits the last item if the input did not end with a delimiter
+  template <typename Emit> bool finish(Emit &&emit)
+  {
+    if (quote)
+      return false;
+    if (delim >= 0 ? !item.empty() : in_item)
+      emit(item);
+    return true;
+  }
+
+  char open_quote() const { return quote; }
+
+private:
+  int delim;
+  std::string item;
+  bool in_item = false, escape = false;
+  char quote = 0;
+};
+
+// Helper: Bytes of argv and envp space the kernel counts for one string
+static size_t arg_cost(const std::string &s)
+{
+  return s.size() + 1 + sizeof(char *);
+}
+
+// Helper: Space left for arguments: ARG_MAX minus the environment, with
+// some headroom as POSIX recommends
+static size_t command_line_limit()
+{
+  long arg_max = sysconf(_SC_ARG_MAX);
+  size_t limit = arg_max > 0 ? arg_max : 131072;
+  size_t env = 0;
+  for (char **e = environ; *e; ++e)
+    env += strlen(*e) + 1 + sizeof(char *);
+  size_t reserve = env + 2048;
+  return limit > reserve + 4096 ? limit - reserve : 4096;
+}
+
+// Helper: Parse a positive count for -n, -P or -s
+static bool parse_count(const std::string &s, long &n)
+{
+  char *end;
+  errno = 0;
+  n = strtol(s.c_str(), &end, 10);
+  return !s.empty() && *end == '\0' && errno == 0 && n >= 0;
+}
+
+// Builtin: xargs [-0] [-d DELIM] [-n MAX-ARGS] [-P MAX-PROCS] [-s MAX-CHARS]
+//                [-r] [-t] [COMMAND [INITIAL-ARGS...]]
+int builtin_xargs(std::vector<std::string> &args, Io &io)
+{
+  int delim = -1;
+  long max_args = 0, max_procs = 1, max_chars = 0;
+  bool no_run_if_empty = false, trace = false;
+  size_t i = 1;
+  for (; i < args.size(); ++i)
+  {
+    const std::string &arg = args[i];
+    if (arg.size() < 2 || arg[0] != '-')
+      break;
+    if (arg == "--")
+    {
+      ++i;
+      break;
+    }
+    for (size_t j = 1; j < arg.size(); ++j)
+    {
+      char opt = arg[j];
+      switch (opt)
+      {
+      case '0':
+        delim = '\0';
+        break;
+      case 'r':
+        no_run_if_empty = true;
+        break;
+      case 't':
+        trace = true;
+        break;
+      case 'd':
+      case 'n':
+      case 'P':
+      case 's':
+      {
+        std::string value;
+        if (j + 1 < arg.size())
+          value = arg.substr(j + 1);
+        else if (i + 1 < args.size())
+          value = args[++i];
+        else
+          return builtin_error(io, "xargs", std::string("option requires an argument -- '") + opt + "'");
+        j = arg.size();
+        if (opt == 'd')
+        {
+          if (value == "\\n")
+            delim = '\n';
+          else if (value == "\\t")
+            delim = '\t';
+          else if (value == "\\0")
+            delim = '\0';
+          else if (value.size() == 1)
+            delim = (unsigned char)value[0];
+          else
+            return builtin_error(io, "xargs", "invalid input delimiter specification " + value);
+          break;
+        }
+        long n;
+        if (!parse_count(value, n) || (n == 0 && opt != 'P'))
+          return builtin_error(io, "xargs", std::string("invalid number \"") + value + "\" for -" + opt + " option");
+        (opt == 'n' ? max_args : opt == 'P' ? max_procs : max_chars) = n;
+        break;
+      }
+      default:
+        return unsupported_option(args, io, std::string("invalid option -- '") + opt + "'");
+      }
+    }
+  }
+
+  std::vector<std::string> command(args.begin() + i, args.end());
+  if (command.empty())
+    command.push_back("echo");
+  // Resolved once here; every batch reuses it instead of searching PATH
+  CommandTarget target = resolve_command(command[0]);
+  if (!target.function && !target.builtin && (target.path.empty() || access(target.path.c_str(), X_OK) != 0))
+    return builtin_error(io, "xargs", command[0] + ": No such file or directory", 127);
+  if (max_procs == 0)
+    max_procs = 1024;
+
+  size_t limit = command_line_limit();
+  if (max_chars > 0)
+    limit = std::min(limit, (size_t)max_chars);
+  size_t base_cost = 0;
+  for (auto &c : command)
+    base_cost += arg_cost(c);
+  if (base_cost >= limit)
+    return builtin_error(io, "xargs", "argument list too long");
+
+  // Commands read /dev/null rather than competing with us for our input
+  Io child_io = io;
+  child_io.in = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (child_io.in < 0)
+    return builtin_error(io, "xargs", std::string("/dev/null: ") + strerror(errno));
+
+  int status = 0;
+  bool stop = false, ran = false;
+  std::vector<pid_t> running;
+  // A pidfd per running child, or -1 without pidfds (kernels before 5.3).
+  // Only these children are waited for: the shell's own, such as <(...)
+  // substitutions, are left for it to reap.
+  std::vector<int> pidfds;
+  // Reaps one child, folding its result into status the way xargs reports it
+  auto reap_one = [&]() {
+    int ws = 0;
+    size_t done = running.size();
+    while (done == running.size())
+    {
+      // A lone child is simply waited for; several are polled for together
+      bool block = running.size() == 1;
+      std::vector<pollfd> fds;
+      bool all_pidfds = true;
+      for (int fd : pidfds)
+      {
+        fds.push_back({fd, POLLIN, 0});
+        all_pidfds = all_pidfds && fd >= 0;
+      }
+      if (!block && poll(fds.data(), fds.size(), all_pidfds ? -1 : 10) < 0 && errno != EINTR)
+        block = true;
+      for (size_t k = 0; k < running.size() && done == running.size(); ++k)
+      {
+        if (!block && pidfds[k] >= 0 && !fds[k].revents)
+          continue;
+        pid_t pid = waitpid(running[k], &ws, block || pidfds[k] >= 0 ? 0 : WNOHANG);
+        if (pid == running[k] || (pid < 0 && errno != EINTR))
+          done = k;
+        if (block)
+          break;
+      }
+    }
+    running.erase(running.begin() + done);
+    if (pidfds[done] >= 0)
+      close(pidfds[done]);
+    pidfds.erase(pidfds.begin() + done);
+    if (WIFSIGNALED(ws))
+    {
+      builtin_error(io, "xargs", command[0] + ": terminated by signal " + std::to_string(WTERMSIG(ws)));
+      status = 125;
+      stop = true;
+    }
+    else if (WEXITSTATUS(ws) == 255)
+    {
+      builtin_error(io, "xargs", command[0] + ": exited with status 255; aborting");
+      status = 124;
+      stop = true;
+    }
+    else if (WEXITSTATUS(ws) != 0 && status == 0)
+      status = 123;
+  };
+
+  std::vector<std::string> batch = command;
+  size_t batch_cost = base_cost;
+  auto run_batch = [&]() {
+    ran = true;
+    while (!stop && (long)running.size() >= max_procs)
+      reap_one();
+    if (stop)
+      return;
+    if (trace)
+    {
+      std::string line;
+      for (size_t k = 0; k < batch.size(); ++k)
+        line += (k ? " " : "") + batch[k];
+      Io{io.in, io.err, io.err}.write(line + "\n");
+    }
+    pid_t pid = spawn_command(target, batch, child_io);
+    if (pid < 0)
+    {
+      builtin_error(io, "xargs", std::string("fork: ") + strerror(errno), 126);
+      status = 126;
+      stop = true;
+    }
+    else
+    {
+      running.push_back(pid);
+      pidfds.push_back(syscall(SYS_pidfd_open, pid, 0));
+    }
+    batch.resize(command.size());
+    batch_cost = base_cost;
+  };
+
+  bool too_long = false;
+  auto emit = [&](const std::string &item) {
+    if (stop)
+      return;
+    size_t cost = arg_cost(item);
+    if (base_cost + cost > limit)
+    {
+      too_long = stop = true;
+      return;
+    }
+    if (batch.size() > command.size() &&
+        (batch_cost + cost > limit || (max_args && (long)(batch.size() - command.size()) >= max_args)))
+      run_batch();
+    if (stop)
+      return;
+    batch.push_back(item);
+    batch_cost += cost;
+  };
+
+  ItemSplitter splitter(delim);
+  bool quote_ok = true;
+  bool read_ok = read_blocks(io.in, [&](const char *p, size_t len) {
+    quote_ok = splitter.feed(p, len, emit);
+    return quote_ok && !stop;
+  });
+  if (quote_ok && read_ok && !stop)
+    quote_ok = splitter.finish(emit);
+
+  if (!stop && (batch.size() > command.size() || (!ran && !no_run_if_empty)))
+    run_batch();
+  while (!running.empty())
+    reap_one();
+  close(child_io.in);
+
+  if (too_long)
+    return builtin_error(io, "xargs", "argument line too long");
+  if (!quote_ok)
+  {
+    std::string which = splitter.open_quote() == '"' ? "double" : "single";
+    return builtin_error(io, "xargs", "unmatched " + which +
+                                          " quote; by default quotes are special to xargs unless you use the -0 option");
+  }
+  if (!read_ok)
+    return builtin_error(io, "xargs", std::string("read error: ") + strerror(errno));
+  return status;
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+// File descriptors a builtin reads from and writes to. In a pipeline stage
+// these are the pipe ends the pipeline loop set up; for a standalone command
+// they are the shell's own stdio or the redirection targets.
+struct Io
+{
+  int in = 0, out = 1, err = 2;
+
+  ssize_t read(void *buf, size_t len);
+  bool write(const void *buf, size_t len);
+  bool write(std::string_view s) { return write(s.data(), s.size()); }
+};
+
+// Helper: Print "name: message" to the builtin's stderr and return status
+int builtin_error(Io &io, const std::string &name, const std::string &message, int status = 1);
+
+// Helper: Open a file operand for reading; "-" means the builtin's stdin.
+// Returns -1 with errno set on failure.
+int open_input(const std::string &path, Io &io);
+
+// Helper: Close an fd returned by open_input (leaves io.in open)
+void close_input(int fd, Io &io);
+
+// Large output buffer so builtins issue few write(2) calls
+class OutBuffer
+{
+public:
+  explicit OutBuffer(Io &io, size_t capacity = 1 << 16);
+  ~OutBuffer();
+  OutBuffer(const OutBuffer &) = delete;
+  OutBuffer &operator=(const OutBuffer &) = delete;
+
+  void put(std::string_view s);
+  void put(char c)
+  {
+    if (len == buf.size())
+      flush();
+    buf[len++] = c;
+  }
+  bool flush();
+  bool ok() const { return !failed; }
+
+private:
+  Io &io;
+  std::vector<char> buf;
+  size_t len = 0;
+  bool failed = false;
+};
+
+// Read-only mmap of the rest of a regular file, from its current offset
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // Maps fd if it is a regular file with bytes past its offset; false
+  // otherwise. The offset itself is left alone: a caller that uses the
+  // bytes moves it past them.
+  bool map(int fd);
+  const char *data() const { return addr + skip; }
+  size_t size() const { return len - skip; }
+  // Tells the kernel the mapping will be read front to back
+  void advise_sequential() const;
+
+private:
+  char *addr = nullptr;
+  size_t len = 0;
+  // mmap starts on a page boundary; the bytes before the offset are skipped
+  size_t skip = 0;
+};
+
+// Helper: Feed an fd's contents from its offset on to fn in large blocks:
+// one mmap'd block for regular files, 1 MiB reads for pipes and other fds.
+// Stops early when fn returns false. Returns false on a read error.
+bool read_blocks(int fd, const std::function<bool(const char *, size_t)> &fn);
+
+// Helper: Like read_blocks, but every block ends on a line boundary; only
+// the last block may lack a trailing newline.
+bool read_line_blocks(int fd, const std::function<bool(const char *, size_t)> &fn);
+
+// Helper: Whether a read of fd would return at once, with data or end of
+// input. Buffered output is flushed before input that would block, so it
+// keeps up with input that trickles in (tail -f).
+bool input_ready(int fd);
+
+// Helper: Read one record ending in delim from fd into out, without the
+// delimiter, stopping early after max bytes. Input past the record is left
+// for whoever reads fd next: regular files are read ahead and seeked back,
+// pipes and sockets are peeked first, other fds are read a byte at a time.
+// fds marked with set_input_owned are instead read in whole blocks, the
+// surplus kept for the next call. timeout_ms < 0 waits forever. Returns 1
+// for a complete record, 0 at end of input, -1 on error, -2 on timeout.
+int read_record(int fd, char delim, size_t max, int timeout_ms, std::string &out);
+
+// Helper: Mark fd as read by this process alone, so read_record may buffer
+// ahead on it; unmarking drops anything buffered
+void set_input_owned(int fd, bool owned);
+
+// Helper: Move bytes from one fd to another, preferring copy_file_range,
+// sendfile and splice over a userspace copy. Stops after limit bytes when
+// limit >= 0. on_progress, if set, is called with each chunk's size.
+// Returns bytes moved, or -1 on error (errno set).
+ssize_t transfer_fd(int in, int out, off_t limit = -1,
+                    const std::function<void(size_t)> &on_progress = nullptr);
+
+// Helper: Format a byte count as a short human-readable size (e.g. "1.5M")
+std::string format_size(double bytes);
+
+// Builtin entry point: args[0] is the command name, returns the exit status
+using BuiltinFn = int (*)(std::vector<std::string> &args, Io &io);
+
+struct Builtin
+{
+  const char *name;
+  BuiltinFn fn;
+};
+
+struct ShellFunction;
+
+// A command resolved once, so it can be spawned many times without another
+// PATH search: a function, a builtin, or the executable's path ("" if not
+// found)
+struct CommandTarget
+{
+  std::shared_ptr<ShellFunction> function;
+  const Builtin *builtin = nullptr;
+  std::string path;
+};
+
+// Helper: Resolve a command name to a function, a builtin or an executable
+// path
+CommandTarget resolve_command(const std::string &name);
+
+// Helper: Remove a shell function; false if there was none
+bool unset_function(const std::string &name);
+
+// Helper: Fork a child running a resolved command with args on io. A builtin
+// runs in the child without an exec. With new_group the child leads its own
+// process group. Returns the pid, or -1 if fork failed.
+pid_t spawn_command(const CommandTarget &target, std::vector<std::string> &args, const Io &io,
+                    bool new_group = false);
+
+// Helper: Fork a child running text as shell commands on io, closing
+// close_fds in the child once io is installed. Returns the pid, or -1 if
+// fork failed.
+pid_t spawn_script(std::string_view text, const Io &io, const std::vector<int> &close_fds = {});
+
+// Helper: Wait for a child and turn its wait status into an exit status
+int wait_status(pid_t pid);
+
+// Helper: In a forked child, put back the signal dispositions the shell
+// changed for itself (SIGPIPE), as a separate process would have them
+void restore_child_signals();
+
+// Helper: For a builtin given an option it does not implement, called
+// before it has done any I/O: run the PATH executable of the same name
+// with args on io instead and return its status. Without one, report
+// message as builtin_error does and return status.
+int unsupported_option(std::vector<std::string> &args, Io &io, const std::string &message, int status = 1);
+
+// Streaming builtins (builtin_stream.cpp)
+int builtin_cat(std::vector<std::string> &args, Io &io);
+int builtin_tee(std::vector<std::string> &args, Io &io);
+int builtin_pv(std::vector<std::string> &args, Io &io);
+int builtin_fanout(std::vector<std::string> &args, Io &io);
+int builtin_fanin(std::vector<std::string> &args, Io &io);
+
+// Text builtins
+int builtin_wc(std::vector<std::string> &args, Io &io);
+int builtin_grep(std::vector<std::string> &args, Io &io);
+int builtin_sort(std::vector<std::string> &args, Io &io);
+int builtin_head(std::vector<std::string> &args, Io &io);
+int builtin_tail(std::vector<std::string> &args, Io &io);
+int builtin_cut(std::vector<std::string> &args, Io &io);
+
+// Filesystem builtins
+int builtin_find(std::vector<std::string> &args, Io &io);
+int builtin_cp(std::vector<std::string> &args, Io &io);
+int builtin_mv(std::vector<std::string> &args, Io &io);
+int builtin_ls(std::vector<std::string> &args, Io &io);
+int builtin_du(std::vector<std::string> &args, Io &io);
+
+// Shell builtins
+int builtin_read(std::vector<std::string> &args, Io &io);
+int builtin_mapfile(std::vector<std::string> &args, Io &io);
+int builtin_declare(std::vector<std::string> &args, Io &io);
+int builtin_unset(std::vector<std::string> &args, Io &io);
+int builtin_local(std::vector<std::string> &args, Io &io);
+int builtin_alias(std::vector<std::string> &args, Io &io);
+int builtin_unalias(std::vector<std::string> &args, Io &io);
+
+// Generator builtins (builtin_generate.cpp)
+int builtin_seq(std::vector<std::string> &args, Io &io);
+int builtin_yes(std::vector<std::string> &args, Io &io);
+
+// Process builtins
+int builtin_xargs(std::vector<std::string> &args, Io &io);
+int builtin_sleep(std::vector<std::string> &args, Io &io);
+int builtin_timeout(std::vector<std::string> &args, Io &io);
@@ -0,0 +1,759 @@
+#include "expand.hpp"
+#include "glob.hpp"
+#include "vars.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+bool expansion_failed = false;
+bool interactive = false;
+
+size_t find_closing(std::string_view s, size_t open)
+{
+  char opening = s[open];
+  char closing = opening == '{' ? '}' : opening == '[' ? ']' : ')';
+  int depth = 0;
+  char quote = 0;
+  for (size_t i = open; i < s.size(); ++i)
+  {
+    char c = s[i];
+    if (quote)
+    {
+      if (c == quote)
+        quote = 0;
+      else if (c == '\\' && quote == '"')
+        ++i;
+    }
+    else if (c == '\\')
+      ++i;
+    else if (c == '\'' || c == '"')
+      quote = c;
+    else if (c == opening)
+      ++depth;
+    else if (c == closing && --depth == 0)
+      return i;
+  }
+  return std::string_view::npos;
+}
+
+// Helper: Length of a value in characters (UTF-8 lead bytes)
+static size_t char_length(std::string_view s)
+{
+  size_t n = 0;
+  for (char c : s)
+    n += (c & 0xC0) != 0x80;
+  return n;
+}
+
+// Helper: Byte offset of the character chars characters into s
+static size_t byte_offset(std::string_view s, size_t chars)
+{
+  size_t i = 0;
+  for (; i < s.size() && chars > 0; --chars)
+    do
+      ++i;
+    while (i < s.size() && (s[i] & 0xC0) == 0x80);
+  return i;
+}
+
+// Helper: Index of the first c in s that is not quoted, escaped or inside
+// a nested ${...}; npos if there is none
+static size_t find_unquoted(std::string_view s, char c)
+{
+  char quote = 0;
+  for (size_t i = 0; i < s.size(); ++i)
+  {
+    if (quote)
+    {
+      if (s[i] == quote)
+        quote = 0;
+      else if (s[i] == '\\' && quote == '"')
+        ++i;
+    }
+    else if (s[i] == '\\')
+      ++i;
+    else if (s[i] == '\'' || s[i] == '"')
+      quote = s[i];
+    else if (s[i] == '$' && i + 1 < s.size() && s[i + 1] == '{')
+    {
+      size_t end = find_closing(s, i + 1);
+      if (end == std::string_view::npos)
+        return std::string_view::npos;
+      i = end;
+    }
+    else if (s[i] == c)
+      return i;
+  }
+  return std::string_view::npos;
+}
+
+// Helper: Index of the last character of the $ expansion at s[i], setting
+// body to its name or brace contents; body is empty if there is none
+static size_t parameter_end(std::string_view s, size_t i, std::string_view &body)
+{
+  body = {};
+  if (s[i + 1] == '{')
+  {
+    size_t end = find_closing(s, i + 1);
+    if (end != std::string_view::npos)
+      body = s.substr(i + 2, end - i - 2);
+    return end;
+  }
+  size_t end = i + 1;
+  if ((s[end] && strchr("?$#@*", s[end])) || isdigit((unsigned char)s[end]))
+    ++end;
+  else
+    while (end < s.size() && (isalnum((unsigned char)s[end]) || s[end] == '_'))
+      ++end;
+  body = s.substr(i + 1, end - i - 1);
+  return end - 1;
+}
+
+// Helper: Expand the pattern word of ${v#pat} and friends. Text that was
+// quoted, in the word or in a quoted expansion, matches literally, so its
+// glob characters come out escaped.
+static std::string expand_pattern(std::string_view s)
+{
+  std::string out;
+  auto literal = [&](std::string_view text) {
+    for (char c : text)
+    {
+      if (strchr("*?[]\\", c))
+        out += '\\';
+      out += c;
+    }
+  };
+  for (size_t i = 0; i < s.size(); ++i)
+  {
+    char c = s[i];
+    if (c == '\\' && i + 1 < s.size())
+    {
+      out += c;
+      out += s[++i];
+    }
+    else if (c == '\'' || c == '"')
+    {
+      size_t close = i + 1;
+      while (close < s.size() && s[close] != c)
+        close += c == '"' && s[close] == '\\' ? 2 : 1;
+      close = std::min(close, s.size() - 1);
+      literal(expand_text(s.substr(i, close - i + 1)));
+      i = close;
+    }
+    else if (c == '$' && i + 1 < s.size())
+    {
+      std::string_view body;
+      size_t end = parameter_end(s, i, body);
+      if (body.empty())
+      {
+        out += c;
+        continue;
+      }
+      out += expand_text(s.substr(i, end - i + 1));
+      i = end;
+    }
+    else
+      out += c;
+  }
+  return out;
+}
+
+// Helper: Parse a substring offset or length: a number, possibly negative
+// or parenthesized, or a variable name holding one
+static bool parse_offset(std::string_view text, long long &n)
+{
+  std::string s = expand_text(text);
+  size_t first = s.find_first_not_of(" \t"), last = s.find_last_not_of(" \t");
+  // An empty offset or length is 0, as in ${v::2}
+  if (first == std::string::npos)
+  {
+    n = 0;
+    return true;
+  }
+  s = s.substr(first, last - first + 1);
+  if (s.size() > 2 && s.front() == '(' && s.back() == ')')
+    s = s.substr(1, s.size() - 2);
+  if (valid_name(s))
+    s = std::string(get_var(s).value_or("0"));
+  char *end;
+  n = strtoll(s.c_str(), &end, 10);
+  return !s.empty() && *end == '\0';
+}
+
+// Helper: Change the case of the characters of value matching glob: all
+// of them, or with only_first just a leading one
+static std::string change_case(std::string_view value, const GlobPattern &glob, bool upper, bool only_first)
+{
+  std::string out(value);
+  for (size_t i = 0; i < out.size();)
+  {
+    size_t len = byte_offset(std::string_view(out).substr(i), 1);
+    if (len == 1 && glob.match(std::string_view(out).substr(i, 1)))
+      out[i] = upper ? toupper((unsigned char)out[i]) : tolower((unsigned char)out[i]);
+    if (only_first)
+      break;
+    i += len;
+  }
+  return out;
+}
+
+// Helper: Replace the matches of glob in value: the first, every one
+// (global), or only one anchored at the start or end
+static std::string replace_matches(std::string_view value, const GlobPattern &glob, std::string_view replacement,
+                                   char mode)
+{
+  std::string out;
+  if (mode == '#' || mode == '%')
+  {
+    size_t n = mode == '#' ? glob.match_prefix(value, true) : glob.match_suffix(value, true);
+    if (n == std::string::npos)
+      return std::string(value);
+    if (mode == '#')
+      return std::string(replacement).append(value.substr(n));
+    return std::string(value.substr(0, n)).append(replacement);
+  }
+  size_t pos = 0, start, len;
+  while (pos <= value.size() && glob.search(value, pos, start, len))
+  {
+    out.append(value.substr(pos, start - pos)).append(replacement);
+    pos = start + len;
+    if (mode != '/')
+      break;
+    // An empty match still moves on a character
+    if (len == 0)
+    {
+      if (pos == value.size())
+        return out;
+      size_t step = byte_offset(value.substr(pos), 1);
+      out.append(value.substr(pos, step));
+      pos += step;
+    }
+  }
+  if (pos < value.size())
+    out.append(value.substr(pos));
+  return out;
+}
+
+// Helper: Expand the parameter named by body, the text of ${...} or of a
+// bare $name: NAME, NAME[SUB], NAME[@] or NAME[*], optionally prefixed by
+// # (length or element count) or ! (indices or keys, or indirection), or
+// followed by an operator: :- = + ? (with or without the colon), # ## % %%
+// (remove a matching prefix or suffix), / // /# /% (replace), :OFF:LEN
+// (substring or element slice) and ^ ^^ , ,, (case). An expansion with [@]
+// sets all and yields one value per element. Returns false if body is not
+// a parameter expansion this shell understands.
+static bool expand_parameter(std::string_view body, std::vector<std::string> &values, bool &all)
+{
+  values.clear();
+  all = false;
+  char prefix = 0;
+  if (body.size() > 1 && (body[0] == '#' || body[0] == '!'))
+  {
+    prefix = body[0];
+    body.remove_prefix(1);
+  }
+  size_t name_end = 0;
+  if (!body.empty() && body[0] && strchr("?$#@*", body[0]))
+    name_end = 1;
+  else if (!body.empty() && isdigit((unsigned char)body[0]))
+    while (name_end < body.size() && isdigit((unsigned char)body[name_end]))
+      ++name_end;
+  else
+    while (name_end < body.size() && (isalnum((unsigned char)body[name_end]) || body[name_end] == '_'))
+      ++name_end;
+  std::string name(body.substr(0, name_end));
+  std::string_view rest = body.substr(name_end);
+  std::string subscript;
+  bool has_subscript = false;
+  if (!rest.empty() && rest[0] == '[')
+  {
+    size_t close = find_closing(rest, 0);
+    if (close == std::string_view::npos)
+      return false;
+    subscript = rest.substr(1, close - 1);
+    has_subscript = true;
+    rest.remove_prefix(close + 1);
+  }
+  // Whatever follows the name is the operator and its word
+  std::string_view op = rest;
+  if (prefix && !op.empty())
+    return false;
+
+  // Special parameters: $? $$ $# $0 $1 ..., and $@ $* as a whole
+  std::optional<std::string> special;
+  bool is_special = !name.empty() && !valid_name(name);
+  bool positional = name == "@" || name == "*";
+  if (is_special && (has_subscript || prefix == '!'))
+    return false;
+  if (positional)
+  {
+    has_subscript = true;
+    subscript = name;
+  }
+  else if (name == "?" || name == "$")
+    special = std::to_string(name == "?" ? last_status : getpid());
+  else if (name == "#")
+    special = std::to_string(positional_params.size());
+  else if (name == "0")
+    special = shell_name;
+  else if (is_special)
+  {
+    size_t n = std::stoul(name);
+    if (n <= positional_params.size())
+      special = positional_params[n - 1];
+  }
+  else if (!valid_name(name))
+    return false;
+  bool every = has_subscript && (subscript == "@" || subscript == "*");
+  if (has_subscript && !every)
+    subscript = expand_text(subscript);
+
+  // ${!NAME}: the variable NAME's value names the one to expand
+  if (prefix == '!' && !every)
+  {
+    auto target = get_var(name);
+    if (!target)
+      return true;
+    std::string ref(*target);
+    if (has_subscript)
+      ref += "[" + subscript + "]";
+    return expand_parameter(ref, values, all);
+  }
+
+  // The values expanded, as views into the variable: every element for
+  // [@] and [*] (with its index, for slicing), otherwise at most one
+  Variable *var = is_special ? nullptr : find_var(name);
+  std::vector<std::string_view> items;
+  std::vector<size_t> indices;
+  if (positional)
+    for (size_t i = 0; i < positional_params.size(); ++i)
+    {
+      items.push_back(positional_params[i]);
+      indices.push_back(i + 1);
+    }
+  else if (is_special)
+  {
+    if (special)
+      items.push_back(*special);
+  }
+  else if (every)
+  {
+    if (!var)
+      ;
+    else if (var->kind == Variable::Scalar)
+      items.push_back(var->value), indices.push_back(0);
+    else if (var->kind == Variable::Indexed)
+      var->elements.for_each([&](size_t i, const ArrayElement &e) {
+        items.push_back(element_text(e));
+        indices.push_back(i);
+      });
+    else
+      var->assoc.for_each([&](std::string_view key, const std::string &value) {
+        items.push_back(prefix == '!' ? key : std::string_view(value));
+        indices.push_back(items.size() - 1);
+      });
+    if (prefix == '!' && var && var->kind != Variable::Assoc)
+    {
+      for (size_t i : indices)
+        values.push_back(std::to_string(i));
+      all = subscript == "@";
+      return true;
+    }
+  }
+  else if (!var)
+    ;
+  else if (var->kind == Variable::Assoc)
+  {
+    if (const std::string *value = var->assoc.get(has_subscript ? subscript : "0"))
+      items.push_back(*value);
+  }
+  else
+  {
+    size_t index = 0;
+    if (has_subscript && !parse_index(subscript, var->elements, index))
+      return true;
+    if (var->kind == Variable::Scalar)
+    {
+      if (index == 0)
+        items.push_back(var->value);
+    }
+    else if (const ArrayElement *e = var->elements.get(index))
+      items.push_back(element_text(*e));
+  }
+  if (prefix == '#')
+  {
+    values = {std::to_string(every ? items.size() : items.empty() ? 0 : char_length(items[0]))};
+    return true;
+  }
+
+  // Operators that produce new text fill results; the rest narrow items
+  std::vector<std::string> results;
+  bool transformed = false;
+  if (!op.empty())
+  {
+    bool colon = op[0] == ':' && op.size() > 1 && strchr("-=+?", op[1]);
+    if (colon)
+      op.remove_prefix(1);
+    char c = op[0];
+    std::string_view word = op.substr(1);
+    if (strchr("-=+?", c))
+    {
+      bool missing = items.empty() || (colon && items.size() == 1 && items[0].empty());
+      if (c == '+')
+      {
+        if (missing)
+          return true;
+        values = {expand_text(word)};
+        return true;
+      }
+      if (!missing)
+        ;
+      else if (c == '-')
+      {
+        values = {expand_text(word)};
+        return true;
+      }
+      else if (c == '=')
+      {
+        if (is_special || every)
+          return false;
+        Assignment a;
+        a.name = name;
+        a.subscript = subscript;
+        a.has_subscript = has_subscript;
+        a.value = expand_text(word);
+        std::string err = apply_assignment(a);
+        if (!err.empty())
+        {
+          std::cerr << err << std::endl;
+          expansion_failed = true;
+          return true;
+        }
+        values = {a.value};
+        return true;
+      }
+      else
+      {
+        std::string message = word.empty() ? "parameter null or not set" : expand_text(word);
+        std::cerr << name << ": " << message << std::endl;
+        if (!interactive)
+          exit(1);
+        expansion_failed = true;
+        return true;
+      }
+    }
+    else if (c == '#' || c == '%')
+    {
+      bool longest = !word.empty() && word[0] == c;
+      if (longest)
+        word.remove_prefix(1);
+      const GlobPattern &glob = cached_glob(expand_pattern(word));
+      for (auto &item : items)
+      {
+        size_t n = c == '#' ? glob.match_prefix(item, longest) : glob.match_suffix(item, longest);
+        if (n != std::string::npos)
+          item = c == '#' ? item.substr(n) : item.substr(0, n);
+      }
+    }
+    else if (c == '/')
+    {
+      char mode = 0;
+      if (!word.empty() && strchr("/#%", word[0]))
+      {
+        mode = word[0];
+        word.remove_prefix(1);
+      }
+      size_t slash = find_unquoted(word, '/');
+      std::string pattern = expand_pattern(word.substr(0, slash));
+      std::string replacement = slash == std::string_view::npos ? "" : expand_text(word.substr(slash + 1));
+      transformed = true;
+      for (auto item : items)
+      {
+        // An empty pattern matches only at an anchor: /# prepends, /% appends
+        if (!pattern.empty())
+          results.push_back(replace_matches(item, cached_glob(pattern), replacement, mode));
+        else if (mode == '#')
+          results.push_back(replacement + std::string(item));
+        else if (mode == '%')
+          results.push_back(std::string(item) + replacement);
+        else
+          results.push_back(std::string(item));
+      }
+    }
+    else if (c == '^' || c == ',')
+    {
+      bool only_first = word.empty() || word[0] != c;
+      if (!only_first)
+        word.remove_prefix(1);
+      const GlobPattern &glob = cached_glob(word.empty() ? "?" : expand_pattern(word));
+      transformed = true;
+      for (auto item : items)
+        results.push_back(change_case(item, glob, c == '^', only_first));
+    }
+    else if (c == ':')
+    {
+      size_t colon2 = find_unquoted(word, ':');
+      long long offset, length = LLONG_MAX;
+      if (word.empty() || !parse_offset(word.substr(0, colon2), offset) ||
+          (colon2 != std::string_view::npos && !parse_offset(word.substr(colon2 + 1), length)))
+        return false;
+      if (every)
+      {
+        // An element slice: elements from index OFFSET on, LENGTH of them
+        if (length < 0)
+          return false;
+        long long end_index = indices.empty() ? 0 : indices.back() + 1;
+        if (offset < 0)
+          offset += end_index;
+        size_t first = std::lower_bound(indices.begin(), indices.end(), (size_t)std::max(offset, 0LL)) -
+                       indices.begin();
+        if (offset < 0)
+          first = items.size();
+        size_t count = std::min<unsigned long long>(length, items.size() - first);
+        items = std::vector<std::string_view>(items.begin() + first, items.begin() + first + count);
+      }
+      else
+        for (auto &item : items)
+        {
+          long long total = char_length(item);
+          long long from = offset < 0 ? offset + total : offset;
+          long long to = length < 0 ? total + length : from + std::min(length, total);
+          if (from < 0 || from > total || to < from)
+          {
+            item = {};
+            continue;
+          }
+          size_t start = byte_offset(item, from);
+          item = item.substr(start, byte_offset(item.substr(start), to - from));
+        }
+    }
+    else
+      return false;
+  }
+  if (!transformed)
+    for (auto item : items)
+      results.emplace_back(item);
+
+  if (every && subscript == "@")
+  {
+    all = true;
+    values = std::move(results);
+  }
+  else if (every)
+  {
+    // [*] joins the elements with the first IFS character
+    std::string joined;
+    std::string_view ifs = current_ifs();
+    for (size_t k = 0; k < results.size(); ++k)
+    {
+      if (k && !ifs.empty())
+        joined += ifs[0];
+      joined += results[k];
+    }
+    values = {joined};
+  }
+  else if (!results.empty())
+    values = {std::move(results[0])};
+  return true;
+}
+
+// Helper: The shared tokenizer. With split unset, whitespace is ordinary
+// text, expansions are not field-split and exactly one token results. In
+// the elements of a compound assignment, a leading [KEY] may hold spaces.
+static void expand_words(std::string_view s, bool split, std::vector<std::string> &tokens, bool compound = false)
+{
+  std::string current;
+  bool in_single_quote = false, in_double_quote = false;
+  // quoted: the word so far contains quoting, so it cannot be an
+  // assignment; vanished: an empty "${a[@]}" that should leave no word
+  bool have_word = false, quoted = false, vanished = false;
+  std::vector<std::string> values;
+  bool all;
+  auto end_word = [&]() {
+    if (have_word && !(vanished && current.empty()))
+      tokens.push_back(current);
+    current.clear();
+    have_word = quoted = vanished = false;
+  };
+  auto assignment_prefix = [&]() {
+    size_t eq = current.find('=');
+    if (quoted || eq == std::string::npos)
+      return false;
+    std::string_view name = std::string_view(current).substr(0, eq);
+    if (!name.empty() && name.back() == '+')
+      name.remove_suffix(1);
+    size_t bracket = name.find('[');
+    if (bracket != std::string_view::npos && name.back() == ']')
+      name = name.substr(0, bracket);
+    return valid_name(name);
+  };
+  for (size_t i = 0; i < s.size(); ++i)
+  {
+    char c = s[i];
+    if (in_single_quote)
+    {
+      if (c == '\'')
+        in_single_quote = false;
+      else
+        current += c;
+      continue;
+    }
+    if (c == '$' && i + 1 < s.size())
+    {
+      // ${...} runs to its matching brace; $NAME to the end of the name
+      std::string_view body;
+      size_t end = parameter_end(s, i, body);
+      if (!body.empty() && expand_parameter(body, values, all))
+      {
+        i = end;
+        if (in_double_quote || !split)
+        {
+          have_word = true;
+          // "${a[@]}" keeps each element a separate word
+          for (size_t k = 0; k < values.size(); ++k)
+          {
+            if (k && split)
+            {
+              tokens.push_back(current);
+              current.clear();
+            }
+            else if (k)
+              current += ' ';
+            current += values[k];
+          }
+          if (all && values.empty() && current.empty())
+            vanished = true;
+          continue;
+        }
+        if (assignment_prefix())
+        {
+          have_word = true;
+          for (auto &value : values)
+            current += value;
+          continue;
+        }
+        // Unquoted: the value's fields join the words around them
+        std::string_view ifs = current_ifs();
+        for (size_t k = 0; k < values.size(); ++k)
+        {
+          const std::string &value = values[k];
+          if (k)
+            end_word();
+          // Leading IFS whitespace separates the value from a word before it
+          if (!value.empty() && strchr(" \t\n", value[0]) && ifs.find(value[0]) != std::string_view::npos)
+            end_word();
+          FieldSplitter splitter(value, ifs);
+          std::string field;
+          bool first = true;
+          while (splitter.next(field))
+          {
+            if (!first)
+              end_word();
+            current += field;
+            have_word = true;
+            first = false;
+          }
+          if (!value.empty() && ifs.find(value.back()) != std::string_view::npos)
+            end_word();
+        }
+        continue;
+      }
+    }
+    if (in_double_quote)
+    {
+      if (c == '"')
+        in_double_quote = false;
+      else if (c == '\\' && i + 1 < s.size() &&
+               (s[i + 1] == '"' || s[i + 1] == '\\' || s[i + 1] == '$' || s[i + 1] == '\n'))
+      {
+        current += s[++i];
+      }
+      else
+        current += c;
+    }
+    else if (c == '\'')
+      in_single_quote = have_word = quoted = true;
+    else if (c == '"')
+      in_double_quote = have_word = quoted = true;
+    else if (c == '\\' && i + 1 < s.size())
+    {
+      current += s[++i];
+      have_word = quoted = true;
+    }
+    else if (split && c == '(' && i > 0 && (s[i - 1] == '<' || s[i - 1] == '>') && (i < 2 || s[i - 2] != '\\'))
+    {
+      // <(...) and >(...) become the path of a pipe to or from the command
+      size_t close = find_closing(s, i);
+      if (close == std::string_view::npos)
+        close = s.size();
+      bool output = current.back() == '>';
+      current.pop_back();
+      current += substitute_process(s.substr(i + 1, close - i - 1), output);
+      have_word = true;
+      i = close;
+    }
+    else if (split && c == '(' && !current.empty() && current.back() == '=' && assignment_prefix() &&
+             current.find('[') == std::string::npos)
+    {
+      // NAME=(...): the elements are words in their own right
+      size_t close = find_closing(s, i);
+      if (close == std::string_view::npos)
+        close = s.size();
+      std::vector<std::string> elements;
+      expand_words(s.substr(i + 1, close - i - 1), true, elements, true);
+      current += '(';
+      current += '\0';
+      for (auto &e : elements)
+      {
+        current += e;
+        current += '\0';
+      }
+      i = close;
+      end_word();
+    }
+    else if (compound && c == '[' && !have_word)
+    {
+      size_t close = find_closing(s, i);
+      if (close == std::string_view::npos)
+        close = s.size() - 1;
+      current += '[';
+      current += expand_text(s.substr(i + 1, close - i - 1));
+      current += s[close];
+      have_word = true;
+      i = close;
+    }
+    else if (split && std::isspace((unsigned char)c))
+      end_word();
+    else
+    {
+      current += c;
+      have_word = true;
+    }
+  }
+  if (!split)
+  {
+    tokens.push_back(current);
+    return;
+  }
+  end_word();
+}
+
+std::vector<std::string> expand_command(const std::vector<std::string> &words)
+{
+  std::vector<std::string> tokens;
+  for (auto &word : words)
+    expand_words(word, true, tokens);
+  return tokens;
+}
+
+std::string expand_text(std::string_view s)
+{
+  std::vector<std::string> tokens;
+  expand_words(s, false, tokens);
+  return tokens[0];
+}
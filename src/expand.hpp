@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Helper: Index of the bracket closing the one at s[open], skipping quoted
+// text and nested pairs; npos if it is never closed
+size_t find_closing(std::string_view s, size_t open);
+
+// Helper: Expand a command's words into its arguments, removing quotes and
+// escapes and expanding parameters. Unquoted expansions are split into
+// fields on IFS, except in the value of an assignment word. A NAME=(...)
+// word becomes the single token "NAME=(" NUL, then each expanded element
+// followed by a NUL, for parse_assignment to take apart.
+std::vector<std::string> expand_command(const std::vector<std::string> &words);
+
+// Helper: Expand parameters and remove quotes in text without splitting it
+// into fields, as for an array subscript
+std::string expand_text(std::string_view s);
+
+// Helper: Start command, the text of a <(command) or >(command), reading
+// from or (output) writing to a pipe; returns the /dev/fd path of the
+// shell's end. Defined by the shell, which reaps the command once the one
+// using the path is done.
+std::string substitute_process(std::string_view command, bool output);
+
+// Set when an expansion reports an error (${v:?message}); the command it
+// belonged to is not run
+extern bool expansion_failed;
+
+// Set while the shell reads commands from a terminal; elsewhere (-c, a
+// script) an expansion error exits the shell instead
+extern bool interactive;
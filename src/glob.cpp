@@ -0,0 +1,295 @@
+#include "glob.hpp"
+
+#include <cctype>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+// Patterns kept compiled; the cache starts over when it grows past this
+static const size_t GLOB_CACHE_LIMIT = 256;
+
+// Helper: Bytes in the UTF-8 character starting with lead byte c (1 for
+// anything that is not a lead byte)
+static inline size_t utf8_length(unsigned char c)
+{
+  if (c >= 0xF0 && c < 0xF8)
+    return 4;
+  if (c >= 0xE0)
+    return c < 0xF0 ? 3 : 1;
+  if (c >= 0xC0)
+    return 2;
+  return 1;
+}
+
+// Helper: The character at s[i], or the rest of s if it is truncated
+static inline std::string_view char_at(std::string_view s, size_t i)
+{
+  return s.substr(i, std::min(utf8_length(s[i]), s.size() - i));
+}
+
+// Helper: Whether byte c belongs to the named [:class:]
+static bool in_named_class(const std::string &name, unsigned char c)
+{
+  if (name == "alpha")
+    return isalpha(c);
+  if (name == "digit")
+    return isdigit(c);
+  if (name == "alnum")
+    return isalnum(c);
+  if (name == "upper")
+    return isupper(c);
+  if (name == "lower")
+    return islower(c);
+  if (name == "space")
+    return isspace(c);
+  if (name == "blank")
+    return c == ' ' || c == '\t';
+  if (name == "punct")
+    return ispunct(c);
+  if (name == "xdigit")
+    return isxdigit(c);
+  if (name == "cntrl")
+    return iscntrl(c);
+  if (name == "print")
+    return isprint(c);
+  if (name == "graph")
+    return isgraph(c);
+  return false;
+}
+
+GlobPattern::GlobPattern(std::string_view p)
+{
+  auto literal = [&](std::string_view text) {
+    if (tokens.empty() || tokens.back().kind != Token::Literal)
+      tokens.push_back({.kind = Token::Literal});
+    tokens.back().text += text;
+  };
+  for (size_t i = 0; i < p.size(); ++i)
+  {
+    char c = p[i];
+    if (c == '\\' && i + 1 < p.size())
+      literal(p.substr(++i, 1));
+    else if (c == '*')
+    {
+      if (tokens.empty() || tokens.back().kind != Token::Star)
+        tokens.push_back({.kind = Token::Star});
+    }
+    else if (c == '?')
+      tokens.push_back({.kind = Token::Any});
+    else if (c == '[')
+    {
+      // A class runs to the first ] that is not its first member; an
+      // unclosed [ is an ordinary character
+      Token t{.kind = Token::Class};
+      size_t j = i + 1;
+      if (j < p.size() && (p[j] == '!' || p[j] == '^'))
+        t.negated = true, ++j;
+      bool closed = false;
+      for (bool first = true; j < p.size(); first = false)
+      {
+        if (p[j] == ']' && !first)
+        {
+          closed = true;
+          break;
+        }
+        if (p.compare(j, 2, "[:") == 0)
+        {
+          size_t end = p.find(":]", j + 2);
+          if (end != std::string_view::npos)
+          {
+            std::string name(p.substr(j + 2, end - j - 2));
+            for (int b = 0; b < 128; ++b)
+              if (in_named_class(name, b))
+                t.set.set(b);
+            j = end + 2;
+            continue;
+          }
+        }
+        if (p[j] == '\\' && j + 1 < p.size())
+          ++j;
+        std::string_view member = char_at(p, j);
+        j += member.size();
+        if (member.size() > 1)
+        {
+          t.wide.emplace_back(member);
+          continue;
+        }
+        unsigned char lo = member[0], hi = lo;
+        if (j + 1 < p.size() && p[j] == '-' && p[j + 1] != ']')
+        {
+          hi = p[j + 1];
+          j += 2;
+        }
+        for (unsigned b = lo; b <= hi; ++b)
+          t.set.set(b);
+      }
+      if (!closed)
+        literal("[");
+      else
+      {
+        tokens.push_back(std::move(t));
+        i = j;
+      }
+    }
+    else
+      literal(p.substr(i, 1));
+  }
+
+  for (auto &t : tokens)
+  {
+    if (t.kind == Token::Star)
+      max_len = std::string::npos;
+    size_t lo = t.kind == Token::Literal ? t.text.size() : t.kind == Token::Star ? 0 : 1;
+    size_t hi = t.kind == Token::Literal ? t.text.size() : 4;
+    min_len += lo;
+    if (max_len != std::string::npos)
+      max_len += hi;
+  }
+  if (!tokens.empty() && tokens.front().kind == Token::Literal)
+    head = tokens.front().text;
+  if (!tokens.empty() && tokens.back().kind == Token::Literal)
+    tail = tokens.back().text;
+}
+
+bool GlobPattern::class_matches(const Token &t, std::string_view c) const
+{
+  bool in;
+  if (c.size() == 1)
+    in = t.set.test((unsigned char)c[0]);
+  else
+  {
+    in = false;
+    for (auto &w : t.wide)
+      in = in || w == c;
+  }
+  return in != t.negated;
+}
+
+// Tokens are matched left to right; on a mismatch the most recent * takes
+// one more character and matching resumes after it. Earlier stars never
+// need to be revisited, so this is linear in practice.
+bool GlobPattern::match(std::string_view s) const
+{
+  if (s.size() < min_len || (max_len != std::string::npos && s.size() > max_len))
+    return false;
+  size_t ti = 0, si = 0;
+  size_t star_ti = std::string::npos, star_si = 0;
+  while (true)
+  {
+    if (ti < tokens.size())
+    {
+      const Token &t = tokens[ti];
+      if (t.kind == Token::Star)
+      {
+        star_ti = ti++;
+        star_si = si;
+        continue;
+      }
+      if (t.kind == Token::Literal)
+      {
+        if (s.compare(si, t.text.size(), t.text) == 0)
+        {
+          si += t.text.size();
+          ++ti;
+          continue;
+        }
+      }
+      else if (si < s.size())
+      {
+        std::string_view c = char_at(s, si);
+        if (t.kind == Token::Any || class_matches(t, c))
+        {
+          si += c.size();
+          ++ti;
+          continue;
+        }
+      }
+    }
+    else if (si == s.size())
+      return true;
+    if (star_ti == std::string::npos || star_si >= s.size())
+      return false;
+    star_si += char_at(s, star_si).size();
+    si = star_si;
+    ti = star_ti + 1;
+  }
+}
+
+bool GlobPattern::may_end_at(std::string_view s, size_t end) const
+{
+  return tail.empty() || (end >= tail.size() && s.compare(end - tail.size(), tail.size(), tail) == 0);
+}
+
+bool GlobPattern::may_start_at(std::string_view s, size_t start) const
+{
+  return head.empty() || s.compare(start, head.size(), head) == 0;
+}
+
+size_t GlobPattern::match_prefix(std::string_view s, bool longest) const
+{
+  if (!may_start_at(s, 0))
+    return std::string::npos;
+  size_t lo = min_len, hi = std::min(max_len, s.size());
+  for (size_t k = 0; lo <= hi && k <= hi - lo; ++k)
+  {
+    size_t len = longest ? hi - k : lo + k;
+    if (len < s.size() && (s[len] & 0xC0) == 0x80)
+      continue;
+    if (may_end_at(s, len) && match(s.substr(0, len)))
+      return len;
+  }
+  return std::string::npos;
+}
+
+size_t GlobPattern::match_suffix(std::string_view s, bool longest) const
+{
+  if (!may_end_at(s, s.size()))
+    return std::string::npos;
+  size_t lo = min_len, hi = std::min(max_len, s.size());
+  for (size_t k = 0; lo <= hi && k <= hi - lo; ++k)
+  {
+    size_t start = s.size() - (longest ? hi - k : lo + k);
+    if (start < s.size() && (s[start] & 0xC0) == 0x80)
+      continue;
+    if (may_start_at(s, start) && match(s.substr(start)))
+      return start;
+  }
+  return std::string::npos;
+}
+
+bool GlobPattern::search(std::string_view s, size_t from, size_t &start, size_t &len) const
+{
+  for (size_t i = from; i <= s.size(); ++i)
+  {
+    // A literal head lets whole stretches of s be skipped
+    if (!head.empty())
+    {
+      i = s.find(head, i);
+      if (i == std::string_view::npos)
+        return false;
+    }
+    else if (i < s.size() && (s[i] & 0xC0) == 0x80)
+      continue;
+    size_t n = match_prefix(s.substr(i), true);
+    if (n != std::string::npos)
+    {
+      start = i;
+      len = n;
+      return true;
+    }
+  }
+  return false;
+}
+
+const GlobPattern &cached_glob(std::string_view pattern)
+{
+  static std::unordered_map<std::string, std::unique_ptr<GlobPattern>> cache;
+  auto it = cache.find(std::string(pattern));
+  if (it != cache.end())
+    return *it->second;
+  if (cache.size() >= GLOB_CACHE_LIMIT)
+    cache.clear();
+  auto &slot = cache[std::string(pattern)];
+  slot = std::make_unique<GlobPattern>(pattern);
+  return *slot;
+}
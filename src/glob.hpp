@@ -0,0 +1,56 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A shell glob pattern (*, ?, [...] classes and backslash escapes) compiled
+// once into tokens. Besides whole-string matching it answers the prefix,
+// suffix and substring questions parameter expansion asks, using the
+// pattern's length bounds and literal ends to skip candidates that cannot
+// match. ? and classes match one UTF-8 character.
+class GlobPattern
+{
+public:
+  explicit GlobPattern(std::string_view pattern);
+
+  // Whether the pattern matches all of s
+  bool match(std::string_view s) const;
+  // Length of the shortest (or longest) prefix of s that matches, or npos
+  size_t match_prefix(std::string_view s, bool longest) const;
+  // Start of the shortest (or longest) suffix of s that matches, or npos
+  size_t match_suffix(std::string_view s, bool longest) const;
+  // The leftmost longest match starting at or after from; false if none
+  bool search(std::string_view s, size_t from, size_t &start, size_t &len) const;
+
+private:
+  struct Token
+  {
+    enum Kind
+    {
+      Literal,
+      Any,
+      Class,
+      Star
+    };
+    Kind kind;
+    std::string text{};              // Literal: the bytes to match
+    std::bitset<256> set{};          // Class: single bytes in the class
+    std::vector<std::string> wide{}; // Class: multibyte characters in it
+    bool negated = false;
+  };
+  bool class_matches(const Token &t, std::string_view c) const;
+  // Whether a match could end at byte end / start at byte start, judging
+  // only by the literal the pattern ends / starts with
+  bool may_end_at(std::string_view s, size_t end) const;
+  bool may_start_at(std::string_view s, size_t start) const;
+
+  std::vector<Token> tokens;
+  size_t min_len = 0, max_len = 0; // in bytes; max_len is npos with a *
+  std::string head, tail;          // literal text the pattern starts / ends with
+};
+
+// Helper: The compiled form of a pattern, from a cache keyed by its text
+const GlobPattern &cached_glob(std::string_view pattern);
@@ -0,0 +1,541 @@
+#include "builtins.hpp"
+#include "ring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#include <unordered_map>
+
+// Helper: read(2), or a read from the ring fd stands for
+static ssize_t read_fd(int fd, void *buf, size_t len)
+{
+  if (ByteRing *ring = ring_for(fd))
+    return ring->read(static_cast<char *>(buf), len);
+  return ::read(fd, buf, len);
+}
+
+ssize_t Io::read(void *buf, size_t len)
+{
+  while (true)
+  {
+    ssize_t n = read_fd(in, buf, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    return n;
+  }
+}
+
+bool Io::write(const void *buf, size_t len)
+{
+  if (ByteRing *ring = ring_for(out))
+    return ring->write(static_cast<const char *>(buf), len);
+  const char *p = static_cast<const char *>(buf);
+  while (len > 0)
+  {
+    ssize_t n = ::write(out, p, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+int builtin_error(Io &io, const std::string &name, const std::string &message, int status)
+{
+  // A builtin whose reader has gone stops quietly, as a process would on
+  // SIGPIPE: a fused stage's ring, or a pipe left without a reader (its
+  // write end then polls as an error)
+  if (ByteRing *ring = ring_for(io.out); ring && ring->reader_closed())
+    return status;
+  pollfd out_fd = {io.out, 0, 0};
+  if (!ring_for(io.out) && poll(&out_fd, 1, 0) > 0 && (out_fd.revents & POLLERR))
+    return status;
+  Io err_io{io.in, io.err, io.err};
+  err_io.write(name + ": " + message + "\n");
+  return status;
+}
+
+int open_input(const std::string &path, Io &io)
+{
+  if (path == "-")
+    return io.in;
+  int fd;
+  do
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  while (fd < 0 && errno == EINTR);
+  return fd;
+}
+
+void close_input(int fd, Io &io)
+{
+  if (fd >= 0 && fd != io.in)
+    close(fd);
+}
+
+OutBuffer::OutBuffer(Io &io, size_t capacity) : io(io), buf(capacity) {}
+
+OutBuffer::~OutBuffer()
+{
+  flush();
+}
+
+void OutBuffer::put(std::string_view s)
+{
+  if (len + s.size() > buf.size())
+  {
+    flush();
+    // Large pieces go straight out instead of through the buffer
+    if (s.size() >= buf.size())
+    {
+      if (!failed && !io.write(s))
+        failed = true;
+      return;
+    }
+  }
+  memcpy(buf.data() + len, s.data(), s.size());
+  len += s.size();
+}
+
+bool OutBuffer::flush()
+{
+  if (len > 0 && !failed && !io.write(buf.data(), len))
+    failed = true;
+  len = 0;
+  return !failed;
+}
+
+MappedFile::~MappedFile()
+{
+  if (addr)
+    munmap(addr, len);
+}
+
+bool MappedFile::map(int fd)
+{
+  struct stat sb;
+  if (fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode))
+    return false;
+  off_t start = lseek(fd, 0, SEEK_CUR);
+  if (start < 0 || start >= sb.st_size)
+    return false;
+  off_t base = start & ~off_t(sysconf(_SC_PAGESIZE) - 1);
+  void *p = mmap(nullptr, sb.st_size - base, PROT_READ, MAP_PRIVATE, fd, base);
+  if (p == MAP_FAILED)
+    return false;
+  addr = static_cast<char *>(p);
+  len = sb.st_size - base;
+  skip = start - base;
+  return true;
+}
+
+void MappedFile::advise_sequential() const
+{
+  madvise(addr, len, MADV_SEQUENTIAL);
+}
+
+bool read_blocks(int fd, const std::function<bool(const char *, size_t)> &fn)
+{
+  // A ring's contents are handed over in place
+  if (ByteRing *ring = ring_for(fd))
+  {
+    for (std::string_view data = ring->peek(); !data.empty(); data = ring->peek())
+    {
+      bool more = fn(data.data(), data.size());
+      ring->consume(data.size());
+      if (!more)
+        break;
+    }
+    return true;
+  }
+  MappedFile file;
+  if (file.map(fd))
+  {
+    file.advise_sequential();
+    fn(file.data(), file.size());
+    // Leave the offset where a read of the whole rest would have
+    lseek(fd, file.size(), SEEK_CUR);
+    return true;
+  }
+  std::vector<char> buf(1 << 20);
+  while (true)
+  {
+    ssize_t n = read(fd, buf.data(), buf.size());
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return false;
+    if (n == 0 || !fn(buf.data(), n))
+      return true;
+  }
+}
+
+bool read_line_blocks(int fd, const std::function<bool(const char *, size_t)> &fn)
+{
+  MappedFile file;
+  if (file.map(fd))
+  {
+    file.advise_sequential();
+    fn(file.data(), file.size());
+    // Leave the offset where a read of the whole rest would have
+    lseek(fd, file.size(), SEEK_CUR);
+    return true;
+  }
+  std::vector<char> buf(1 << 20);
+  size_t have = 0;
+  while (true)
+  {
+    // A line longer than the buffer grows it
+    if (have == buf.size())
+      buf.resize(buf.size() * 2);
+    ssize_t n = read_fd(fd, buf.data() + have, buf.size() - have);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return false;
+    if (n == 0)
+    {
+      if (have > 0)
+        fn(buf.data(), have);
+      return true;
+    }
+    have += n;
+    const char *nl = static_cast<const char *>(memrchr(buf.data(), '\n', have));
+    if (!nl)
+      continue;
+    size_t upto = nl - buf.data() + 1;
+    if (!fn(buf.data(), upto))
+      return true;
+    memmove(buf.data(), buf.data() + upto, have - upto);
+    have -= upto;
+  }
+}
+
+bool input_ready(int fd)
+{
+  if (ByteRing *ring = ring_for(fd))
+    return ring->ready();
+  pollfd pfd = {fd, POLLIN, 0};
+  return poll(&pfd, 1, 0) != 0;
+}
+
+// Input read ahead on fds this process owns, kept for the next read_record
+static std::unordered_map<int, std::string> owned_input;
+
+void set_input_owned(int fd, bool owned)
+{
+  if (owned)
+    owned_input.try_emplace(fd);
+  else
+    owned_input.erase(fd);
+}
+
+int read_record(int fd, char delim, size_t max, int timeout_ms, std::string &out)
+{
+  out.clear();
+  struct stat sb;
+  if (fstat(fd, &sb) < 0)
+    return -1;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  // Returns 1 once fd is readable, 0 if the timeout ran out first
+  auto wait = [&]() {
+    while (true)
+    {
+      int ms = -1;
+      if (timeout_ms >= 0)
+      {
+        auto left = deadline - std::chrono::steady_clock::now();
+        ms = std::max<long>(0, std::chrono::ceil<std::chrono::milliseconds>(left).count());
+      }
+      pollfd pfd = {fd, POLLIN, 0};
+      int n = poll(&pfd, 1, ms);
+      if (n >= 0 || errno != EINTR)
+        return n != 0;
+    }
+  };
+  bool found = false;
+  // Appends p[0, n) up to the delimiter or max, returning the bytes used
+  auto take = [&](const char *p, size_t n) -> size_t {
+    size_t scan = std::min(n, max - out.size());
+    const char *d = static_cast<const char *>(memchr(p, delim, scan));
+    if (d)
+    {
+      out.append(p, d);
+      found = true;
+      return d - p + 1;
+    }
+    out.append(p, scan);
+    return scan;
+  };
+  // Reads exactly len bytes already known to be there
+  auto consume = [&](char *p, size_t len) {
+    while (len > 0)
+    {
+      ssize_t n = ::read(fd, p, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      p += n;
+      len -= n;
+    }
+    return true;
+  };
+  // Look-ahead starts small and grows while records are long, so short
+  // lines do not each cost a large copy
+  static size_t guess = 128;
+  static int peek_pipe[2] = {-1, -1};
+  static bool can_tee = true;
+  char buf[1 << 16];
+  auto owned = owned_input.find(fd);
+  bool canonical_tty = false;
+  if (S_ISCHR(sb.st_mode) && delim == '\n')
+  {
+    termios tio;
+    canonical_tty = tcgetattr(fd, &tio) == 0 && (tio.c_lflag & ICANON);
+  }
+  while (!found && out.size() < max)
+  {
+    size_t want = std::min({guess, sizeof(buf), max - out.size()});
+    ssize_t n;
+    if (owned != owned_input.end())
+    {
+      // Owned input: read whole blocks and keep what is left over
+      std::string &pending = owned->second;
+      if (pending.empty())
+      {
+        if (timeout_ms >= 0 && !wait())
+          return -2;
+        n = ::read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          return n < 0 ? -1 : 0;
+        pending.assign(buf, n);
+      }
+      pending.erase(0, take(pending.data(), pending.size()));
+      continue;
+    }
+    if (S_ISREG(sb.st_mode))
+    {
+      // Regular files: read ahead, then seek back to just past the record
+      n = ::read(fd, buf, want);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return n < 0 ? -1 : 0;
+      size_t used = take(buf, n);
+      if (used < (size_t)n)
+        lseek(fd, (off_t)used - n, SEEK_CUR);
+    }
+    else if (timeout_ms >= 0 && !wait())
+      return -2;
+    else if (S_ISFIFO(sb.st_mode) && can_tee)
+    {
+      // Pipes: peek with tee(2) into a private pipe, then consume only the
+      // record itself
+      if (peek_pipe[0] < 0 && pipe2(peek_pipe, O_CLOEXEC) < 0)
+      {
+        can_tee = false;
+        continue;
+      }
+      if (timeout_ms < 0 && !wait())
+        continue;
+      n = tee(fd, peek_pipe[1], want, SPLICE_F_NONBLOCK);
+      if (n < 0)
+      {
+        if (errno == EAGAIN || errno == EINTR)
+          continue;
+        if (errno != EINVAL && errno != ENOSYS)
+          return -1;
+        can_tee = false;
+        continue;
+      }
+      if (n == 0)
+        return 0;
+      ssize_t got = 0;
+      while (got < n)
+      {
+        ssize_t r = ::read(peek_pipe[0], buf + got, n - got);
+        if (r < 0 && errno == EINTR)
+          continue;
+        if (r <= 0)
+          return -1;
+        got += r;
+      }
+      if (!consume(buf, take(buf, n)))
+        return -1;
+    }
+    else if (S_ISSOCK(sb.st_mode) || canonical_tty)
+    {
+      // Sockets can be peeked directly; a terminal in canonical mode never
+      // returns more than one line
+      n = S_ISSOCK(sb.st_mode) ? recv(fd, buf, want, MSG_PEEK) : ::read(fd, buf, std::min(sizeof(buf), max - out.size()));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return n < 0 ? -1 : 0;
+      size_t used = take(buf, n);
+      if (S_ISSOCK(sb.st_mode) && !consume(buf, used))
+        return -1;
+    }
+    else
+    {
+      // Anything else: a byte at a time, so nothing is over-read
+      n = ::read(fd, buf, 1);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return n < 0 ? -1 : 0;
+      take(buf, 1);
+    }
+    if (!found)
+      guess = std::min(guess * 2, sizeof(buf));
+  }
+  if (found)
+    guess = std::clamp<size_t>(out.size() * 2, 128, sizeof(buf));
+  return 1;
+}
+
+// Transfer strategies in order of preference; each falls back to the next
+// when the kernel rejects it for this pair of fds
+enum class TransferMethod
+{
+  CopyRange,
+  Sendfile,
+  Splice,
+  ReadWrite
+};
+
+ssize_t transfer_fd(int in, int out, off_t limit, const std::function<void(size_t)> &on_progress)
+{
+  struct stat in_sb, out_sb;
+  if (fstat(in, &in_sb) < 0 || fstat(out, &out_sb) < 0)
+    return -1;
+  int out_flags = fcntl(out, F_GETFL);
+  // None of the zero-copy calls accept an O_APPEND destination
+  bool out_append = out_flags >= 0 && (out_flags & O_APPEND);
+  bool any_pipe = S_ISFIFO(in_sb.st_mode) || S_ISFIFO(out_sb.st_mode);
+
+  TransferMethod method = TransferMethod::ReadWrite;
+  ByteRing *in_ring = ring_for(in);
+  if (!out_append && !in_ring && !ring_for(out))
+  {
+    if (S_ISREG(in_sb.st_mode) && S_ISREG(out_sb.st_mode))
+      method = TransferMethod::CopyRange;
+    else if (S_ISREG(in_sb.st_mode))
+      method = TransferMethod::Sendfile;
+    else if (any_pipe)
+      method = TransferMethod::Splice;
+  }
+
+  const size_t chunk = 1 << 20;
+  std::vector<char> buf;
+  off_t total = 0;
+  while (limit < 0 || total < limit)
+  {
+    size_t want = chunk;
+    if (limit >= 0)
+      want = std::min<off_t>(want, limit - total);
+    ssize_t n;
+    switch (method)
+    {
+    case TransferMethod::CopyRange:
+      n = copy_file_range(in, nullptr, out, nullptr, want, 0);
+      break;
+    case TransferMethod::Sendfile:
+      n = sendfile(out, in, nullptr, want);
+      break;
+    case TransferMethod::Splice:
+      n = splice(in, nullptr, out, nullptr, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+      break;
+    default:
+      if (in_ring)
+      {
+        // Written straight from the ring, without a copy through buf
+        std::string_view data = in_ring->peek();
+        n = std::min(want, data.size());
+        Io io{in, out, 2};
+        if (n > 0 && !io.write(data.data(), n))
+          return -1;
+        in_ring->consume(n);
+        break;
+      }
+      if (buf.empty())
+        buf.resize(1 << 17);
+      n = ::read(in, buf.data(), std::min(want, buf.size()));
+      if (n > 0)
+      {
+        Io io{in, out, 2};
+        if (!io.write(buf.data(), n))
+          return -1;
+      }
+      break;
+    }
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if (method != TransferMethod::ReadWrite &&
+          (errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF))
+      {
+        if (method == TransferMethod::CopyRange)
+          method = TransferMethod::Sendfile;
+        else if (method == TransferMethod::Sendfile && any_pipe)
+          method = TransferMethod::Splice;
+        else
+          method = TransferMethod::ReadWrite;
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0)
+    {
+      // Pseudo-files (procfs, sysfs) report EOF to the zero-copy calls
+      // straight away; confirm with a plain read before giving up
+      if (total == 0 && method != TransferMethod::ReadWrite)
+      {
+        method = TransferMethod::ReadWrite;
+        continue;
+      }
+      break;
+    }
+    total += n;
+    if (on_progress)
+      on_progress(n);
+  }
+  return total;
+}
+
+std::string format_size(double bytes)
+{
+  static const char units[] = "BKMGTPE";
+  int unit = 0;
+  while (bytes >= 1024 && unit < 6)
+  {
+    bytes /= 1024;
+    ++unit;
+  }
+  char out[32];
+  if (unit == 0)
+    snprintf(out, sizeof(out), "%.0f", bytes);
+  else if (bytes < 10)
+    snprintf(out, sizeof(out), "%.1f%c", bytes, units[unit]);
+  else
+    snprintf(out, sizeof(out), "%.0f%c", bytes, units[unit]);
+  return out;
+}
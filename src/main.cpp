@@ -1,87 +1,604 @@
+#include "aliases.hpp"
+#include "builtins.hpp"
+#include "expand.hpp"
+#include "parse.hpp"
+#include "ring.hpp"
+#include "vars.hpp"
+
+#include <csignal>
 #include <fcntl.h>
 #include <iostream>
+#include <map>
+#include <optional>
 #include <readline/history.h>
 #include <readline/readline.h>
 #include <sstream>
 #include <string>
+#include <sys/eventfd.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <thread>
 #include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <dirent.h>
 #include <algorithm>
+#include <cstring>
 
-// List of shell builtins for completion and type
-const std::vector<std::string> builtins = {"echo", "exit", "history", "pwd", "cd", "type"};
-
-// Helper: Check if a command is a shell builtin
-bool is_builtin(const std::string &cmd)
+// Helper: Look up an executable in PATH, returning its full path or ""
+std::string find_in_path(const std::string &name)
 {
-  return std::find(builtins.begin(), builtins.end(), cmd) != builtins.end();
+  char *path_env = std::getenv("PATH");
+  if (!path_env)
+    return "";
+  std::istringstream path_stream(path_env);
+  std::string dir;
+  while (std::getline(path_stream, dir, ':'))
+  {
+    std::string full_path = dir + "/" + name;
+    struct stat sb;
+    if (stat(full_path.c_str(), &sb) == 0 && sb.st_mode & S_IXUSR)
+      return full_path;
+  }
+  return "";
 }
 
-// Helper: Tokenize a command line into arguments, respecting quotes and escapes
-std::vector<std::string> tokenize(const std::string &s)
+// Redirections stripped from a command's tokens
+struct Redirections
 {
-  std::vector<std::string> tokens;
-  std::string current;
-  bool in_single_quote = false, in_double_quote= false;
-  for (size_t i = 0; i < s.size(); ++i)
+  std::string in_file, out_file, err_file;
+  bool out_append = false, err_append = false;
+};
+
+// Helper: Remove <, >, 1>, >>, 1>>, 2> and 2>> operators and their targets
+Redirections extract_redirections(std::vector<std::string> &tokens)
+{
+  Redirections r;
+  for (size_t i = 0; i < tokens.size();)
   {
-    char c = s[i];
-    if (in_single_quote)
+    if ((tokens[i] == "<" || tokens[i] == "0<") && i + 1 < tokens.size())
     {
-      if (c == '\'')
-        in_single_quote = false;
-      else
-        current += c;
+      r.in_file = tokens[i + 1];
+      tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
     }
-    else if (in_double_quote)
+    else if ((tokens[i] == ">" || tokens[i] == "1>") && i + 1 < tokens.size())
     {
-      if (c == '"')
-        in_double_quote = false;
-      else if (c == '\\' && i + 1 < s.size() &&
-               (s[i + 1] == '"' || s[i + 1] == '\\' || s[i + 1] == '$' || s[i + 1] == '\n'))
-      {
-        current += s[++i];
-      }
-      else
-        current += c;
+      r.out_file = tokens[i + 1];
+      r.out_append = false;
+      tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
+    }
+    else if ((tokens[i] == ">>" || tokens[i] == "1>>") && i + 1 < tokens.size())
+    {
+      r.out_file = tokens[i + 1];
+      r.out_append = true;
+      tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
+    }
+    else if (tokens[i] == "2>" && i + 1 < tokens.size())
+    {
+      r.err_file = tokens[i + 1];
+      r.err_append = false;
+      tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
+    }
+    else if (tokens[i] == "2>>" && i + 1 < tokens.size())
+    {
+      r.err_file = tokens[i + 1];
+      r.err_append = true;
+      tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
     }
     else
+      ++i;
+  }
+  return r;
+}
+
+// Helper: Remove the assignment words that lead a command
+std::vector<Assignment> extract_assignments(std::vector<std::string> &tokens)
+{
+  std::vector<Assignment> assignments;
+  size_t n = 0;
+  Assignment a;
+  for (; n < tokens.size() && parse_assignment(tokens[n], a); ++n)
+    assignments.push_back(std::move(a));
+  tokens.erase(tokens.begin(), tokens.begin() + n);
+  return assignments;
+}
+
+// Helper: Carry out assignments, reporting any that fail; false if one did
+bool apply_assignments(const std::vector<Assignment> &assignments)
+{
+  bool ok = true;
+  for (auto &a : assignments)
+  {
+    std::string err = apply_assignment(a);
+    if (!err.empty())
+    {
+      std::cerr << err << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// Helper: Open redirection targets and point io at them
+bool open_redirections(const Redirections &r, Io &io)
+{
+  if (!r.in_file.empty())
+  {
+    io.in = open(r.in_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (io.in < 0)
+    {
+      io.in = 0;
+      std::cerr << r.in_file << ": " << strerror(errno) << std::endl;
+      return false;
+    }
+  }
+  if (!r.out_file.empty())
+  {
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (r.out_append ? O_APPEND : O_TRUNC);
+    io.out = open(r.out_file.c_str(), flags, 0644);
+    if (io.out < 0)
+    {
+      io.out = 1;
+      std::cerr << "Failed to open file for redirection: " << r.out_file << std::endl;
+      return false;
+    }
+  }
+  if (!r.err_file.empty())
+  {
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (r.err_append ? O_APPEND : O_TRUNC);
+    io.err = open(r.err_file.c_str(), flags, 0644);
+    if (io.err < 0)
+    {
+      io.err = 2;
+      std::cerr << "Failed to open file for stderr redirection: " << r.err_file << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Helper: Close any fds open_redirections opened
+void close_redirections(Io &io)
+{
+  if (io.in != 0)
+    close(io.in);
+  if (io.out != 1)
+    close(io.out);
+  if (io.err != 2)
+    close(io.err);
+  io = Io{};
+}
+
+// Helper: In a forked child, make io the process's stdin/stdout/stderr
+void install_io(const Io &io)
+{
+  if (io.in != 0)
+    dup2(io.in, 0);
+  if (io.out != 1)
+    dup2(io.out, 1);
+  if (io.err != 2)
+    dup2(io.err, 2);
+}
+
+// A name's entry in the command table. A function shadows a builtin of
+// the same name until it is unset.
+struct CommandEntry
+{
+  const Builtin *builtin = nullptr;
+  std::shared_ptr<ShellFunction> function;
+};
+
+std::unordered_map<std::string, CommandEntry> &command_table();
+
+// Helper: Resolve a command name to a function, a builtin or an executable
+// path; functions and builtins share one table searched before PATH
+CommandTarget resolve_command(const std::string &name)
+{
+  CommandTarget target;
+  auto &table = command_table();
+  auto it = table.find(name);
+  if (it != table.end())
+  {
+    target.function = it->second.function;
+    target.builtin = it->second.builtin;
+    if (target.function || target.builtin)
+      return target;
+  }
+  target.path = name.find('/') == std::string::npos ? find_in_path(name) : name;
+  return target;
+}
+
+// SIGPIPE's disposition as the shell was started with it. The shell
+// ignores the signal, so a builtin writing to a reader that has gone gets
+// EPIPE instead of killing the shell; children get this back.
+static struct sigaction inherited_sigpipe;
+
+void restore_child_signals()
+{
+  sigaction(SIGPIPE, &inherited_sigpipe, nullptr);
+}
+
+// Helper: In a forked child, exec an already resolved external command
+[[noreturn]] static void exec_target(const CommandTarget &target, std::vector<std::string> &tokens)
+{
+  if (target.path.empty())
+  {
+    std::cerr << tokens[0] << ": command not found" << std::endl;
+    exit(1);
+  }
+  std::vector<char *> argv;
+  for (auto &t : tokens)
+    argv.push_back(const_cast<char *>(t.c_str()));
+  argv.push_back(nullptr);
+  execv(target.path.c_str(), argv.data());
+  std::cerr << "Failed to execute " << target.path << std::endl;
+  exit(1);
+}
+
+int call_function(ShellFunction &f, std::vector<std::string> &args, Io &io);
+
+// Helper: Fork a child running a resolved command on io
+pid_t spawn_command(const CommandTarget &target, std::vector<std::string> &args, const Io &io, bool new_group)
+{
+  pid_t pid = fork();
+  // Both sides set the group, so it exists whichever runs first
+  if (pid > 0 && new_group)
+    setpgid(pid, pid);
+  if (pid != 0)
+    return pid;
+  if (new_group)
+    setpgid(0, 0);
+  restore_child_signals();
+  if (target.builtin && !target.function)
+    exit(target.builtin->fn(args, const_cast<Io &>(io)));
+  install_io(io);
+  if (target.function)
+  {
+    Io std_io;
+    exit(call_function(*target.function, args, std_io));
+  }
+  exec_target(target, args);
+}
+
+// Helper: Wait for a child and turn its wait status into an exit status
+int wait_status(pid_t pid)
+{
+  int status;
+  if (waitpid(pid, &status, 0) < 0)
+    return 1;
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+
+int unsupported_option(std::vector<std::string> &args, Io &io, const std::string &message, int status)
+{
+  CommandTarget target;
+  target.path = find_in_path(args[0]);
+  if (target.path.empty())
+    return builtin_error(io, args[0], message, status);
+  // A fused stage's rings exist only in this process, so the program gets
+  // pipes instead, with this thread and a helper copying across
+  ByteRing *in_ring = ring_for(io.in);
+  int in_pipe[2] = {-1, -1}, out_pipe[2] = {-1, -1};
+  if ((in_ring && pipe2(in_pipe, O_CLOEXEC) < 0) || (ring_for(io.out) && pipe2(out_pipe, O_CLOEXEC) < 0))
+  {
+    int saved = errno;
+    for (int fd : {in_pipe[0], in_pipe[1]})
+      if (fd >= 0)
+        close(fd);
+    return builtin_error(io, args[0], std::string("pipe: ") + strerror(saved), status);
+  }
+  Io child = io;
+  if (in_ring)
+    child.in = in_pipe[0];
+  if (out_pipe[1] >= 0)
+    child.out = out_pipe[1];
+  pid_t pid = spawn_command(target, args, child);
+  for (int fd : {in_pipe[0], out_pipe[1]})
+    if (fd >= 0)
+      close(fd);
+  std::thread feeder;
+  if (pid > 0 && in_ring)
+    feeder = std::thread([&] {
+      // A program that stops reading ends the copy with EPIPE; the signal
+      // stays pending on this thread and is dropped when it exits
+      sigset_t pipe_signal;
+      sigemptyset(&pipe_signal);
+      sigaddset(&pipe_signal, SIGPIPE);
+      pthread_sigmask(SIG_BLOCK, &pipe_signal, nullptr);
+      transfer_fd(io.in, in_pipe[1]);
+      close(in_pipe[1]);
+    });
+  else if (in_pipe[1] >= 0)
+    close(in_pipe[1]);
+  if (pid > 0 && out_pipe[0] >= 0)
+    transfer_fd(out_pipe[0], io.out);
+  if (out_pipe[0] >= 0)
+    close(out_pipe[0]);
+  int result = pid > 0 ? wait_status(pid) : builtin_error(io, args[0], std::string("fork: ") + strerror(errno), status);
+  // Whatever the program left unread stays in the ring; closing it wakes
+  // the feeder if it is still waiting there
+  if (in_ring)
+    in_ring->close_reader();
+  if (feeder.joinable())
+    feeder.join();
+  return result;
+}
+
+const char *histfile = nullptr;
+int last_appended_history = 0;
+
+// Builtin: exit [status]
+int builtin_exit(std::vector<std::string> &args, Io &)
+{
+  if (histfile && histfile[0] != '\0')
+    write_history(histfile);
+  int status = 0;
+  if (args.size() > 1)
+  {
+    try
+    {
+      status = std::stoi(args[1]);
+    }
+    catch (...)
     {
-      if (c == '\'')
-        in_single_quote = true;
-      else if (c == '"')
-        in_double_quote = true;
-      else if (c == '\\' && i + 1 < s.size())
-        current += s[++i];
-      else if (std::isspace(c))
+      status = 2;
+    }
+  }
+  exit(status);
+}
+
+// Builtin: echo [ARG...]
+int builtin_echo(std::vector<std::string> &args, Io &io)
+{
+  OutBuffer out(io);
+  for (size_t i = 1; i < args.size(); ++i)
+  {
+    if (i > 1)
+      out.put(' ');
+    out.put(args[i]);
+  }
+  out.put('\n');
+  return out.flush() ? 0 : 1;
+}
+
+// Builtin: history [N | -r FILE | -w FILE | -a FILE]
+int builtin_history(std::vector<std::string> &args, Io &io)
+{
+  std::string arg1 = args.size() > 1 ? args[1] : "", arg2 = args.size() > 2 ? args[2] : "";
+  if (arg1 == "-r" && !arg2.empty())
+  {
+    read_history(arg2.c_str());
+    return 0;
+  }
+  if (arg1 == "-w" && !arg2.empty())
+  {
+    write_history(arg2.c_str());
+    last_appended_history = history_length;
+    return 0;
+  }
+  if (arg1 == "-a" && !arg2.empty())
+  {
+    HIST_ENTRY **hist_list = history_list();
+    if (hist_list)
+    {
+      FILE *f = fopen(arg2.c_str(), "a");
+      if (f)
       {
-        if (!current.empty())
-        {
-          tokens.push_back(current);
-          current.clear();
-        }
+        int total = 0;
+        while (hist_list[total])
+          ++total;
+        for (int i = last_appended_history; i < total; ++i)
+          fprintf(f, "%s\n", hist_list[i]->line);
+        fclose(f);
+        last_appended_history = total;
       }
-      else
-        current += c;
+    }
+    return 0;
+  }
+  int n = -1;
+  if (!arg1.empty() && arg1 != "-r" && arg1 != "-w")
+  {
+    try
+    {
+      n = std::stoi(arg1);
+    }
+    catch (...)
+    {
+      n = -1;
+    }
+  }
+  HIST_ENTRY **hist_list = history_list();
+  if (hist_list)
+  {
+    int total = 0;
+    while (hist_list[total])
+      ++total;
+    int start = (n > 0 && n < total) ? total - n : 0;
+    OutBuffer out(io);
+    for (int i = start; i < total; ++i)
+    {
+      out.put("    " + std::to_string(i + 1) + "  ");
+      out.put(hist_list[i]->line);
+      out.put('\n');
     }
   }
-  if (!current.empty())
-    tokens.push_back(current);
-  return tokens;
+  return 0;
 }
 
-// Helper: Trim whitespace from both ends of a string
-void trim(std::string &s)
+// Builtin: pwd
+int builtin_pwd(std::vector<std::string> &, Io &io)
 {
-  size_t start = s.find_first_not_of(" \t");
-  size_t end = s.find_last_not_of(" \t");
-  if (start == std::string::npos)
-    s = "";
-  else
-    s = s.substr(start, end - start + 1);
+  char cwd[4096];
+  if (!getcwd(cwd, sizeof(cwd)))
+    return builtin_error(io, "pwd", "error retrieving current directory");
+  io.write(std::string(cwd) + "\n");
+  return 0;
+}
+
+// Builtin: cd [DIR]
+int builtin_cd(std::vector<std::string> &args, Io &io)
+{
+  if (args.size() < 2)
+    return 0;
+  std::string path = args[1];
+  if (path == "~")
+  {
+    const char *home = std::getenv("HOME");
+    if (!home)
+      return 0;
+    if (chdir(home) != 0)
+      return builtin_error(io, "cd", path + ": No such file or directory");
+    return 0;
+  }
+  if (chdir(path.c_str()) != 0)
+    return builtin_error(io, "cd", path + ": No such file or directory");
+  return 0;
+}
+
+// Builtin: true, :
+int builtin_true(std::vector<std::string> &, Io &)
+{
+  return 0;
+}
+
+// Builtin: false
+int builtin_false(std::vector<std::string> &, Io &)
+{
+  return 1;
+}
+
+int builtin_type(std::vector<std::string> &args, Io &io);
+int builtin_return(std::vector<std::string> &args, Io &io);
+int builtin_source(std::vector<std::string> &args, Io &io);
+
+// List of shell builtins, used for dispatch, completion and type
+const std::vector<Builtin> builtins = {
+    {"echo", builtin_echo},
+    {"exit", builtin_exit},
+    {"history", builtin_history},
+    {"pwd", builtin_pwd},
+    {"cd", builtin_cd},
+    {"true", builtin_true},
+    {":", builtin_true},
+    {"false", builtin_false},
+    {"type", builtin_type},
+    {"return", builtin_return},
+    {"source", builtin_source},
+    {".", builtin_source},
+    {"local", builtin_local},
+    {"read", builtin_read},
+    {"mapfile", builtin_mapfile},
+    {"readarray", builtin_mapfile},
+    {"declare", builtin_declare},
+    {"typeset", builtin_declare},
+    {"unset", builtin_unset},
+    {"alias", builtin_alias},
+    {"unalias", builtin_unalias},
+    {"cat", builtin_cat},
+    {"tee", builtin_tee},
+    {"pv", builtin_pv},
+    {"fanout", builtin_fanout},
+    {"fanin", builtin_fanin},
+    {"wc", builtin_wc},
+    {"grep", builtin_grep},
+    {"sort", builtin_sort},
+    {"head", builtin_head},
+    {"tail", builtin_tail},
+    {"cut", builtin_cut},
+    {"find", builtin_find},
+    {"cp", builtin_cp},
+    {"mv", builtin_mv},
+    {"ls", builtin_ls},
+    {"du", builtin_du},
+    {"xargs", builtin_xargs},
+    {"sleep", builtin_sleep},
+    {"timeout", builtin_timeout},
+    {"seq", builtin_seq},
+    {"yes", builtin_yes},
+};
+
+// Helper: The command table, seeded with the builtins on first use
+std::unordered_map<std::string, CommandEntry> &command_table()
+{
+  static std::unordered_map<std::string, CommandEntry> table = [] {
+    std::unordered_map<std::string, CommandEntry> t;
+    for (auto &b : builtins)
+      t[b.name].builtin = &b;
+    return t;
+  }();
+  return table;
+}
+
+// Helper: Find a shell builtin by name
+const Builtin *find_builtin(const std::string &cmd)
+{
+  auto &table = command_table();
+  auto it = table.find(cmd);
+  return it == table.end() ? nullptr : it->second.builtin;
+}
+
+// Helper: Define or redefine a shell function
+void define_function(const std::shared_ptr<ShellFunction> &f)
+{
+  command_table()[f->name].function = f;
+}
+
+bool unset_function(const std::string &name)
+{
+  auto &table = command_table();
+  auto it = table.find(name);
+  if (it == table.end() || !it->second.function)
+    return false;
+  it->second.function.reset();
+  if (!it->second.builtin)
+    table.erase(it);
+  return true;
+}
+
+// Helper: Check if a command is a shell builtin
+bool is_builtin(const std::string &cmd)
+{
+  return find_builtin(cmd) != nullptr;
+}
+
+// Builtin: type NAME
+int builtin_type(std::vector<std::string> &args, Io &io)
+{
+  if (args.size() < 2)
+  {
+    io.write("type: missing argument\n");
+    return 1;
+  }
+  const std::string &arg = args[1];
+  if (const Alias *a = find_alias(arg))
+  {
+    io.write(arg + " is aliased to `" + a->text + "'\n");
+    return 0;
+  }
+  CommandTarget target = resolve_command(arg);
+  if (target.function)
+  {
+    io.write(arg + " is a function\n");
+    if (!target.function->text.empty())
+      io.write(arg + " () " + target.function->text + "\n");
+    return 0;
+  }
+  if (is_builtin(arg))
+  {
+    io.write(arg + " is a shell builtin\n");
+    return 0;
+  }
+  std::string full_path = find_in_path(arg);
+  if (full_path.empty())
+  {
+    io.write(arg + ": not found\n");
+    return 1;
+  }
+  io.write(arg + " is " + full_path + "\n");
+  return 0;
 }
 
 // Builtin command completion for readline
@@ -95,13 +612,28 @@ char *builtin_generator(const char *text, int state)
   }
   while (idx < builtins.size())
   {
-    if (builtins[idx].compare(0, len, text) == 0)
-      return strdup(builtins[idx++].c_str());
+    if (strncmp(builtins[idx].name, text, len) == 0)
+      return strdup(builtins[idx++].name);
     ++idx;
   }
   return nullptr;
 }
 
+// Alias name completion for readline
+char *alias_generator(const char *text, int state)
+{
+  static std::vector<std::string> matches;
+  static size_t match_index;
+  if (!state)
+  {
+    matches = alias_names(text);
+    match_index = 0;
+  }
+  if (match_index < matches.size())
+    return strdup(matches[match_index++].c_str());
+  return nullptr;
+}
+
 char **builtin_completion(const char *text, int start, int)
 {
   if (start != 0)
@@ -157,9 +689,16 @@ char **command_completion(const char *text, int start, int end)
   if (start != 0)
     return nullptr;
   rl_attempted_completion_over = 1;
+  char **alias_matches = rl_completion_matches(text, alias_generator);
   char **builtin_matches = rl_completion_matches(text, builtin_generator);
   char **external_matches = rl_completion_matches(text, external_command_generator);
   std::vector<char *> all_matches;
+  if (alias_matches && alias_matches[0])
+  {
+    for (int i = 0; alias_matches[i]; ++i)
+      all_matches.push_back(alias_matches[i]);
+    free(alias_matches);
+  }
   if (builtin_matches && builtin_matches[0])
   {
     for (int i = 0; builtin_matches[i]; ++i)
@@ -184,511 +723,789 @@ char **command_completion(const char *text, int start, int end)
   return result;
 }
 
-int main()
-{
-  std::cout << std::unitbuf;
-  std::cerr << std::unitbuf;
-  rl_attempted_completion_function = command_completion;
+// Set by the return builtin; the lists being run stop until the function
+// call or sourced file they belong to is reached
+bool returning = false;
+int function_depth = 0, source_depth = 0;
 
-  int last_appended_history = 0;
-  const char *histfile = std::getenv("HISTFILE");
-  if (histfile && histfile[0] != '\0')
-    read_history(histfile);
+// Set while the command being run is the last this process will run, as in
+// a subshell's child or at the end of a -c string. An external command may
+// then replace the shell by exec rather than run in a child, and a subshell
+// needs no fork of its own.
+bool exits_after = false;
 
-  while (true)
-  {
-    char *input_c = readline("$ ");
-    if (!input_c)
-      break;
-    std::string input(input_c);
-    if (input.find_first_not_of(" \t\n") != std::string::npos)
-      add_history(input_c);
-    free(input_c);
+int run_list(const CommandList &list);
 
-    // Pipeline support: split by '|', handle each stage
-    size_t pipe_pos = input.find('|');
-    if (pipe_pos != std::string::npos)
-    {
-      std::vector<std::string> stages;
-      size_t start = 0;
-      while (true)
-      {
-        size_t pos = input.find('|', start);
-        if (pos == std::string::npos)
-        {
-          stages.push_back(input.substr(start));
-          break;
-        }
-        stages.push_back(input.substr(start, pos - start));
-        start = pos + 1;
-      }
-      std::vector<std::vector<std::string>> pipeline_tokens;
-      for (auto &stage : stages)
+// Points the shell's own stdin/stdout/stderr at io for as long as it lives,
+// so redirections of a function call or source apply to every command run
+class StdioRedirect
+{
+public:
+  explicit StdioRedirect(const Io &io)
+  {
+    int targets[3] = {io.in, io.out, io.err};
+    for (int fd = 0; fd < 3; ++fd)
+      if (targets[fd] != fd)
       {
-        trim(stage);
-        pipeline_tokens.push_back(tokenize(stage));
+        saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+        dup2(targets[fd], fd);
       }
-      int n = pipeline_tokens.size();
-      std::vector<int> pfd(2 * (n - 1));
-      for (int i = 0; i < n - 1; ++i)
-        if (pipe(&pfd[2 * i]) == -1)
-        {
-          std::cerr << "Failed to create pipe\n";
-          return 1;
-        }
-      std::vector<pid_t> pids;
-      for (int i = 0; i < n; ++i)
+  }
+  ~StdioRedirect()
+  {
+    for (int fd = 0; fd < 3; ++fd)
+      if (saved[fd] >= 0)
       {
-        pid_t pid = fork();
-        if (pid == 0)
-        {
-          if (i > 0)
-            dup2(pfd[2 * (i - 1)], 0);
-          if (i < n - 1)
-            dup2(pfd[2 * i + 1], 1);
-          for (int j = 0; j < 2 * (n - 1); ++j)
-            close(pfd[j]);
-          auto &tokens = pipeline_tokens[i];
-          if (!tokens.empty() && tokens[0] == "echo")
-          {
-            for (size_t k = 1; k < tokens.size(); ++k)
-            {
-              if (k > 1)
-                std::cout << " ";
-              std::cout << tokens[k];
-            }
-            std::cout << std::endl;
-            exit(0);
-          }
-          else if (!tokens.empty() && tokens[0] == "type")
-          {
-            if (tokens.size() < 2)
-              std::cout << "type: missing argument" << std::endl;
-            else if (is_builtin(tokens[1]))
-              std::cout << tokens[1] << " is a shell builtin" << std::endl;
-            else
-            {
-              char *path_env = std::getenv("PATH");
-              bool found = false;
-              if (path_env)
-              {
-                std::istringstream path_stream(path_env);
-                std::string dir;
-                while (std::getline(path_stream, dir, ':'))
-                {
-                  std::string full_path = dir + "/" + tokens[1];
-                  struct stat sb;
-                  if (stat(full_path.c_str(), &sb) == 0 && sb.st_mode & S_IXUSR)
-                  {
-                    std::cout << tokens[1] << " is " << full_path << std::endl;
-                    found = true;
-                    break;
-                  }
-                }
-              }
-              if (!found)
-                std::cout << tokens[1] << ": not found" << std::endl;
-            }
-            exit(0);
-          }
-          // External command
-          if (!tokens.empty())
-          {
-            std::vector<char *> argv;
-            for (auto &t : tokens)
-              argv.push_back(const_cast<char *>(t.c_str()));
-            argv.push_back(nullptr);
-            std::string exec_path;
-            if (tokens[0].find('/') == std::string::npos)
-            {
-              char *path_env = std::getenv("PATH");
-              bool found = false;
-              if (path_env)
-              {
-                std::istringstream path_stream(path_env);
-                std::string dir;
-                while (std::getline(path_stream, dir, ':'))
-                {
-                  std::string full_path = dir + "/" + tokens[0];
-                  struct stat sb;
-                  if (stat(full_path.c_str(), &sb) == 0 && sb.st_mode & S_IXUSR)
-                  {
-                    exec_path = full_path;
-                    found = true;
-                    break;
-                  }
-                }
-              }
-              if (!found)
-              {
-                std::cerr << tokens[0] << ": command not found" << std::endl;
-                exit(1);
-              }
-            }
-            else
-              exec_path = tokens[0];
-            execv(exec_path.c_str(), argv.data());
-            std::cerr << "Failed to execute " << exec_path << std::endl;
-            exit(1);
-          }
-          exit(0);
-        }
-        else if (pid > 0)
-          pids.push_back(pid);
-        else
-        {
-          std::cerr << "Failed to fork\n";
-          for (int j = 0; j < 2 * (n - 1); ++j)
-            close(pfd[j]);
-          return 1;
-        }
+        dup2(saved[fd], fd);
+        close(saved[fd]);
       }
-      for (int j = 0; j < 2 * (n - 1); ++j)
-        close(pfd[j]);
-      for (pid_t pid : pids)
+  }
+  StdioRedirect(const StdioRedirect &) = delete;
+  StdioRedirect &operator=(const StdioRedirect &) = delete;
+
+private:
+  int saved[3] = {-1, -1, -1};
+};
+
+// Helper: Run a function's body with args as its positional parameters.
+// Redirections of the call (io) apply to every command in the body.
+int call_function(ShellFunction &f, std::vector<std::string> &args, Io &io)
+{
+  std::string error;
+  const CommandList *body = function_body(f, error);
+  if (!body)
+  {
+    std::cerr << f.name << ": " << error << std::endl;
+    return 2;
+  }
+  StdioRedirect redirect(io);
+  std::vector<std::string> saved_params(args.begin() + 1, args.end());
+  saved_params.swap(positional_params);
+  push_scope();
+  ++function_depth;
+  int status = run_list(*body);
+  returning = false;
+  --function_depth;
+  pop_scope();
+  positional_params.swap(saved_params);
+  return status;
+}
+
+// A sourced file's parsed commands, reused while the file's size and mtime
+// are unchanged
+struct SourceCacheEntry
+{
+  off_t size;
+  timespec mtime;
+  std::shared_ptr<const CommandList> commands;
+};
+
+std::map<std::pair<dev_t, ino_t>, SourceCacheEntry> source_cache;
+
+// Helper: Find the file source should read: a name without a slash is
+// searched for in PATH, then taken relative to the current directory
+std::string find_source_file(const std::string &name)
+{
+  if (name.find('/') != std::string::npos)
+    return name;
+  const char *path_env = std::getenv("PATH");
+  std::istringstream path_stream(path_env ? path_env : "");
+  std::string dir;
+  while (std::getline(path_stream, dir, ':'))
+  {
+    std::string full_path = dir + "/" + name;
+    struct stat sb;
+    if (stat(full_path.c_str(), &sb) == 0 && S_ISREG(sb.st_mode) && access(full_path.c_str(), R_OK) == 0)
+      return full_path;
+  }
+  return name;
+}
+
+// Helper: The parsed commands of the file open on fd, from the cache when
+// the file is unchanged. A file that fails to parse is not cached; the
+// commands before the error are returned with error set.
+std::shared_ptr<const CommandList> load_source(int fd, std::string &error)
+{
+  struct stat sb;
+  bool cacheable = fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode);
+  auto key = std::make_pair(sb.st_dev, sb.st_ino);
+  if (cacheable)
+  {
+    auto it = source_cache.find(key);
+    if (it != source_cache.end() && it->second.size == sb.st_size &&
+        it->second.mtime.tv_sec == sb.st_mtim.tv_sec && it->second.mtime.tv_nsec == sb.st_mtim.tv_nsec)
+      return it->second.commands;
+  }
+  std::string text;
+  if (!read_blocks(fd, [&](const char *p, size_t n) {
+        text.append(p, n);
+        return true;
+      }))
+  {
+    error = strerror(errno);
+    return nullptr;
+  }
+  auto commands = std::make_shared<CommandList>();
+  ParseStatus parsed = parse_script(text, *commands, error);
+  if (parsed == ParseStatus::Incomplete)
+    error = "syntax error: unexpected end of file";
+  else if (parsed == ParseStatus::Ok && cacheable)
+    source_cache[key] = {sb.st_size, sb.st_mtim, commands};
+  return commands;
+}
+
+// Helper: Run the commands in a file in the current shell. With args,
+// they replace the positional parameters while it runs.
+int source_file(const std::string &path, const std::vector<std::string> *args, Io &io)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return builtin_error(io, path, strerror(errno));
+  std::string error;
+  auto commands = load_source(fd, error);
+  close(fd);
+  if (!commands)
+    return builtin_error(io, path, error);
+  std::vector<std::string> saved_params;
+  if (args)
+  {
+    saved_params = *args;
+    saved_params.swap(positional_params);
+  }
+  int status;
+  {
+    StdioRedirect redirect(io);
+    ++source_depth;
+    status = run_list(*commands);
+    returning = false;
+    --source_depth;
+  }
+  if (args)
+    positional_params.swap(saved_params);
+  if (!error.empty())
+    status = builtin_error(io, path, error, 2);
+  return status;
+}
+
+// Builtin: source FILE [ARG...]
+int builtin_source(std::vector<std::string> &args, Io &io)
+{
+  if (args.size() < 2)
+    return builtin_error(io, args[0], "filename argument required", 2);
+  std::vector<std::string> params(args.begin() + 2, args.end());
+  return source_file(find_source_file(args[1]), args.size() > 2 ? &params : nullptr, io);
+}
+
+// Builtin: return [N]
+int builtin_return(std::vector<std::string> &args, Io &io)
+{
+  if (function_depth == 0 && source_depth == 0)
+    return builtin_error(io, "return", "can only `return' from a function or sourced script");
+  int status = last_status;
+  if (args.size() > 1)
+  {
+    char *end;
+    status = strtol(args[1].c_str(), &end, 10) & 0xFF;
+    if (args[1].empty() || *end != '\0')
+      status = builtin_error(io, "return", args[1] + ": numeric argument required", 2);
+  }
+  returning = true;
+  return status;
+}
+
+// Helper: Run one command with its redirections; builtins and functions run
+// in-process. Assignments alone set shell variables; before a command they
+// are exported to that command only.
+int run_command(std::vector<std::string> &tokens)
+{
+  auto assignments = extract_assignments(tokens);
+  Redirections redirs = extract_redirections(tokens);
+  if (tokens.empty())
+    return apply_assignments(assignments) ? 0 : 1;
+  Io io;
+  if (!open_redirections(redirs, io))
+  {
+    close_redirections(io);
+    return 1;
+  }
+  std::vector<std::pair<std::string, std::optional<Variable>>> saved;
+  for (auto &a : assignments)
+  {
+    Variable *old = find_var(a.name);
+    saved.push_back({a.name, old ? std::optional<Variable>(*old) : std::nullopt});
+  }
+  apply_assignments(assignments);
+  for (auto &a : assignments)
+    export_var(a.name);
+  int status;
+  CommandTarget target = resolve_command(tokens[0]);
+  if (target.function)
+    status = call_function(*target.function, tokens, io);
+  else if (target.builtin)
+    status = target.builtin->fn(tokens, io);
+  else if (exits_after)
+  {
+    install_io(io);
+    exec_target(target, tokens);
+  }
+  else
+  {
+    pid_t pid = spawn_command(target, tokens, io);
+    if (pid > 0)
+      status = wait_status(pid);
+    else
+    {
+      std::cerr << "Failed to fork" << std::endl;
+      status = 1;
+    }
+  }
+  for (auto it = saved.rbegin(); it != saved.rend(); ++it)
+    put_var(it->first, it->second ? &*it->second : nullptr);
+  close_redirections(io);
+  return status;
+}
+
+// Helper: Expand a simple command's words; false if an expansion failed
+bool expand_simple(const Command &command, std::vector<std::string> &tokens)
+{
+  expansion_failed = false;
+  tokens = expand_command(command.words);
+  return !expansion_failed;
+}
+
+// A running <(...) or >(...) command and the shell's end of its pipe
+struct Substitution
+{
+  pid_t pid;
+  int fd;
+};
+
+// Substitutions started for the commands now running, oldest first
+std::vector<Substitution> substitutions;
+
+pid_t spawn_script(std::string_view text, const Io &io, const std::vector<int> &close_fds)
+{
+  pid_t pid = fork();
+  if (pid != 0)
+    return pid;
+  restore_child_signals();
+  // Substitutions' ends must not keep their pipes open
+  for (auto &sub : substitutions)
+    close(sub.fd);
+  substitutions.clear();
+  install_io(io);
+  for (int fd : close_fds)
+    close(fd);
+  CommandList list;
+  std::string error;
+  if (parse_script(text, list, error) != ParseStatus::Ok)
+  {
+    std::cerr << (error.empty() ? "syntax error: unexpected end of file" : error) << std::endl;
+    exit(2);
+  }
+  exits_after = true;
+  exit(run_list(list));
+}
+
+std::string substitute_process(std::string_view command, bool output)
+{
+  int pfd[2];
+  if (pipe2(pfd, O_CLOEXEC) == -1)
+  {
+    std::cerr << "Failed to create pipe" << std::endl;
+    expansion_failed = true;
+    return "";
+  }
+  // The command writes to the pipe for <(...) and reads from it for >(...)
+  int ours = output ? pfd[1] : pfd[0], theirs = output ? pfd[0] : pfd[1];
+  Io io;
+  (output ? io.in : io.out) = theirs;
+  pid_t pid = spawn_script(command, io, {ours, theirs});
+  close(theirs);
+  if (pid < 0)
+  {
+    close(ours);
+    std::cerr << "Failed to fork" << std::endl;
+    expansion_failed = true;
+    return "";
+  }
+  // The command using the path may be exec'd, so the shell's end must
+  // survive that
+  fcntl(ours, F_SETFD, 0);
+  substitutions.push_back({pid, ours});
+  return "/dev/fd/" + std::to_string(ours);
+}
+
+// Helper: Close the pipes of the substitutions started since the first
+// `from` and wait for their commands
+void reap_substitutions(size_t from)
+{
+  for (size_t i = from; i < substitutions.size(); ++i)
+    close(substitutions[i].fd);
+  for (size_t i = from; i < substitutions.size(); ++i)
+    wait_status(substitutions[i].pid);
+  substitutions.resize(from);
+}
+
+// Helper: Expand and open the redirections that follow a group or
+// subshell; false, with io left unchanged, if one fails
+bool open_compound_redirections(const Command &command, Io &io)
+{
+  std::vector<std::string> tokens;
+  if (!expand_simple(command, tokens))
+    return false;
+  Redirections redirs = extract_redirections(tokens);
+  if (!tokens.empty())
+  {
+    std::cerr << tokens[0] << ": ambiguous redirect" << std::endl;
+    return false;
+  }
+  if (!open_redirections(redirs, io))
+  {
+    close_redirections(io);
+    return false;
+  }
+  return true;
+}
+
+// Helper: Run a subshell's body in a child, so nothing it changes reaches
+// this shell
+int run_subshell(const Command &command, const Io &io)
+{
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    std::cerr << "Failed to fork" << std::endl;
+    return 1;
+  }
+  if (pid == 0)
+  {
+    restore_child_signals();
+    install_io(io);
+    exits_after = true;
+    exit(run_list(*command.body));
+  }
+  return wait_status(pid);
+}
+
+// Helper: Run a command that is not part of a larger pipeline. A group's
+// redirections are opened once and point the shell's own stdio at the
+// targets while its body runs.
+int run_single(const Command &command)
+{
+  if (command.kind == Command::FunctionDef)
+  {
+    define_function(command.function);
+    return 0;
+  }
+  // Process substitutions in the words live until the command is done
+  size_t first_substitution = substitutions.size();
+  int status = 1;
+  if (command.kind == Command::Group || command.kind == Command::Subshell)
+  {
+    Io io;
+    if (open_compound_redirections(command, io))
+    {
+      // A process about to exit can run a subshell's body itself
+      if (command.kind == Command::Subshell && !exits_after)
+        status = run_subshell(command, io);
+      else
       {
-        int status;
-        waitpid(pid, &status, 0);
+        StdioRedirect redirect(io);
+        status = run_list(*command.body);
       }
+      close_redirections(io);
+    }
+  }
+  else
+  {
+    std::vector<std::string> tokens;
+    if (expand_simple(command, tokens))
+      status = run_command(tokens);
+  }
+  reap_substitutions(first_substitution);
+  return status;
+}
+
+// Helper: Whether a pipeline stage can run on a thread of a fused run: a
+// simple command naming, literally, a builtin that does all its I/O through
+// the stream helpers. Words whose expansion could change the shell
+// (${v:=...}) or start processes (<(...)) rule it out, since a fused run's
+// words are expanded in the shell itself.
+bool fusable(const Command &command)
+{
+  static const std::unordered_set<std::string> streaming = {"echo", "cat", "tee", "pv",   "wc",  "grep",
+                                                            "sort", "head", "tail", "cut", "seq", "yes"};
+  if (command.kind != Command::Simple || command.words.empty() || !streaming.count(command.words[0]))
+    return false;
+  for (auto &word : command.words)
+    if ((word.find("${") != std::string::npos && word.find('=') != std::string::npos) ||
+        word.find("<(") != std::string::npos || word.find(">(") != std::string::npos)
+      return false;
+  CommandTarget target = resolve_command(command.words[0]);
+  return target.builtin && !target.function;
+}
+
+// Helper: Run pipeline stages that are all fusable builtins in this process,
+// each on a thread of its own (the last on this one), joined by rings
+// instead of pipes. io is the first stage's input and the last's output.
+// False, with nothing run, if the rings could not be set up.
+bool run_fused(const std::vector<const Command *> &stages, const Io &io, int &status)
+{
+  size_t n = stages.size();
+  // Each ring is stood for by an eventfd: cheap to make, and a read or
+  // write that bypassed the ring would fail on it instead of losing data
+  std::vector<std::unique_ptr<ByteRing>> rings;
+  std::vector<int> ring_fds;
+  for (size_t i = 0; i + 1 < n; ++i)
+  {
+    int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd < 0)
+    {
+      for (int f : ring_fds)
+        close(f);
+      return false;
+    }
+    ring_fds.push_back(fd);
+    rings.push_back(std::make_unique<ByteRing>());
+  }
+
+  struct Stage
+  {
+    std::vector<std::string> tokens;
+    Io io, opened;
+    bool ok = false;
+    BuiltinFn fn = nullptr;
+    int status = 1;
+  };
+  std::vector<Stage> run(n);
+  for (size_t i = 0; i < n; ++i)
+  {
+    Stage &stage = run[i];
+    if (!expand_simple(*stages[i], stage.tokens))
+      continue;
+    Redirections redirs = extract_redirections(stage.tokens);
+    if (!open_redirections(redirs, stage.opened))
+    {
+      close_redirections(stage.opened);
       continue;
     }
+    stage.io = stage.opened;
+    if (redirs.in_file.empty())
+      stage.io.in = i > 0 ? ring_fds[i - 1] : io.in;
+    if (redirs.out_file.empty())
+      stage.io.out = i + 1 < n ? ring_fds[i] : io.out;
+    if (redirs.err_file.empty())
+      stage.io.err = io.err;
+    stage.fn = resolve_command(stage.tokens[0]).builtin->fn;
+    stage.ok = true;
+  }
+  for (size_t i = 0; i + 1 < n; ++i)
+    attach_ring(ring_fds[i], rings[i].get());
+  // A stage passing one ring on to the next stops when the next stage's
+  // reader goes
+  for (size_t i = 1; i + 1 < n; ++i)
+    if (run[i].ok && run[i].io.in == ring_fds[i - 1] && run[i].io.out == ring_fds[i])
+      rings[i]->set_upstream(rings[i - 1].get());
+
+  auto run_stage = [&](size_t i) {
+    Stage &stage = run[i];
+    ByteRing *in = i > 0 ? rings[i - 1].get() : nullptr, *out = i + 1 < n ? rings[i].get() : nullptr;
+    // A ring the stage will not use is closed up front, so its other side
+    // sees end of input or a gone reader at once
+    if (in && (!stage.ok || stage.io.in != ring_fds[i - 1]))
+      in->close_reader();
+    if (out && (!stage.ok || stage.io.out != ring_fds[i]))
+      out->close_writer();
+    if (stage.ok)
+      stage.status = stage.fn(stage.tokens, stage.io);
+    if (out)
+      out->close_writer();
+    if (in)
+      in->close_reader();
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i + 1 < n; ++i)
+    threads.emplace_back(run_stage, i);
+  run_stage(n - 1);
+  for (auto &thread : threads)
+    thread.join();
 
-    // Parse command and arguments
-    std::istringstream iss(input);
-    std::string cmd;
-    iss >> cmd;
+  for (size_t i = 0; i + 1 < n; ++i)
+  {
+    detach_ring(ring_fds[i]);
+    close(ring_fds[i]);
+  }
+  for (auto &stage : run)
+    close_redirections(stage.opened);
+  status = run.back().status;
+  return true;
+}
+
+// Helper: Run a pipeline, one process per stage. Builtin stages run in the
+// forked child directly on the pipe fds, without an exec; each stage's words
+// are expanded in its own process. A run of two or more fusable builtins is
+// one segment instead, fused on rings in a single process: this one, if
+// the whole pipeline is such a run, and otherwise a child with real pipes
+// only where the run meets other stages.
+int run_pipeline(const Pipeline &pipeline)
+{
+  int n = pipeline.commands.size();
+  if (n == 1)
+    return run_single(pipeline.commands[0]);
+  // Segments of stages, each [first, last)
+  std::vector<std::pair<int, int>> segments;
+  for (int i = 0; i < n;)
+  {
+    int j = i + 1;
+    if (fusable(pipeline.commands[i]))
+      while (j < n && fusable(pipeline.commands[j]))
+        ++j;
+    segments.push_back({i, j});
+    i = j;
+  }
+  auto stages_of = [&](std::pair<int, int> segment) {
+    std::vector<const Command *> stages;
+    for (int i = segment.first; i < segment.second; ++i)
+      stages.push_back(&pipeline.commands[i]);
+    return stages;
+  };
+  int status;
+  if (segments.size() == 1 && run_fused(stages_of(segments[0]), Io{}, status))
+    return status;
 
-    // Builtin: exit
-    if (cmd == "exit")
+  int m = segments.size();
+  std::vector<int> pfd(2 * (m - 1));
+  for (int i = 0; i < m - 1; ++i)
+    if (pipe(&pfd[2 * i]) == -1)
     {
-      std::string arg;
-      iss >> arg;
-      if (histfile && histfile[0] != '\0')
-        write_history(histfile);
-      exit(arg.empty() ? 0 : std::stoi(arg));
+      std::cerr << "Failed to create pipe\n";
+      for (int j = 0; j < 2 * i; ++j)
+        close(pfd[j]);
+      return 1;
     }
-    // Builtin: echo
-    else if (cmd == "echo")
+  std::vector<pid_t> pids;
+  for (int i = 0; i < m; ++i)
+  {
+    pid_t pid = fork();
+    if (pid == 0)
     {
-      std::vector<std::string> tokens = tokenize(input.substr(input.find("echo") + 4));
-      std::string redirect_file, redirect_stderr_file;
-      bool append_mode = false, append_stderr_mode = false;
-      // Handle output redirection
-      for (size_t i = 0; i < tokens.size();)
-      {
-        if ((tokens[i] == ">" || tokens[i] == "1>") && i + 1 < tokens.size())
-        {
-          redirect_file = tokens[i + 1];
-          append_mode = false;
-          tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
-        }
-        else if ((tokens[i] == ">>" || tokens[i] == "1>>") && i + 1 < tokens.size())
-        {
-          redirect_file = tokens[i + 1];
-          append_mode = true;
-          tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
-        }
-        else if (tokens[i] == "2>" && i + 1 < tokens.size())
-        {
-          redirect_stderr_file = tokens[i + 1];
-          append_stderr_mode = false;
-          tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
-        }
-        else if (tokens[i] == "2>>" && i + 1 < tokens.size())
-        {
-          redirect_stderr_file = tokens[i + 1];
-          append_stderr_mode = true;
-          tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
-        }
-        else
-          ++i;
-      }
-      int saved_stdout = -1, fd = -1;
-      if (!redirect_file.empty())
-      {
-        int flags = O_WRONLY | O_CREAT | (append_mode ? O_APPEND : O_TRUNC);
-        fd = open(redirect_file.c_str(), flags, 0644);
-        if (fd < 0)
-        {
-          std::cerr << "Failed to open file for redirection: " << redirect_file << std::endl;
-          return 1;
-        }
-        saved_stdout = dup(1);
-        dup2(fd, 1);
-      }
-      int saved_stderr = -1, fd_err = -1;
-      if (!redirect_stderr_file.empty())
+      restore_child_signals();
+      if (i > 0)
+        dup2(pfd[2 * (i - 1)], 0);
+      if (i < m - 1)
+        dup2(pfd[2 * i + 1], 1);
+      for (int j = 0; j < 2 * (m - 1); ++j)
+        close(pfd[j]);
+      if (segments[i].second - segments[i].first > 1)
       {
-        int flags = O_WRONLY | O_CREAT | (append_stderr_mode ? O_APPEND : O_TRUNC);
-        fd_err = open(redirect_stderr_file.c_str(), flags, 0644);
-        if (fd_err < 0)
+        if (!run_fused(stages_of(segments[i]), Io{}, status))
         {
-          std::cerr << "Failed to open file for stderr redirection: " << redirect_stderr_file << std::endl;
-          if (fd != -1)
-          {
-            fflush(stdout);
-            dup2(saved_stdout, 1);
-            close(fd);
-            close(saved_stdout);
-          }
-          return 1;
+          std::cerr << "Failed to set up fused pipeline stages" << std::endl;
+          exit(1);
         }
-        saved_stderr = dup(2);
-        dup2(fd_err, 2);
+        exit(status);
       }
-      for (size_t i = 0; i < tokens.size(); ++i)
+      const Command &command = pipeline.commands[segments[i].first];
+      exits_after = true;
+      if (command.kind != Command::Simple)
+        exit(run_single(command));
+      std::vector<std::string> tokens;
+      if (!expand_simple(command, tokens))
+        exit(1);
+      auto assignments = extract_assignments(tokens);
+      Redirections redirs = extract_redirections(tokens);
+      Io io;
+      if (!open_redirections(redirs, io))
+        exit(1);
+      if (tokens.empty())
+        exit(0);
+      apply_assignments(assignments);
+      for (auto &a : assignments)
+        export_var(a.name);
+      CommandTarget target = resolve_command(tokens[0]);
+      // Nothing else reads a pipe or file this stage was given as input, so
+      // a builtin may read ahead on it
+      if (target.builtin && !target.function)
       {
-        if (i > 0)
-          std::cout << " ";
-        std::cout << tokens[i];
+        if (i > 0 || io.in != 0)
+          set_input_owned(io.in, true);
+        int status = target.builtin->fn(tokens, io);
+        // A >(...) command sees end of input only once its pipe is closed
+        close_redirections(io);
+        reap_substitutions(0);
+        exit(status);
       }
-      std::cout << std::endl;
-      if (fd != -1)
+      install_io(io);
+      if (target.function)
       {
-        fflush(stdout);
-        dup2(saved_stdout, 1);
-        close(fd);
-        close(saved_stdout);
-      }
-      if (fd_err != -1)
-      {
-        fflush(stderr);
-        dup2(saved_stderr, 2);
-        close(fd_err);
-        close(saved_stderr);
+        Io std_io;
+        exit(call_function(*target.function, tokens, std_io));
       }
+      exec_target(target, tokens);
     }
-    // Builtin: type
-    else if (cmd == "type")
+    else if (pid > 0)
+      pids.push_back(pid);
+    else
     {
-      std::string arg;
-      iss >> arg;
-      if (is_builtin(arg))
-        std::cout << arg << " is a shell builtin" << std::endl;
-      else if (!arg.empty())
-      {
-        char *path_env = std::getenv("PATH");
-        bool found = false;
-        if (path_env)
-        {
-          std::istringstream path_stream(path_env);
-          std::string dir;
-          while (std::getline(path_stream, dir, ':'))
-          {
-            std::string full_path = dir + "/" + arg;
-            struct stat sb;
-            if (stat(full_path.c_str(), &sb) == 0 && sb.st_mode & S_IXUSR)
-            {
-              std::cout << arg << " is " << full_path << std::endl;
-              found = true;
-              break;
-            }
-          }
-        }
-        if (!found)
-          std::cout << arg << ": not found" << std::endl;
-      }
-      else
-        std::cout << "type: missing argument" << std::endl;
+      std::cerr << "Failed to fork\n";
+      break;
     }
-    // Builtin: history
-    else if (cmd == "history")
+  }
+  for (int j = 0; j < 2 * (m - 1); ++j)
+    close(pfd[j]);
+  status = 1;
+  for (pid_t pid : pids)
+    status = wait_status(pid);
+  return status;
+}
+
+// Helper: Run a command list, stopping early for return. A pipeline after
+// && or || is skipped, keeping $?, when the status so far says so.
+int run_list(const CommandList &list)
+{
+  bool list_exits_after = exits_after;
+  for (size_t i = 0; i < list.pipelines.size(); ++i)
+  {
+    const Pipeline &pipeline = list.pipelines[i];
+    if ((pipeline.condition == Pipeline::IfSuccess && last_status != 0) ||
+        (pipeline.condition == Pipeline::IfFailure && last_status == 0))
+      continue;
+    exits_after = list_exits_after && i + 1 == list.pipelines.size() && !pipeline.negated;
+    int status = run_pipeline(pipeline);
+    last_status = pipeline.negated ? status == 0 : status;
+    if (returning)
+      break;
+  }
+  exits_after = list_exits_after;
+  return last_status;
+}
+
+// Helper: Run commands read from a non-terminal fd, a line at a time, until
+// end of input. Lines are taken with read_record, so commands reading the
+// same fd see exactly the input after their own line.
+int run_input(int fd)
+{
+  std::string pending, line;
+  while (true)
+  {
+    int result = read_record(fd, '\n', SIZE_MAX, -1, line);
+    if (result < 0 || (result == 0 && line.empty()))
+      break;
+    pending += line;
+    CommandList list;
+    std::string error;
+    ParseStatus parsed = parse_script(pending, list, error);
+    if (parsed == ParseStatus::Incomplete)
     {
-      std::string arg1, arg2;
-      iss >> arg1 >> arg2;
-      if (arg1 == "-r" && !arg2.empty())
-      {
-        read_history(arg2.c_str());
-        continue;
-      }
-      if (arg1 == "-w" && !arg2.empty())
-      {
-        write_history(arg2.c_str());
-        last_appended_history = history_length;
-        continue;
-      }
-      if (arg1 == "-a" && !arg2.empty())
-      {
-        HIST_ENTRY **hist_list = history_list();
-        if (hist_list)
-        {
-          FILE *f = fopen(arg2.c_str(), "a");
-          if (f)
-          {
-            int total = 0;
-            while (hist_list[total])
-              ++total;
-            for (int i = last_appended_history; i < total; ++i)
-              fprintf(f, "%s\n", hist_list[i]->line);
-            fclose(f);
-            last_appended_history = total;
-          }
-        }
-        continue;
-      }
-      int n = -1;
-      if (!arg1.empty() && arg1 != "-r" && arg1 != "-w")
-      {
-        try
-        {
-          n = std::stoi(arg1);
-        }
-        catch (...)
-        {
-          n = -1;
-        }
-      }
-      HIST_ENTRY **hist_list = history_list();
-      if (hist_list)
-      {
-        int total = 0;
-        while (hist_list[total])
-          ++total;
-        int start = (n > 0 && n < total) ? total - n : 0;
-        for (int i = start; i < total; ++i)
-          std::cout << "    " << (i + 1) << "  " << hist_list[i]->line << std::endl;
-      }
+      pending += '\n';
+      continue;
     }
-    // Builtin: pwd
-    else if (cmd == "pwd")
+    pending.clear();
+    if (parsed == ParseStatus::Error)
     {
-      char cwd[4096];
-      if (getcwd(cwd, sizeof(cwd)))
-        std::cout << cwd << std::endl;
-      else
-        std::cerr << "pwd: error retrieving current directory" << std::endl;
+      std::cerr << error << std::endl;
+      last_status = 2;
+      continue;
     }
-    // Builtin: cd
-    else if (cmd == "cd")
+    run_list(list);
+  }
+  if (!pending.empty())
+  {
+    std::cerr << "syntax error: unexpected end of file" << std::endl;
+    last_status = 2;
+  }
+  return last_status;
+}
+
+int main(int argc, char **argv)
+{
+  std::cout << std::unitbuf;
+  std::cerr << std::unitbuf;
+  import_environment();
+  struct sigaction ignore = {};
+  ignore.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &ignore, &inherited_sigpipe);
+
+  // shell -c STRING [NAME [ARG...]] runs the commands in STRING, the last
+  // of them in place of the shell
+  if (argc > 1 && std::string(argv[1]) == "-c")
+  {
+    if (argc < 3)
     {
-      std::string path;
-      iss >> path;
-      if (path.empty())
-        continue;
-      if (path == "~")
-      {
-        const char *home = std::getenv("HOME");
-        if (home && chdir(home) != 0)
-          std::cerr << "cd: " << path << ": No such file or directory" << std::endl;
-        continue;
-      }
-      if (chdir(path.c_str()) != 0)
-        std::cerr << "cd: " << path << ": No such file or directory" << std::endl;
+      std::cerr << "-c: option requires an argument" << std::endl;
+      return 2;
     }
-    // External command
-    else
+    if (argc > 3)
+      shell_name = argv[3];
+    if (argc > 4)
+      positional_params.assign(argv + 4, argv + argc);
+    CommandList list;
+    std::string error;
+    ParseStatus parsed = parse_script(argv[2], list, error);
+    if (parsed != ParseStatus::Ok)
     {
-      std::vector<std::string> tokens = tokenize(input);
-      if (tokens.empty())
-        continue;
-      // Handle output redirection
-      std::string redirect_file, redirect_stderr_file;
-      bool append_mode = false, append_stderr_mode = false;
-      for (size_t i = 0; i < tokens.size();)
-      {
-        if ((tokens[i] == ">" || tokens[i] == "1>") && i + 1 < tokens.size())
-        {
-          redirect_file = tokens[i + 1];
-          append_mode = false;
-          tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
-        }
-        else if ((tokens[i] == ">>" || tokens[i] == "1>>") && i + 1 < tokens.size())
-        {
-          redirect_file = tokens[i + 1];
-          append_mode = true;
-          tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
-        }
-        else if (tokens[i] == "2>" && i + 1 < tokens.size())
-        {
-          redirect_stderr_file = tokens[i + 1];
-          append_stderr_mode = false;
-          tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
-        }
-        else if (tokens[i] == "2>>" && i + 1 < tokens.size())
-        {
-          redirect_stderr_file = tokens[i + 1];
-          append_stderr_mode = true;
-          tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
-        }
-        else
-          ++i;
-      }
-      pid_t pid = fork();
-      if (pid == 0)
-      {
-        std::vector<char *> argv;
-        for (auto &t : tokens)
-          argv.push_back(const_cast<char *>(t.c_str()));
-        argv.push_back(nullptr);
-        std::string exec_path;
-        if (tokens[0].find('/') == std::string::npos)
-        {
-          char *path_env = std::getenv("PATH");
-          bool found = false;
-          if (path_env)
-          {
-            std::istringstream path_stream(path_env);
-            std::string dir;
-            while (std::getline(path_stream, dir, ':'))
-            {
-              std::string full_path = dir + "/" + tokens[0];
-              struct stat sb;
-              if (stat(full_path.c_str(), &sb) == 0 && sb.st_mode & S_IXUSR)
-              {
-                exec_path = full_path;
-                found = true;
-                break;
-              }
-            }
-          }
-          if (!found)
-          {
-            std::cerr << tokens[0] << ": command not found" << std::endl;
-            exit(1);
-          }
-        }
-        else
-          exec_path = tokens[0];
-        if (!redirect_file.empty())
-        {
-          int flags = O_WRONLY | O_CREAT | (append_mode ? O_APPEND : O_TRUNC);
-          int fd = open(redirect_file.c_str(), flags, 0644);
-          if (fd < 0)
-          {
-            std::cerr << "Failed to open file for redirection: " << redirect_file << std::endl;
-            exit(1);
-          }
-          dup2(fd, 1);
-          close(fd);
-        }
-        if (!redirect_stderr_file.empty())
-        {
-          int flags = O_WRONLY | O_CREAT | (append_stderr_mode ? O_APPEND : O_TRUNC);
-          int fd_err = open(redirect_stderr_file.c_str(), flags, 0644);
-          if (fd_err < 0)
-          {
-            std::cerr << "Failed to open file for stderr redirection: " << redirect_stderr_file << std::endl;
-            exit(1);
-          }
-          dup2(fd_err, 2);
-          close(fd_err);
-        }
-        execv(exec_path.c_str(), argv.data());
-        std::cerr << "Failed to execute " << exec_path << std::endl;
-        exit(1);
-      }
-      else if (pid > 0)
-      {
-        int status;
-        waitpid(pid, &status, 0);
-      }
-      else
-        std::cerr << "Failed to fork" << std::endl;
+      std::cerr << (parsed == ParseStatus::Incomplete ? "syntax error: unexpected end of file" : error) << std::endl;
+      return 2;
     }
+    exits_after = true;
+    return run_list(list);
+  }
+
+  // shell FILE [ARG...] runs a script; input that is not a terminal is read
+  // as one
+  if (argc > 1)
+  {
+    std::vector<std::string> args(argv + 2, argv + argc);
+    Io io;
+    shell_name = argv[1];
+    return source_file(argv[1], &args, io);
+  }
+  if (!isatty(0))
+    return run_input(0);
+
+  interactive = true;
+  rl_attempted_completion_function = command_completion;
+  histfile = std::getenv("HISTFILE");
+  if (histfile && histfile[0] != '\0')
+    read_history(histfile);
+
+  // Lines accumulate until they parse as complete commands, so a group or
+  // function definition may span several
+  std::string pending;
+  while (true)
+  {
+    char *input_c = readline(pending.empty() ? "$ " : "> ");
+    if (!input_c)
+    {
+      if (!pending.empty())
+        std::cerr << "syntax error: unexpected end of file" << std::endl;
+      break;
+    }
+    pending += input_c;
+    free(input_c);
+    CommandList list;
+    std::string error;
+    ParseStatus parsed = parse_script(pending, list, error);
+    if (parsed == ParseStatus::Incomplete)
+    {
+      pending += '\n';
+      continue;
+    }
+    if (pending.find_first_not_of(" \t\n") != std::string::npos)
+      add_history(pending.c_str());
+    pending.clear();
+    if (parsed == ParseStatus::Error)
+    {
+      std::cerr << error << std::endl;
+      last_status = 2;
+      continue;
+    }
+    run_list(list);
   }
 
   // Save history to HISTFILE on exit
   if (histfile && histfile[0] != '\0')
     write_history(histfile);
   return 0;
-}
\ No newline at end of file
+}
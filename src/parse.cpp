@@ -0,0 +1,537 @@
+#include "parse.hpp"
+#include "aliases.hpp"
+#include "expand.hpp"
+#include "vars.hpp"
+
+#include <algorithm>
+#include <deque>
+
+// Splits source text into tokens. Words keep their quotes; ${...}, quoted
+// strings, <(...) and >(...) and the parenthesized list of NAME=(...) never
+// end a word.
+class Lexer
+{
+public:
+  explicit Lexer(std::string_view src) : src(src) {}
+
+  LexToken next();
+  // Cleared once the text ends inside a quote or an unfinished construct
+  bool complete = true;
+
+private:
+  void read_word(std::string &word);
+  // Index just past the quoted string or bracketed construct at pos, or
+  // the end of the text (clearing complete) if it is never closed
+  size_t skip_double_quote(size_t pos);
+  size_t skip_closing(size_t pos);
+
+  std::string_view src;
+  size_t pos = 0;
+};
+
+// Helper: Whether word, as read so far, is the NAME= (or NAME+=, NAME[SUB]=)
+// that begins an assignment
+static bool assignment_prefix(std::string_view word)
+{
+  if (word.empty() || word.back() != '=')
+    return false;
+  word.remove_suffix(1);
+  if (!word.empty() && word.back() == '+')
+    word.remove_suffix(1);
+  size_t bracket = word.find('[');
+  if (bracket != std::string_view::npos && !word.empty() && word.back() == ']')
+    word = word.substr(0, bracket);
+  return valid_name(word);
+}
+
+size_t Lexer::skip_closing(size_t open)
+{
+  size_t close = find_closing(src, open);
+  if (close == std::string_view::npos)
+  {
+    complete = false;
+    return src.size();
+  }
+  return close + 1;
+}
+
+size_t Lexer::skip_double_quote(size_t i)
+{
+  for (++i; i < src.size(); ++i)
+  {
+    if (src[i] == '"')
+      return i + 1;
+    if (src[i] == '\\')
+      ++i;
+    else if (src[i] == '$' && i + 1 < src.size() && src[i + 1] == '{')
+      i = skip_closing(i + 1) - 1;
+  }
+  complete = false;
+  return src.size();
+}
+
+void Lexer::read_word(std::string &word)
+{
+  while (pos < src.size())
+  {
+    char c = src[pos];
+    size_t end;
+    if (c == ' ' || c == '\t' || c == '\n' || c == ';' || c == '|' || c == ')')
+      break;
+    if (c == '(')
+    {
+      // NAME=(...) is one word, elements and all, as is <(...) or >(...)
+      bool substitution = !word.empty() && (word.back() == '<' || word.back() == '>');
+      if (!substitution && !assignment_prefix(word))
+        break;
+      end = skip_closing(pos);
+    }
+    else if (c == '&')
+    {
+      // The & of >&, <& and &> belongs to a redirection
+      bool redirect = (!word.empty() && (word.back() == '>' || word.back() == '<')) ||
+                      (pos + 1 < src.size() && src[pos + 1] == '>');
+      if (!redirect)
+        break;
+      end = pos + 1;
+    }
+    else if (c == '\\')
+    {
+      if (pos + 1 >= src.size())
+      {
+        complete = false;
+        ++pos;
+        return;
+      }
+      // A backslash-newline joins the lines
+      if (src[pos + 1] == '\n')
+      {
+        pos += 2;
+        continue;
+      }
+      end = pos + 2;
+    }
+    else if (c == '\'')
+    {
+      end = src.find('\'', pos + 1);
+      if (end == std::string_view::npos)
+      {
+        complete = false;
+        end = src.size();
+      }
+      else
+        ++end;
+    }
+    else if (c == '"')
+      end = skip_double_quote(pos);
+    else if (c == '$' && pos + 1 < src.size() && src[pos + 1] == '{')
+      end = skip_closing(pos + 1);
+    else
+      end = pos + 1;
+    word.append(src.substr(pos, end - pos));
+    pos = end;
+  }
+}
+
+LexToken Lexer::next()
+{
+  LexToken tok;
+  while (pos < src.size())
+  {
+    char c = src[pos];
+    if (c == ' ' || c == '\t')
+      ++pos;
+    else if (c == '\\' && pos + 1 < src.size() && src[pos + 1] == '\n')
+      pos += 2;
+    else if (c == '#')
+    {
+      size_t nl = src.find('\n', pos);
+      pos = nl == std::string_view::npos ? src.size() : nl;
+    }
+    else
+      break;
+  }
+  tok.start = pos;
+  if (pos >= src.size())
+  {
+    tok.end = pos;
+    return tok;
+  }
+  auto op = [&](LexToken::Kind kind, size_t len) {
+    tok.kind = kind;
+    tok.text = src.substr(pos, len);
+    pos += len;
+  };
+  char c = src[pos];
+  bool doubled = pos + 1 < src.size() && src[pos + 1] == c;
+  if (c == '\n')
+    op(LexToken::Newline, 1);
+  else if (c == ';')
+    op(LexToken::Semi, 1);
+  else if (c == '|')
+    doubled ? op(LexToken::OrIf, 2) : op(LexToken::Pipe, 1);
+  else if (c == '&' && !(pos + 1 < src.size() && src[pos + 1] == '>'))
+    doubled ? op(LexToken::AndIf, 2) : op(LexToken::Background, 1);
+  else if (c == '(')
+    op(LexToken::LParen, 1);
+  else if (c == ')')
+    op(LexToken::RParen, 1);
+  else
+  {
+    tok.kind = LexToken::Word;
+    read_word(tok.text);
+  }
+  tok.end = pos;
+  return tok;
+}
+
+std::vector<LexToken> lex_all(std::string_view text, bool &complete)
+{
+  Lexer lexer(text);
+  std::vector<LexToken> tokens;
+  for (LexToken tok = lexer.next(); tok.kind != LexToken::End; tok = lexer.next())
+    tokens.push_back(std::move(tok));
+  complete = lexer.complete;
+  return tokens;
+}
+
+// Helper: Whether a word may name a function
+static bool valid_function_name(std::string_view s)
+{
+  return !s.empty() && s.find_first_of("'\"\\$`=") == std::string_view::npos;
+}
+
+// Recursive descent over the token stream. Aliases are expanded here, by
+// putting the alias's stored tokens back in front of the stream.
+class Parser
+{
+public:
+  explicit Parser(std::string_view src) : lexer(src), src(src) {}
+
+  ParseStatus parse(CommandList &out, std::string &error);
+
+private:
+  const LexToken &peek();
+  LexToken take();
+  bool is_word(const LexToken &tok, const char *text) { return tok.kind == LexToken::Word && tok.text == text; }
+  bool fail(const std::string &message);
+  bool unexpected(const LexToken &tok);
+  bool incomplete();
+  void skip_newlines();
+  // Replaces an alias at the front of the stream; true if it did
+  bool expand_alias();
+
+  // What ends a list: the end of the text, or the } or ) closing it
+  enum class Until
+  {
+    End,
+    Brace,
+    Paren
+  };
+  bool parse_list(CommandList &out, Until until);
+  bool parse_pipeline(Pipeline &out);
+  bool parse_command(Command &out);
+  bool parse_group(Command &out);
+  bool parse_subshell(Command &out);
+  bool parse_redirections(Command &out);
+  bool parse_function(const std::string &name, Command &out);
+
+  Lexer lexer;
+  std::string_view src;
+  std::deque<LexToken> queue;
+  ParseStatus status = ParseStatus::Ok;
+  std::string message;
+};
+
+const LexToken &Parser::peek()
+{
+  if (queue.empty())
+    queue.push_back(lexer.next());
+  return queue.front();
+}
+
+LexToken Parser::take()
+{
+  peek();
+  LexToken tok = std::move(queue.front());
+  queue.pop_front();
+  return tok;
+}
+
+bool Parser::fail(const std::string &text)
+{
+  status = ParseStatus::Error;
+  message = text;
+  return false;
+}
+
+bool Parser::unexpected(const LexToken &tok)
+{
+  if (tok.kind == LexToken::End)
+    return incomplete();
+  return fail("syntax error near unexpected token `" + tok.text + "'");
+}
+
+bool Parser::incomplete()
+{
+  status = ParseStatus::Incomplete;
+  return false;
+}
+
+void Parser::skip_newlines()
+{
+  while (peek().kind == LexToken::Newline)
+    take();
+}
+
+bool Parser::expand_alias()
+{
+  const LexToken &tok = peek();
+  if (tok.kind != LexToken::Word || !valid_alias_name(tok.text))
+    return false;
+  const Alias *alias = find_alias(tok.text);
+  if (!alias)
+    return false;
+  for (auto &name : tok.aliases)
+    if (name == tok.text)
+      return false;
+  LexToken word = take();
+  std::vector<std::string> chain = word.aliases;
+  chain.push_back(word.text);
+  for (auto it = alias->tokens.rbegin(); it != alias->tokens.rend(); ++it)
+  {
+    queue.push_front(*it);
+    queue.front().aliases = chain;
+  }
+  if (alias->chains)
+  {
+    // Mark the token after the alias's own
+    if (queue.size() == alias->tokens.size())
+      queue.push_back(lexer.next());
+    queue[alias->tokens.size()].alias_candidate = true;
+  }
+  return true;
+}
+
+bool Parser::parse_list(CommandList &out, Until until)
+{
+  while (true)
+  {
+    while (peek().kind == LexToken::Newline || peek().kind == LexToken::Semi)
+      take();
+    const LexToken &tok = peek();
+    if (tok.kind == LexToken::End)
+      return until == Until::End || incomplete();
+    if (is_word(tok, "}") && until == Until::Brace)
+      return true;
+    if (tok.kind == LexToken::RParen)
+      return until == Until::Paren ? true : unexpected(tok);
+    Pipeline pipeline;
+    if (!parse_pipeline(pipeline))
+      return false;
+    out.pipelines.push_back(std::move(pipeline));
+    // && and || bind the pipelines around them; a newline may follow either
+    while (peek().kind == LexToken::AndIf || peek().kind == LexToken::OrIf)
+    {
+      Pipeline next;
+      next.condition = take().kind == LexToken::AndIf ? Pipeline::IfSuccess : Pipeline::IfFailure;
+      skip_newlines();
+      if (!parse_pipeline(next))
+        return false;
+      out.pipelines.push_back(std::move(next));
+    }
+    const LexToken &sep = peek();
+    if (sep.kind == LexToken::Background)
+      return fail("background jobs (&) are not supported");
+    // A group may close straight after a nested group or subshell
+    bool closes = (until == Until::Brace && is_word(sep, "}")) || (until == Until::Paren && sep.kind == LexToken::RParen);
+    if (sep.kind != LexToken::Semi && sep.kind != LexToken::Newline && sep.kind != LexToken::End && !closes)
+      return unexpected(sep);
+  }
+}
+
+bool Parser::parse_pipeline(Pipeline &out)
+{
+  if (is_word(peek(), "!"))
+  {
+    take();
+    out.negated = true;
+  }
+  while (true)
+  {
+    Command command;
+    if (!parse_command(command))
+      return false;
+    out.commands.push_back(std::move(command));
+    if (peek().kind != LexToken::Pipe)
+      return true;
+    take();
+    skip_newlines();
+  }
+}
+
+bool Parser::parse_command(Command &out)
+{
+  while (expand_alias())
+    ;
+  const LexToken &tok = peek();
+  if (is_word(tok, "{"))
+    return parse_group(out) && parse_redirections(out);
+  if (tok.kind == LexToken::LParen)
+    return parse_subshell(out) && parse_redirections(out);
+  if (is_word(tok, "function"))
+  {
+    take();
+    LexToken name = take();
+    if (name.kind != LexToken::Word || !valid_function_name(name.text))
+      return unexpected(name);
+    if (peek().kind == LexToken::LParen)
+    {
+      take();
+      if (peek().kind != LexToken::RParen)
+        return unexpected(peek());
+      take();
+    }
+    return parse_function(name.text, out);
+  }
+  if (tok.kind != LexToken::Word || is_word(tok, "}"))
+    return unexpected(tok);
+
+  out.kind = Command::Simple;
+  out.words.push_back(take().text);
+  if (peek().kind == LexToken::LParen && out.words.size() == 1)
+  {
+    take();
+    if (peek().kind != LexToken::RParen)
+      return unexpected(peek());
+    take();
+    if (!valid_function_name(out.words[0]))
+      return fail("`" + out.words[0] + "': not a valid identifier");
+    std::string name = std::move(out.words[0]);
+    out.words.clear();
+    return parse_function(name, out);
+  }
+  while (true)
+  {
+    // An alias ending in a blank makes the next word a candidate too
+    while (peek().alias_candidate && expand_alias())
+      ;
+    if (peek().kind != LexToken::Word)
+      return true;
+    out.words.push_back(take().text);
+  }
+}
+
+bool Parser::parse_group(Command &out)
+{
+  take();
+  out.kind = Command::Group;
+  out.body = std::make_shared<CommandList>();
+  if (!parse_list(*out.body, Until::Brace))
+    return false;
+  take();
+  return true;
+}
+
+bool Parser::parse_subshell(Command &out)
+{
+  take();
+  out.kind = Command::Subshell;
+  out.body = std::make_shared<CommandList>();
+  if (!parse_list(*out.body, Until::Paren))
+    return false;
+  take();
+  return true;
+}
+
+// Only redirections may follow a group or subshell; each operator takes the
+// next word as its target
+bool Parser::parse_redirections(Command &out)
+{
+  static const char *const operators[] = {"<", "0<", ">", "1>", ">>", "1>>", "2>", "2>>"};
+  while (peek().kind == LexToken::Word)
+  {
+    const std::string &op = peek().text;
+    if (std::find(std::begin(operators), std::end(operators), op) == std::end(operators))
+      return true;
+    out.words.push_back(take().text);
+    if (peek().kind == LexToken::End || peek().kind == LexToken::Newline)
+      return fail("syntax error near unexpected token `newline'");
+    if (peek().kind != LexToken::Word)
+      return unexpected(peek());
+    out.words.push_back(take().text);
+  }
+  return true;
+}
+
+// The body's extent is found by counting the braces that stand as words
+// where a command could start, without building any commands
+bool Parser::parse_function(const std::string &name, Command &out)
+{
+  skip_newlines();
+  const LexToken &open = peek();
+  if (!is_word(open, "{"))
+    return open.kind == LexToken::End ? incomplete() : fail("function bodies must be { ...; } groups");
+  out.kind = Command::FunctionDef;
+  out.function = std::make_shared<ShellFunction>();
+  out.function->name = name;
+  // A body that came out of an alias has no source text to keep
+  if (!open.aliases.empty() || queue.size() > 1)
+  {
+    Command group;
+    if (!parse_group(group))
+      return false;
+    out.function->body = std::make_shared<CommandList>();
+    out.function->body->pipelines.emplace_back().commands.push_back(std::move(group));
+    return true;
+  }
+  size_t start = take().start;
+  int depth = 1;
+  bool command_position = true;
+  while (depth > 0)
+  {
+    LexToken tok = lexer.next();
+    if (tok.kind == LexToken::End)
+      return incomplete();
+    if (tok.kind != LexToken::Word)
+      command_position = true;
+    else if (command_position && (tok.text == "{" || tok.text == "}"))
+      depth += tok.text == "{" ? 1 : -1;
+    else
+      command_position = false;
+    if (depth == 0)
+      out.function->text = src.substr(start, tok.end - start);
+  }
+  return lexer.complete || incomplete();
+}
+
+ParseStatus Parser::parse(CommandList &out, std::string &error)
+{
+  bool ok = parse_list(out, Until::End);
+  if (ok && !lexer.complete)
+    return ParseStatus::Incomplete;
+  if (!ok)
+    error = message;
+  return ok ? ParseStatus::Ok : status;
+}
+
+ParseStatus parse_script(std::string_view text, CommandList &out, std::string &error)
+{
+  Parser parser(text);
+  return parser.parse(out, error);
+}
+
+const CommandList *function_body(ShellFunction &f, std::string &error)
+{
+  if (f.body)
+    return f.body.get();
+  auto body = std::make_shared<CommandList>();
+  if (parse_script(f.text, *body, error) != ParseStatus::Ok)
+  {
+    if (error.empty())
+      error = f.name + ": incomplete function body";
+    return nullptr;
+  }
+  f.body = body;
+  return body.get();
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A lexical token: a word, kept exactly as written (quotes and all) so it
+// is expanded afresh each time it runs, or an operator
+struct LexToken
+{
+  enum Kind
+  {
+    Word,
+    Pipe,       // |
+    Semi,       // ;
+    Newline,
+    AndIf,      // &&
+    OrIf,       // ||
+    Background, // &
+    LParen,
+    RParen,
+    End
+  };
+  Kind kind = End;
+  std::string text;
+  size_t start = 0, end = 0; // offsets in the source text
+  // Aliases this token came from; they are not expanded again inside it
+  std::vector<std::string> aliases;
+  // Follows an alias whose value ends in a blank, so it is checked for an
+  // alias too, wherever it falls in the command
+  bool alias_candidate = false;
+};
+
+// Helper: Split text into tokens, as alias definitions are stored. complete
+// is cleared if the text ends inside a quote or ${...}.
+std::vector<LexToken> lex_all(std::string_view text, bool &complete);
+
+struct CommandList;
+struct ShellFunction;
+
+// A parsed command: a simple command (its words, unexpanded), a { list; }
+// group, a ( list ) subshell, or a function definition. The words of a
+// group or subshell are the redirections that follow it.
+struct Command
+{
+  enum Kind
+  {
+    Simple,
+    Group,
+    Subshell,
+    FunctionDef
+  };
+  Kind kind = Simple;
+  std::vector<std::string> words;
+  std::shared_ptr<CommandList> body;
+  std::shared_ptr<ShellFunction> function;
+};
+
+// Commands joined by |, with the status inverted if it began with !
+struct Pipeline
+{
+  // Whether it runs after the pipeline before it unconditionally (; or a
+  // newline), only if that succeeded (&&) or only if it failed (||)
+  enum Condition
+  {
+    Always,
+    IfSuccess,
+    IfFailure
+  };
+  Condition condition = Always;
+  bool negated = false;
+  std::vector<Command> commands;
+};
+
+// Pipelines run one after another, each as its condition allows
+struct CommandList
+{
+  std::vector<Pipeline> pipelines;
+};
+
+// A shell function. Only the extent of its body is found when it is
+// defined; the body is parsed the first time it is called, and that
+// parsed form serves every later call.
+struct ShellFunction
+{
+  std::string name;
+  std::string text; // the body's source, braces included
+  std::shared_ptr<CommandList> body;
+};
+
+enum class ParseStatus
+{
+  Ok,
+  Incomplete, // the text ends inside a quote, group, subshell or pipeline
+  Error
+};
+
+// Helper: Parse a script or command line into out; on Error, error holds a
+// message
+ParseStatus parse_script(std::string_view text, CommandList &out, std::string &error);
+
+// Helper: A function's parsed body, parsing it on the first call; null with
+// error set if it does not parse
+const CommandList *function_body(ShellFunction &f, std::string &error);
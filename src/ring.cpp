@@ -0,0 +1,140 @@
+#include "ring.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+ByteRing::ByteRing(size_t size) : capacity(std::bit_ceil(size)), mask(capacity - 1)
+{
+  buf.reset(new char[capacity]);
+}
+
+bool ByteRing::write(const char *p, size_t len)
+{
+  while (len > 0)
+  {
+    uint32_t seen = space_event.load(std::memory_order_acquire);
+    if (reader_done.load(std::memory_order_acquire))
+    {
+      errno = EPIPE;
+      return false;
+    }
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t room = capacity - (h - tail.load(std::memory_order_acquire));
+    if (room == 0)
+    {
+      space_event.wait(seen, std::memory_order_acquire);
+      continue;
+    }
+    size_t n = std::min(len, room);
+    size_t at = h & mask, first = std::min(n, capacity - at);
+    memcpy(buf.get() + at, p, first);
+    memcpy(buf.get(), p + first, n - first);
+    head.store(h + n, std::memory_order_release);
+    data_event.fetch_add(1, std::memory_order_release);
+    data_event.notify_one();
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+void ByteRing::close_writer()
+{
+  writer_done.store(true, std::memory_order_release);
+  data_event.fetch_add(1, std::memory_order_release);
+  data_event.notify_one();
+}
+
+std::string_view ByteRing::peek()
+{
+  while (true)
+  {
+    uint32_t seen = data_event.load(std::memory_order_acquire);
+    if (reader_done.load(std::memory_order_acquire))
+      return {};
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    if (h != t)
+    {
+      size_t at = t & mask;
+      return std::string_view(buf.get() + at, std::min(h - t, capacity - at));
+    }
+    // The writer's last data is stored before it closes, so look again
+    if (writer_done.load(std::memory_order_acquire))
+    {
+      if (head.load(std::memory_order_acquire) != t)
+        continue;
+      return {};
+    }
+    data_event.wait(seen, std::memory_order_acquire);
+  }
+}
+
+void ByteRing::consume(size_t n)
+{
+  tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+  space_event.fetch_add(1, std::memory_order_release);
+  space_event.notify_one();
+}
+
+bool ByteRing::ready() const
+{
+  return head.load(std::memory_order_acquire) != tail.load(std::memory_order_relaxed) ||
+         writer_done.load(std::memory_order_acquire) || reader_done.load(std::memory_order_acquire);
+}
+
+size_t ByteRing::read(char *p, size_t len)
+{
+  size_t total = 0;
+  // Both pieces of a wrapped run are taken in one call
+  for (int piece = 0; piece < 2 && total < len; ++piece)
+  {
+    if (piece == 1 && head.load(std::memory_order_acquire) == tail.load(std::memory_order_relaxed))
+      break;
+    std::string_view data = peek();
+    if (data.empty())
+      break;
+    size_t n = std::min(len - total, data.size());
+    memcpy(p + total, data.data(), n);
+    consume(n);
+    total += n;
+  }
+  return total;
+}
+
+void ByteRing::close_reader()
+{
+  if (reader_done.exchange(true, std::memory_order_acq_rel))
+    return;
+  space_event.fetch_add(1, std::memory_order_release);
+  space_event.notify_one();
+  // Wake a consumer waiting in peek(), if the ring was closed under it
+  data_event.fetch_add(1, std::memory_order_release);
+  data_event.notify_one();
+  if (upstream)
+    upstream->close_reader();
+}
+
+// Indexed by fd; only changed while no stage threads run
+static std::vector<ByteRing *> rings;
+
+void attach_ring(int fd, ByteRing *ring)
+{
+  if ((size_t)fd >= rings.size())
+    rings.resize(fd + 1, nullptr);
+  rings[fd] = ring;
+}
+
+void detach_ring(int fd)
+{
+  if ((size_t)fd < rings.size())
+    rings[fd] = nullptr;
+}
+
+ByteRing *ring_for(int fd)
+{
+  return fd >= 0 && (size_t)fd < rings.size() ? rings[fd] : nullptr;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+// A fixed-size single-producer, single-consumer byte queue joining two
+// builtins that run on threads of one process. Each side owns one index,
+// so neither takes a lock; a side that finds the ring full or empty sleeps
+// on an event counter the other side bumps.
+class ByteRing
+{
+public:
+  // size is rounded up to a power of two
+  explicit ByteRing(size_t size = 1 << 20);
+  ByteRing(const ByteRing &) = delete;
+  ByteRing &operator=(const ByteRing &) = delete;
+
+  // Producer: queue all of p, waiting for room; false with errno EPIPE if
+  // the consumer has gone
+  bool write(const char *p, size_t len);
+  // Producer: no more data will come
+  void close_writer();
+
+  // Consumer: copy out up to len bytes, waiting for some; 0 at end of input
+  size_t read(char *p, size_t len);
+  // Consumer: the queued bytes that lie contiguously in the ring, waiting
+  // for some; empty at end of input or once the reader is closed.
+  // consume() releases them.
+  std::string_view peek();
+  void consume(size_t n);
+  // Consumer: whether peek() would return without waiting
+  bool ready() const;
+  // No more data will be read; the producer's writes fail. Callable from
+  // any thread: a ring closed under its consumer reads as ended.
+  void close_reader();
+  bool reader_closed() const { return reader_done.load(std::memory_order_acquire); }
+  // ring is the producer's own input. Closing this reader closes that one
+  // too, so every stage upstream of a reader that has gone stops, as a
+  // pipeline does on SIGPIPE, even one that never checks its writes. Set
+  // before either side starts.
+  void set_upstream(ByteRing *ring) { upstream = ring; }
+
+private:
+  // Left uninitialized, so a ring that carries little touches few pages
+  std::unique_ptr<char[]> buf;
+  size_t capacity, mask;
+  // Total bytes ever written and read; each is stored by one side only
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+  // Bumped when data arrives or space frees up, for the other side to wait on
+  alignas(64) std::atomic<uint32_t> data_event{0};
+  alignas(64) std::atomic<uint32_t> space_event{0};
+  std::atomic<bool> writer_done{false}, reader_done{false};
+  ByteRing *upstream = nullptr;
+};
+
+// Helper: Make fd stand for ring, so the stream helpers (Io::read and
+// Io::write, read_blocks, read_line_blocks, transfer_fd) use the ring
+// instead. fd itself is never read or written. Rings are attached before
+// the threads using them start and detached after they finish.
+void attach_ring(int fd, ByteRing *ring);
+
+// Helper: Undo attach_ring
+void detach_ring(int fd);
+
+// Helper: The ring fd stands for, or null
+ByteRing *ring_for(int fd);
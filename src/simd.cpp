@@ -0,0 +1,462 @@
+#include "simd.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static inline bool is_space_byte(unsigned char b)
+{
+  return b == ' ' || (unsigned char)(b - '\t') <= '\r' - '\t';
+}
+
+static size_t count_byte_scalar(const char *p, size_t len, char c)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < len; ++i)
+    n += p[i] == c;
+  return n;
+}
+
+static size_t count_words_scalar(const char *p, size_t len, bool &prev_space)
+{
+  size_t n = 0;
+  bool space = prev_space;
+  for (size_t i = 0; i < len; ++i)
+  {
+    bool s = is_space_byte(p[i]);
+    n += space && !s;
+    space = s;
+  }
+  prev_space = space;
+  return n;
+}
+
+static size_t count_utf8_chars_scalar(const char *p, size_t len)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < len; ++i)
+    n += (p[i] & 0xC0) != 0x80;
+  return n;
+}
+
+static inline char fold_byte(char c)
+{
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// Helper: Compare len bytes, folding ASCII case in a (b is already lowercase)
+static bool equal_folded(const char *a, const char *b, size_t len)
+{
+  for (size_t i = 0; i < len; ++i)
+    if (fold_byte(a[i]) != b[i])
+      return false;
+  return true;
+}
+
+static bool equal_at(const char *a, const char *b, size_t len, bool fold)
+{
+  return fold ? equal_folded(a, b, len) : memcmp(a, b, len) == 0;
+}
+
+static const char *find_literal_scalar(const char *hay, size_t len, const char *needle, size_t needle_len, bool fold)
+{
+  if (!fold)
+    return static_cast<const char *>(memmem(hay, len, needle, needle_len));
+  for (size_t i = 0; i + needle_len <= len; ++i)
+    if (fold_byte(hay[i]) == needle[0] && equal_folded(hay + i, needle, needle_len))
+      return hay + i;
+  return nullptr;
+}
+
+static const char *find_nth_byte_scalar(const char *p, size_t len, char c, size_t &n)
+{
+  const char *end = p + len;
+  while (const char *hit = static_cast<const char *>(memchr(p, c, end - p)))
+  {
+    if (--n == 0)
+      return hit;
+    p = hit + 1;
+  }
+  return nullptr;
+}
+
+static const char *rfind_nth_byte_scalar(const char *p, size_t len, char c, size_t &n)
+{
+  while (const char *hit = static_cast<const char *>(memrchr(p, c, len)))
+  {
+    if (--n == 0)
+      return hit;
+    len = hit - p;
+  }
+  return nullptr;
+}
+
+static size_t index_bytes_scalar(const char *p, size_t len, char a, char b, uint32_t *out, size_t base)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < len; ++i)
+  {
+    out[n] = base + i;
+    n += p[i] == a || p[i] == b;
+  }
+  return n;
+}
+
+#if defined(__x86_64__)
+
+static inline char upper_byte(char c)
+{
+  return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+static const char *find_literal_sse2(const char *hay, size_t len, const char *needle, size_t needle_len, bool fold)
+{
+  const __m128i first = _mm_set1_epi8(needle[0]), last = _mm_set1_epi8(needle[needle_len - 1]);
+  const __m128i first_alt = _mm_set1_epi8(fold ? upper_byte(needle[0]) : needle[0]);
+  const __m128i last_alt = _mm_set1_epi8(fold ? upper_byte(needle[needle_len - 1]) : needle[needle_len - 1]);
+  size_t i = 0;
+  for (; i + needle_len - 1 + 16 <= len; i += 16)
+  {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(hay + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(hay + i + needle_len - 1));
+    __m128i eq_a = _mm_or_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(a, first_alt));
+    __m128i eq_b = _mm_or_si128(_mm_cmpeq_epi8(b, last), _mm_cmpeq_epi8(b, last_alt));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(eq_a, eq_b));
+    while (mask)
+    {
+      unsigned bit = __builtin_ctz(mask);
+      if (equal_at(hay + i + bit, needle, needle_len, fold))
+        return hay + i + bit;
+      mask &= mask - 1;
+    }
+  }
+  return find_literal_scalar(hay + i, len - i, needle, needle_len, fold);
+}
+
+__attribute__((target("avx2"))) static const char *find_literal_avx2(const char *hay, size_t len, const char *needle,
+                                                                      size_t needle_len, bool fold)
+{
+  const __m256i first = _mm256_set1_epi8(needle[0]), last = _mm256_set1_epi8(needle[needle_len - 1]);
+  const __m256i first_alt = _mm256_set1_epi8(fold ? upper_byte(needle[0]) : needle[0]);
+  const __m256i last_alt = _mm256_set1_epi8(fold ? upper_byte(needle[needle_len - 1]) : needle[needle_len - 1]);
+  size_t i = 0;
+  for (; i + needle_len - 1 + 32 <= len; i += 32)
+  {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(hay + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(hay + i + needle_len - 1));
+    __m256i eq_a = _mm256_or_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(a, first_alt));
+    __m256i eq_b = _mm256_or_si256(_mm256_cmpeq_epi8(b, last), _mm256_cmpeq_epi8(b, last_alt));
+    unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(eq_a, eq_b));
+    while (mask)
+    {
+      unsigned bit = __builtin_ctz(mask);
+      if (equal_at(hay + i + bit, needle, needle_len, fold))
+        return hay + i + bit;
+      mask &= mask - 1;
+    }
+  }
+  return find_literal_scalar(hay + i, len - i, needle, needle_len, fold);
+}
+
+static size_t count_byte_sse2(const char *p, size_t len, char c)
+{
+  const __m128i needle = _mm_set1_epi8(c);
+  size_t n = 0, i = 0;
+  for (; i + 16 <= len; i += 16)
+  {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+  }
+  return n + count_byte_scalar(p + i, len - i, c);
+}
+
+__attribute__((target("avx2"))) static size_t count_byte_avx2(const char *p, size_t len, char c)
+{
+  const __m256i needle = _mm256_set1_epi8(c);
+  size_t n = 0, i = 0;
+  // Accumulate per-lane match counts in bytes and fold them every 255
+  // iterations, which is cheaper than a popcount per vector
+  while (i + 32 <= len)
+  {
+    __m256i acc = _mm256_setzero_si256();
+    size_t block_end = i + 32 * 255 < len ? i + 32 * 255 : len;
+    for (; i + 32 <= block_end; i += 32)
+    {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+      acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, needle));
+    }
+    __m256i sums = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+    n += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) + _mm256_extract_epi64(sums, 2) +
+         _mm256_extract_epi64(sums, 3);
+  }
+  return n + count_byte_scalar(p + i, len - i, c);
+}
+
+static size_t count_words_sse2(const char *p, size_t len, bool &prev_space)
+{
+  const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), span = _mm_set1_epi8('\r' - '\t');
+  size_t n = 0, i = 0;
+  unsigned carry = prev_space;
+  for (; i + 16 <= len; i += 16)
+  {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    __m128i shifted = _mm_sub_epi8(v, tab);
+    __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(shifted, span), shifted);
+    unsigned ws = _mm_movemask_epi8(_mm_or_si128(ctrl, _mm_cmpeq_epi8(v, space)));
+    // A word starts at each non-space byte whose predecessor is a space
+    unsigned starts = ~ws & ((ws << 1) | carry) & 0xFFFF;
+    n += __builtin_popcount(starts);
+    carry = ws >> 15;
+  }
+  prev_space = carry;
+  return n + count_words_scalar(p + i, len - i, prev_space);
+}
+
+__attribute__((target("avx2"))) static size_t count_words_avx2(const char *p, size_t len, bool &prev_space)
+{
+  const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t'), span = _mm256_set1_epi8('\r' - '\t');
+  size_t n = 0, i = 0;
+  uint64_t carry = prev_space;
+  for (; i + 32 <= len; i += 32)
+  {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    __m256i shifted = _mm256_sub_epi8(v, tab);
+    __m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, span), shifted);
+    uint64_t ws = uint32_t(_mm256_movemask_epi8(_mm256_or_si256(ctrl, _mm256_cmpeq_epi8(v, space))));
+    uint64_t starts = ~ws & ((ws << 1) | carry) & 0xFFFFFFFFu;
+    n += __builtin_popcountll(starts);
+    carry = ws >> 31;
+  }
+  prev_space = carry;
+  return n + count_words_scalar(p + i, len - i, prev_space);
+}
+
+static size_t count_utf8_chars_sse2(const char *p, size_t len)
+{
+  // Continuation bytes are 0x80..0xBF, i.e. signed values below -64
+  const __m128i limit = _mm_set1_epi8(-65);
+  size_t n = 0, i = 0;
+  for (; i + 16 <= len; i += 16)
+  {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(v, limit)));
+  }
+  return n + count_utf8_chars_scalar(p + i, len - i);
+}
+
+__attribute__((target("avx2"))) static size_t count_utf8_chars_avx2(const char *p, size_t len)
+{
+  const __m256i limit = _mm256_set1_epi8(-65);
+  size_t n = 0, i = 0;
+  for (; i + 32 <= len; i += 32)
+  {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    n += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, limit)));
+  }
+  return n + count_utf8_chars_scalar(p + i, len - i);
+}
+
+// The n-th search kernels popcount a match mask per vector and only look
+// for the exact bit in the vector where the count runs out
+static const char *find_nth_byte_sse2(const char *p, size_t len, char c, size_t &n)
+{
+  const __m128i needle = _mm_set1_epi8(c);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16)
+  {
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i)), needle));
+    size_t hits = __builtin_popcount(mask);
+    if (hits >= n)
+    {
+      while (--n)
+        mask &= mask - 1;
+      return p + i + __builtin_ctz(mask);
+    }
+    n -= hits;
+  }
+  return find_nth_byte_scalar(p + i, len - i, c, n);
+}
+
+__attribute__((target("avx2"))) static const char *find_nth_byte_avx2(const char *p, size_t len, char c, size_t &n)
+{
+  const __m256i needle = _mm256_set1_epi8(c);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32)
+  {
+    unsigned mask =
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i)), needle));
+    size_t hits = __builtin_popcount(mask);
+    if (hits >= n)
+    {
+      while (--n)
+        mask &= mask - 1;
+      return p + i + __builtin_ctz(mask);
+    }
+    n -= hits;
+  }
+  return find_nth_byte_scalar(p + i, len - i, c, n);
+}
+
+static const char *rfind_nth_byte_sse2(const char *p, size_t len, char c, size_t &n)
+{
+  const __m128i needle = _mm_set1_epi8(c);
+  size_t i = len;
+  for (; i >= 16; i -= 16)
+  {
+    unsigned mask =
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i - 16)), needle));
+    size_t hits = __builtin_popcount(mask);
+    if (hits >= n)
+    {
+      while (--n)
+        mask ^= 1u << (31 - __builtin_clz(mask));
+      return p + i - 16 + (31 - __builtin_clz(mask));
+    }
+    n -= hits;
+  }
+  return rfind_nth_byte_scalar(p, i, c, n);
+}
+
+__attribute__((target("avx2"))) static const char *rfind_nth_byte_avx2(const char *p, size_t len, char c, size_t &n)
+{
+  const __m256i needle = _mm256_set1_epi8(c);
+  size_t i = len;
+  for (; i >= 32; i -= 32)
+  {
+    unsigned mask = _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i - 32)), needle));
+    size_t hits = __builtin_popcount(mask);
+    if (hits >= n)
+    {
+      while (--n)
+        mask ^= 1u << (31 - __builtin_clz(mask));
+      return p + i - 32 + (31 - __builtin_clz(mask));
+    }
+    n -= hits;
+  }
+  return rfind_nth_byte_scalar(p, i, c, n);
+}
+
+static size_t index_bytes_sse2(const char *p, size_t len, char a, char b, uint32_t *out)
+{
+  const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+  size_t n = 0, i = 0;
+  for (; i + 16 <= len; i += 16)
+  {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+    for (; mask; mask &= mask - 1)
+      out[n++] = i + __builtin_ctz(mask);
+  }
+  return n + index_bytes_scalar(p + i, len - i, a, b, out + n, i);
+}
+
+__attribute__((target("avx2"))) static size_t index_bytes_avx2(const char *p, size_t len, char a, char b, uint32_t *out)
+{
+  const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+  size_t n = 0, i = 0;
+  for (; i + 32 <= len; i += 32)
+  {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+    for (; mask; mask &= mask - 1)
+      out[n++] = i + __builtin_ctz(mask);
+  }
+  return n + index_bytes_scalar(p + i, len - i, a, b, out + n, i);
+}
+
+static bool detect_avx2()
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+static const bool have_avx2 = detect_avx2();
+
+size_t count_byte(const char *p, size_t len, char c)
+{
+  return have_avx2 ? count_byte_avx2(p, len, c) : count_byte_sse2(p, len, c);
+}
+
+size_t count_words(const char *p, size_t len, bool &prev_space)
+{
+  return have_avx2 ? count_words_avx2(p, len, prev_space) : count_words_sse2(p, len, prev_space);
+}
+
+size_t count_utf8_chars(const char *p, size_t len)
+{
+  return have_avx2 ? count_utf8_chars_avx2(p, len) : count_utf8_chars_sse2(p, len);
+}
+
+const char *find_literal(const char *hay, size_t len, const char *needle, size_t needle_len, bool fold)
+{
+  if (needle_len == 0)
+    return hay;
+  if (needle_len > len)
+    return nullptr;
+  if (needle_len == 1 && !fold)
+    return static_cast<const char *>(memchr(hay, needle[0], len));
+  return have_avx2 ? find_literal_avx2(hay, len, needle, needle_len, fold)
+                   : find_literal_sse2(hay, len, needle, needle_len, fold);
+}
+
+const char *find_nth_byte(const char *p, size_t len, char c, size_t &n)
+{
+  return have_avx2 ? find_nth_byte_avx2(p, len, c, n) : find_nth_byte_sse2(p, len, c, n);
+}
+
+const char *rfind_nth_byte(const char *p, size_t len, char c, size_t &n)
+{
+  return have_avx2 ? rfind_nth_byte_avx2(p, len, c, n) : rfind_nth_byte_sse2(p, len, c, n);
+}
+
+size_t index_bytes(const char *p, size_t len, char a, char b, uint32_t *out)
+{
+  return have_avx2 ? index_bytes_avx2(p, len, a, b, out) : index_bytes_sse2(p, len, a, b, out);
+}
+
+#else
+
+size_t count_byte(const char *p, size_t len, char c)
+{
+  return count_byte_scalar(p, len, c);
+}
+
+size_t count_words(const char *p, size_t len, bool &prev_space)
+{
+  return count_words_scalar(p, len, prev_space);
+}
+
+size_t count_utf8_chars(const char *p, size_t len)
+{
+  return count_utf8_chars_scalar(p, len);
+}
+
+const char *find_literal(const char *hay, size_t len, const char *needle, size_t needle_len, bool fold)
+{
+  if (needle_len == 0)
+    return hay;
+  if (needle_len > len)
+    return nullptr;
+  return find_literal_scalar(hay, len, needle, needle_len, fold);
+}
+
+const char *find_nth_byte(const char *p, size_t len, char c, size_t &n)
+{
+  return find_nth_byte_scalar(p, len, c, n);
+}
+
+const char *rfind_nth_byte(const char *p, size_t len, char c, size_t &n)
+{
+  return rfind_nth_byte_scalar(p, len, c, n);
+}
+
+size_t index_bytes(const char *p, size_t len, char a, char b, uint32_t *out)
+{
+  return index_bytes_scalar(p, len, a, b, out, 0);
+}
+
+#endif
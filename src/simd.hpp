@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Byte-scanning kernels shared by the text builtins. Each picks an AVX2 or
+// SSE2 implementation at runtime on x86-64 and falls back to scalar code
+// elsewhere.
+
+// Helper: Count occurrences of byte c in [p, p + len)
+size_t count_byte(const char *p, size_t len, char c);
+
+// Helper: Count words (maximal runs of non-whitespace, C locale isspace) in
+// [p, p + len). prev_space carries whether the byte before p was whitespace
+// across calls and should start out true.
+size_t count_words(const char *p, size_t len, bool &prev_space);
+
+// Helper: Count UTF-8 characters, i.e. bytes that are not continuation bytes
+size_t count_utf8_chars(const char *p, size_t len);
+
+// Helper: Find the first occurrence of needle in [hay, hay + len). With fold
+// set the needle must be lowercase and ASCII letters match either case.
+// Candidates are found by comparing the first and last needle bytes a
+// vector at a time, then verified. Returns nullptr when there is none.
+const char *find_literal(const char *hay, size_t len, const char *needle, size_t needle_len, bool fold);
+
+// Helper: Find the n-th occurrence (n >= 1) of byte c in [p, p + len).
+// When there are fewer, returns nullptr and subtracts the occurrences seen
+// from n, so the search can continue in the next block.
+const char *find_nth_byte(const char *p, size_t len, char c, size_t &n);
+
+// Helper: Like find_nth_byte, but counting backwards from p + len
+const char *rfind_nth_byte(const char *p, size_t len, char c, size_t &n);
+
+// Helper: Write the offset of every byte in [p, p + len) equal to a or b to
+// out, which must have room for len entries, and return how many there are
+size_t index_bytes(const char *p, size_t len, char a, char b, uint32_t *out);
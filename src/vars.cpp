@@ -0,0 +1,386 @@
+#include "vars.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+extern char **environ;
+
+int last_status = 0;
+
+std::vector<std::string> positional_params;
+std::string shell_name = program_invocation_short_name;
+
+static std::unordered_map<std::string, Variable> variables;
+
+// Per function call: the variables made local, with what to restore
+static std::vector<std::vector<std::pair<std::string, std::optional<Variable>>>> scopes;
+
+void import_environment()
+{
+  for (char **env = environ; *env; ++env)
+  {
+    const char *eq = strchr(*env, '=');
+    if (!eq)
+      continue;
+    Variable &var = variables[std::string(*env, eq - *env)];
+    var.value = eq + 1;
+    var.exported = true;
+  }
+}
+
+bool valid_name(std::string_view s)
+{
+  if (s.empty() || !(isalpha((unsigned char)s[0]) || s[0] == '_'))
+    return false;
+  for (char c : s)
+    if (!(isalnum((unsigned char)c) || c == '_'))
+      return false;
+  return true;
+}
+
+Variable *find_var(const std::string &name)
+{
+  auto it = variables.find(name);
+  return it == variables.end() ? nullptr : &it->second;
+}
+
+std::vector<std::string> var_names()
+{
+  std::vector<std::string> names;
+  names.reserve(variables.size());
+  for (auto &entry : variables)
+    names.push_back(entry.first);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+std::optional<std::string_view> get_var(const std::string &name)
+{
+  Variable *var = find_var(name);
+  if (!var)
+    return std::nullopt;
+  if (var->kind == Variable::Scalar)
+    return var->value;
+  if (var->kind == Variable::Assoc)
+  {
+    const std::string *value = var->assoc.get("0");
+    return value ? std::optional<std::string_view>(*value) : std::nullopt;
+  }
+  const ArrayElement *e = var->elements.get(0);
+  return e ? std::optional<std::string_view>(element_text(*e)) : std::nullopt;
+}
+
+void set_var(const std::string &name, std::string value)
+{
+  Variable &var = variables[name];
+  var.kind = Variable::Scalar;
+  var.elements = IndexedArray();
+  var.assoc = AssocArray();
+  var.value = std::move(value);
+  if (var.exported)
+    setenv(name.c_str(), var.value.c_str(), 1);
+}
+
+void set_array(const std::string &name, IndexedArray elements)
+{
+  Variable &var = variables[name];
+  var.kind = Variable::Indexed;
+  var.value.clear();
+  var.assoc = AssocArray();
+  var.elements = std::move(elements);
+}
+
+std::string declare_array(const std::string &name, Variable::Kind kind)
+{
+  Variable *existing = find_var(name);
+  if (existing && existing->kind == kind)
+    return "";
+  if (existing && existing->kind != Variable::Scalar)
+    return name + ": cannot convert " + (existing->kind == Variable::Assoc ? "associative to indexed" : "indexed to associative") + " array";
+  // A scalar's value becomes element 0
+  Variable &var = variables[name];
+  var.kind = kind;
+  if (existing && kind == Variable::Indexed)
+    var.elements.set(0, std::move(var.value));
+  else if (existing)
+    var.assoc.set("0", std::move(var.value));
+  var.value.clear();
+  return "";
+}
+
+bool parse_index(std::string_view subscript, const IndexedArray &array, size_t &index)
+{
+  // Only plain numbers and variable names are understood, not arithmetic
+  std::string text(subscript);
+  if (valid_name(text))
+  {
+    auto value = get_var(text);
+    text = value ? std::string(*value) : "0";
+  }
+  if (text.empty())
+    return false;
+  char *end;
+  long long n = strtoll(text.c_str(), &end, 10);
+  if (*end != '\0')
+    return false;
+  if (n < 0)
+  {
+    if ((size_t)-n > array.end_index())
+      return false;
+    n += array.end_index();
+  }
+  index = n;
+  return true;
+}
+
+bool parse_assignment(const std::string &word, Assignment &out)
+{
+  size_t eq = word.find('=');
+  if (eq == std::string::npos || eq == 0)
+    return false;
+  size_t name_end = eq;
+  out = Assignment{};
+  if (word[name_end - 1] == '+')
+  {
+    out.append = true;
+    --name_end;
+  }
+  if (name_end > 0 && word[name_end - 1] == ']')
+  {
+    size_t open = word.find('[');
+    if (open == std::string::npos || open >= name_end)
+      return false;
+    out.subscript = word.substr(open + 1, name_end - open - 2);
+    out.has_subscript = true;
+    name_end = open;
+  }
+  out.name = word.substr(0, name_end);
+  if (!valid_name(out.name))
+    return false;
+  // NAME=( arrives as "NAME=(" NUL, then each element followed by a NUL
+  if (!out.has_subscript && word.size() >= eq + 3 && word[eq + 1] == '(' && word[eq + 2] == '\0')
+  {
+    out.compound = true;
+    for (size_t start = eq + 3; start < word.size();)
+    {
+      size_t nul = word.find('\0', start);
+      out.elements.push_back(word.substr(start, nul - start));
+      start = nul + 1;
+    }
+    return true;
+  }
+  out.value = word.substr(eq + 1);
+  return true;
+}
+
+std::string apply_assignment(const Assignment &a)
+{
+  Variable *var = find_var(a.name);
+  if (a.compound)
+  {
+    if (!var || var->kind == Variable::Scalar)
+    {
+      std::string old = var && a.append ? var->value : "";
+      set_array(a.name, IndexedArray());
+      var = find_var(a.name);
+      if (!old.empty())
+        var->elements.set(0, std::move(old));
+    }
+    if (var->kind == Variable::Assoc)
+    {
+      if (!a.append)
+        var->assoc = AssocArray();
+      // [KEY]=VALUE elements, or alternating keys and values
+      for (size_t k = 0; k < a.elements.size(); ++k)
+      {
+        const std::string &e = a.elements[k];
+        size_t close = e.find("]=");
+        if (!e.empty() && e[0] == '[' && close != std::string::npos)
+          var->assoc.set(std::string_view(e).substr(1, close - 1), e.substr(close + 2));
+        else if (k + 1 < a.elements.size())
+        {
+          var->assoc.set(e, a.elements[k + 1]);
+          ++k;
+        }
+        else
+          var->assoc.set(e, "");
+      }
+      return "";
+    }
+    if (!a.append)
+      var->elements = IndexedArray();
+    size_t next = var->elements.end_index();
+    for (auto &e : a.elements)
+    {
+      size_t close = e.find("]=");
+      if (!e.empty() && e[0] == '[' && close != std::string::npos)
+      {
+        if (!parse_index(std::string_view(e).substr(1, close - 1), var->elements, next))
+          return e.substr(0, close + 1) + ": bad array subscript";
+        var->elements.set(next++, e.substr(close + 2));
+      }
+      else
+        var->elements.set(next++, e);
+    }
+    return "";
+  }
+  if (a.has_subscript)
+  {
+    if (!var)
+    {
+      set_array(a.name, IndexedArray());
+      var = find_var(a.name);
+    }
+    if (var->kind == Variable::Assoc)
+    {
+      const std::string *old = a.append ? var->assoc.get(a.subscript) : nullptr;
+      var->assoc.set(a.subscript, old ? *old + a.value : a.value);
+      return "";
+    }
+    if (var->kind == Variable::Scalar)
+      declare_array(a.name, Variable::Indexed);
+    size_t index;
+    if (!parse_index(a.subscript, var->elements, index))
+      return a.name + "[" + a.subscript + "]: bad array subscript";
+    const ArrayElement *old = a.append ? var->elements.get(index) : nullptr;
+    var->elements.set(index, old ? std::string(element_text(*old)) + a.value : a.value);
+    return "";
+  }
+  // A plain assignment to an array sets its first element
+  if (var && var->kind == Variable::Indexed)
+  {
+    const ArrayElement *old = a.append ? var->elements.get(0) : nullptr;
+    var->elements.set(0, old ? std::string(element_text(*old)) + a.value : a.value);
+    return "";
+  }
+  if (var && var->kind == Variable::Assoc)
+  {
+    const std::string *old = a.append ? var->assoc.get("0") : nullptr;
+    var->assoc.set("0", old ? *old + a.value : a.value);
+    return "";
+  }
+  set_var(a.name, a.append && var ? var->value + a.value : a.value);
+  return "";
+}
+
+void unset_var(const std::string &name)
+{
+  auto it = variables.find(name);
+  if (it == variables.end())
+    return;
+  if (it->second.exported)
+    unsetenv(name.c_str());
+  variables.erase(it);
+}
+
+void export_var(const std::string &name)
+{
+  Variable &var = variables[name];
+  var.exported = true;
+  auto value = get_var(name);
+  setenv(name.c_str(), std::string(value.value_or("")).c_str(), 1);
+}
+
+void push_scope()
+{
+  scopes.emplace_back();
+}
+
+void pop_scope()
+{
+  auto &saved = scopes.back();
+  for (auto it = saved.rbegin(); it != saved.rend(); ++it)
+    put_var(it->first, it->second ? &*it->second : nullptr);
+  scopes.pop_back();
+}
+
+bool in_scope()
+{
+  return !scopes.empty();
+}
+
+void make_local(const std::string &name)
+{
+  auto &saved = scopes.back();
+  for (auto &entry : saved)
+    if (entry.first == name)
+      return;
+  Variable *var = find_var(name);
+  saved.push_back({name, var ? std::optional<Variable>(*var) : std::nullopt});
+  unset_var(name);
+}
+
+void put_var(const std::string &name, const Variable *var)
+{
+  unset_var(name);
+  if (!var)
+    return;
+  variables[name] = *var;
+  if (var->exported)
+    export_var(name);
+}
+
+std::string_view current_ifs()
+{
+  return get_var("IFS").value_or(" \t\n");
+}
+
+FieldSplitter::FieldSplitter(std::string_view text, std::string_view ifs, const std::vector<char> *escaped)
+    : text(text), ifs(ifs), escaped(escaped)
+{
+  while (pos < text.size() && is_ifs_space(pos))
+    ++pos;
+}
+
+bool FieldSplitter::is_ifs(size_t i) const
+{
+  return !(escaped && (*escaped)[i]) && ifs.find(text[i]) != std::string_view::npos;
+}
+
+bool FieldSplitter::is_ifs_space(size_t i) const
+{
+  return is_ifs(i) && (text[i] == ' ' || text[i] == '\t' || text[i] == '\n');
+}
+
+// One delimiter: IFS whitespace around at most one other IFS character
+void FieldSplitter::skip_delimiter()
+{
+  while (pos < text.size() && is_ifs_space(pos))
+    ++pos;
+  if (pos < text.size() && is_ifs(pos))
+  {
+    ++pos;
+    while (pos < text.size() && is_ifs_space(pos))
+      ++pos;
+  }
+}
+
+bool FieldSplitter::next(std::string &field)
+{
+  if (pos >= text.size())
+    return false;
+  size_t start = pos;
+  while (pos < text.size() && !is_ifs(pos))
+    ++pos;
+  field.assign(text.substr(start, pos - start));
+  skip_delimiter();
+  return true;
+}
+
+std::string FieldSplitter::rest()
+{
+  // A single field followed only by a delimiter loses the delimiter
+  size_t start = pos, end = pos;
+  while (end < text.size() && !is_ifs(end))
+    ++end;
+  pos = end;
+  skip_delimiter();
+  if (pos >= text.size())
+    return std::string(text.substr(start, end - start));
+  end = text.size();
+  while (end > start && is_ifs_space(end - 1))
+    --end;
+  return std::string(text.substr(start, end - start));
+}
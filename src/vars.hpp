@@ -0,0 +1,132 @@
+#pragma once
+
+#include "arrays.hpp"
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A shell variable: a scalar, an indexed array or an associative array.
+// Exported variables are mirrored into the process environment so child
+// processes see them.
+struct Variable
+{
+  enum Kind
+  {
+    Scalar,
+    Indexed,
+    Assoc
+  };
+  Kind kind = Scalar;
+  std::string value;
+  IndexedArray elements;
+  AssocArray assoc;
+  bool exported = false;
+};
+
+// A NAME=value word, or one of its forms: NAME+=value appends, NAME[SUB]=
+// value sets one array element, and NAME=(...) assigns a whole array
+struct Assignment
+{
+  std::string name, subscript, value;
+  std::vector<std::string> elements; // for NAME=(...)
+  bool has_subscript = false, append = false, compound = false;
+};
+
+// Exit status of the last command, for $?
+extern int last_status;
+
+// The positional parameters $1, $2, ...; a function call replaces them for
+// its duration
+extern std::vector<std::string> positional_params;
+
+// $0: the script being run, or the shell's own name
+extern std::string shell_name;
+
+// Helper: Import the process environment as exported shell variables
+void import_environment();
+
+// Helper: Whether s is a valid variable name
+bool valid_name(std::string_view s);
+
+// Helper: Look up a variable; null if unset
+Variable *find_var(const std::string &name);
+
+// Helper: Names of all variables, sorted
+std::vector<std::string> var_names();
+
+// Helper: A variable's scalar value (element 0 of an indexed array, key
+// "0" of an associative one); none if unset
+std::optional<std::string_view> get_var(const std::string &name);
+
+// Helper: Set a scalar variable, replacing any array of that name
+void set_var(const std::string &name, std::string value);
+
+// Helper: Set an indexed array variable
+void set_array(const std::string &name, IndexedArray elements);
+
+// Helper: Create an empty array of the given kind unless name already is
+// one; a scalar value becomes element 0. Returns an error message or "".
+std::string declare_array(const std::string &name, Variable::Kind kind);
+
+// Helper: Parse an indexed array subscript: a number (negative counts back
+// from the end) or a variable name holding one. False if it is neither.
+bool parse_index(std::string_view subscript, const IndexedArray &array, size_t &index);
+
+// Helper: Recognize an assignment word. NAME=(...) arrives from the
+// expansion already split into elements (see expand_command).
+bool parse_assignment(const std::string &word, Assignment &out);
+
+// Helper: Carry out an assignment; returns an error message or ""
+std::string apply_assignment(const Assignment &a);
+
+// Helper: Remove a variable
+void unset_var(const std::string &name);
+
+// Helper: Mark a variable exported, putting it in the environment
+void export_var(const std::string &name);
+
+// Helper: Start a new scope for local variables, on a function call
+void push_scope();
+
+// Helper: End the innermost scope, restoring every variable it made local
+void pop_scope();
+
+// Helper: Whether a function scope is active
+bool in_scope();
+
+// Helper: Make name local to the innermost scope: its current state is
+// saved for pop_scope to restore, and it starts out unset
+void make_local(const std::string &name);
+
+// Helper: Replace a variable wholesale, or remove it if var is null; used to
+// undo an assignment that applied to one command only
+void put_var(const std::string &name, const Variable *var);
+
+// Helper: The field separators in effect ($IFS, or space/tab/newline)
+std::string_view current_ifs();
+
+// Splits text into fields on IFS characters the way the shell does: runs of
+// IFS whitespace separate fields and are dropped at either end, while any
+// other IFS character ends exactly one field. Bytes flagged in escaped (a
+// backslash quoted them) never separate.
+class FieldSplitter
+{
+public:
+  FieldSplitter(std::string_view text, std::string_view ifs, const std::vector<char> *escaped = nullptr);
+
+  // Next field; false once the text is used up
+  bool next(std::string &field);
+  // Everything not yet split, as read assigns it to its last name
+  std::string rest();
+
+private:
+  bool is_ifs(size_t i) const;
+  bool is_ifs_space(size_t i) const;
+  void skip_delimiter();
+
+  std::string_view text, ifs;
+  const std::vector<char> *escaped;
+  size_t pos = 0;
+};
@@ -0,0 +1,223 @@
+#include "walk.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+struct linux_dirent64
+{
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+bool read_dir(int dirfd, const std::function<void(const char *name, unsigned char type, ino_t ino)> &fn)
+{
+  alignas(linux_dirent64) char buf[1 << 16];
+  while (true)
+  {
+    long n = syscall(SYS_getdents64, dirfd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return false;
+    if (n == 0)
+      return true;
+    for (long off = 0; off < n;)
+    {
+      auto *d = reinterpret_cast<linux_dirent64 *>(buf + off);
+      off += d->d_reclen;
+      const char *name = d->d_name;
+      if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        continue;
+      fn(name, d->d_type, d->d_ino);
+    }
+  }
+}
+
+unsigned walk_threads(const WalkOptions &opts)
+{
+  if (opts.threads)
+    return opts.threads;
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// An open directory, shared by the tasks of its subdirectories so they can
+// openat relative to it; closed when the last of them has opened
+struct DirRef
+{
+  int fd;
+  explicit DirRef(int fd) : fd(fd) {}
+  ~DirRef() { close(fd); }
+};
+
+// A directory still to be listed
+struct WalkTask
+{
+  std::shared_ptr<DirRef> parent; // null for roots
+  std::string name, path;
+  int depth;
+  void *data; // WalkEntry::data of the directory
+};
+
+// Work-stealing pool: each worker pushes and pops at the back of its own
+// deque (depth-first, which keeps few directories open) and steals from the
+// front of the others' deques when it runs dry
+class WalkPool
+{
+public:
+  WalkPool(unsigned threads, std::function<void(WalkTask &, unsigned)> run) : queues(threads), run(std::move(run)) {}
+
+  void push(unsigned worker, WalkTask task)
+  {
+    ++pending;
+    {
+      std::lock_guard<std::mutex> lock(queues[worker].m);
+      queues[worker].tasks.push_back(std::move(task));
+    }
+    idle_cv.notify_one();
+  }
+
+  // Runs until every task, including those pushed by tasks, is done
+  void run_all()
+  {
+    std::vector<std::thread> threads;
+    for (unsigned w = 1; w < queues.size(); ++w)
+      threads.emplace_back(&WalkPool::work, this, w);
+    work(0);
+    for (auto &t : threads)
+      t.join();
+  }
+
+private:
+  struct Queue
+  {
+    std::mutex m;
+    std::deque<WalkTask> tasks;
+  };
+  std::vector<Queue> queues;
+  std::function<void(WalkTask &, unsigned)> run;
+  std::atomic<size_t> pending{0};
+  std::mutex idle_m;
+  std::condition_variable idle_cv;
+
+  bool take(unsigned self, WalkTask &task)
+  {
+    {
+      Queue &own = queues[self];
+      std::lock_guard<std::mutex> lock(own.m);
+      if (!own.tasks.empty())
+      {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        return true;
+      }
+    }
+    for (unsigned i = 1; i < queues.size(); ++i)
+    {
+      Queue &victim = queues[(self + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(victim.m);
+      if (!victim.tasks.empty())
+      {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void work(unsigned self)
+  {
+    while (true)
+    {
+      WalkTask task;
+      if (take(self, task))
+      {
+        run(task, self);
+        if (--pending == 0)
+        {
+          std::lock_guard<std::mutex> lock(idle_m);
+          idle_cv.notify_all();
+        }
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(idle_m);
+      if (pending == 0)
+        return;
+      idle_cv.wait_for(lock, std::chrono::milliseconds(1));
+    }
+  }
+};
+
+static std::string join_path(const std::string &dir, const char *name)
+{
+  if (!dir.empty() && dir.back() == '/')
+    return dir + name;
+  return dir + "/" + name;
+}
+
+void parallel_walk(const std::vector<std::string> &roots, const WalkOptions &opts,
+                   const std::function<bool(const WalkEntry &entry, unsigned worker)> &visit,
+                   const std::function<void(const std::string &path, int err)> &error)
+{
+  WalkPool *pool_ptr = nullptr;
+  auto list = [&](WalkTask &task, unsigned worker) {
+    int parent_fd = task.parent ? task.parent->fd : AT_FDCWD;
+    int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    if (task.depth > 0 || !opts.follow_roots)
+      flags |= O_NOFOLLOW;
+    int fd = openat(parent_fd, task.name.c_str(), flags);
+    // Out of descriptors: the path from the cwd still works
+    if (fd < 0 && errno == EMFILE)
+      fd = open(task.path.c_str(), flags);
+    task.parent.reset();
+    if (fd < 0)
+    {
+      // Not a directory after all (or a symlink we don't follow)
+      if (errno != ENOTDIR && errno != ELOOP)
+        error(task.path, errno);
+      return;
+    }
+    auto dir = std::make_shared<DirRef>(fd);
+    bool ok = read_dir(fd, [&](const char *name, unsigned char type, ino_t ino) {
+      std::string path = join_path(task.path, name);
+      WalkEntry entry{fd, name, path, type, ino, task.depth + 1, task.data};
+      if (visit(entry, worker) && (type == DT_DIR || type == DT_UNKNOWN))
+        pool_ptr->push(worker, WalkTask{dir, name, std::move(path), task.depth + 1, entry.data});
+    });
+    if (!ok)
+      error(task.path, errno);
+  };
+  // Roots are walked one after another so their output stays grouped
+  for (auto &root : roots)
+  {
+    struct stat sb;
+    if (fstatat(AT_FDCWD, root.c_str(), &sb, opts.follow_roots ? 0 : AT_SYMLINK_NOFOLLOW) != 0)
+    {
+      error(root, errno);
+      continue;
+    }
+    WalkEntry entry{AT_FDCWD, root.c_str(), root, (unsigned char)IFTODT(sb.st_mode), sb.st_ino, 0, nullptr};
+    if (!visit(entry, 0) || !S_ISDIR(sb.st_mode))
+      continue;
+    WalkPool pool(walk_threads(opts), list);
+    pool_ptr = &pool;
+    pool.push(0, WalkTask{nullptr, root, root, 0, entry.data});
+    pool.run_all();
+  }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// An entry seen by parallel_walk. dirfd and name are only valid during the
+// visit callback.
+struct WalkEntry
+{
+  int dirfd;               // Directory containing the entry (AT_FDCWD for roots)
+  const char *name;        // Name relative to dirfd
+  const std::string &path; // Root-relative path, as it should be printed
+  unsigned char type;      // DT_* from getdents64, or DT_UNKNOWN
+  ino_t ino;
+  int depth;         // 0 for the roots
+  void *parent_data; // data attached to the containing directory, or null
+  // A visit that descends into a directory may attach a pointer here; its
+  // entries then see it as parent_data
+  mutable void *data = nullptr;
+};
+
+struct WalkOptions
+{
+  unsigned threads = 0; // 0 means one per core
+  bool follow_roots = false;
+};
+
+// Helper: Number of workers parallel_walk will use for these options
+unsigned walk_threads(const WalkOptions &opts);
+
+// Helper: Read every entry of an open directory with getdents64, skipping
+// "." and "..". Returns false with errno set on error.
+bool read_dir(int dirfd, const std::function<void(const char *name, unsigned char type, ino_t ino)> &fn);
+
+// Helper: Walk the trees under roots on a work-stealing pool of threads.
+// Directories are listed with getdents64 and opened with openat relative to
+// their parent's fd; symlinks are never followed below the roots. visit runs
+// concurrently on the workers (worker is in [0, walk_threads())) and returns
+// whether to descend into the entry if it is a directory. error reports
+// roots and directories that could not be opened or read.
+void parallel_walk(const std::vector<std::string> &roots, const WalkOptions &opts,
+                   const std::function<bool(const WalkEntry &entry, unsigned worker)> &visit,
+                   const std::function<void(const std::string &path, int err)> &error);
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Builtins run inside the shell process write with SIGPIPE ignored, so a
+# reader that goes away stops the builtin, not the shell. Each command line
+# below must go on to print "survived". Usage: broken_pipes.sh SHELL
+
+shell="$1"
+failed=0
+big=$(mktemp)
+trap 'rm -f "$big"' EXIT
+seq 1 1000000 > "$big"
+
+check() {
+  out=$(timeout 10 "$shell" -c "$1; echo survived" 2>&1)
+  status=$?
+  if [ "$status" -ne 0 ] || [ "$(printf '%s\n' "$out" | tail -n1)" != survived ]; then
+    echo "FAIL ($status): $1 printed '$out'"
+    failed=1
+  fi
+}
+
+check "cat $big > >(head -n1)"
+check "seq 1000000 > >(head -n1)"
+check "yes > >(head -n1)"
+check "grep 1 $big > >(head -n1)"
+check "tee /dev/null < $big > >(head -n1)"
+check "cut -c1 $big > >(head -n1)"
+# A fused run whose last stage writes into the substitution
+check "yes | cat > >(head -n1)"
+
+exit $failed
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Parameter expansion edge cases: empty substring offsets, empty anchored
+# replacement patterns and ${v:?} in a non-interactive shell. Usage:
+# expansions.sh SHELL
+
+shell="$1"
+failed=0
+
+check() {
+  out=$(timeout 10 "$shell" -c "$1" 2>/dev/null)
+  status=$?
+  if [ "$status" -ne "${3:-0}" ] || [ "$out" != "$2" ]; then
+    printf '%s\n' "FAIL ($status): $1 printed '$out', expected '$2'"
+    failed=1
+  fi
+}
+
+check 'v=abcd; echo ${v::2}' ab
+check 'v=abcd; echo ${v: :3}' abc
+check 'v=abcd; echo "[${v:1:}]"' '[]'
+check 'v=abcd; echo ${v/#/P}' Pabcd
+check 'v=abcd; echo ${v/%/S}' abcdS
+check 'a=(x y); echo ${a[@]/#/-}' '-x -y'
+check 'v=abcd; echo ${v//b/B}' aBcd
+# An unset parameter with :? ends a -c shell and a script
+check 'echo ${u:?msg}; echo after' '' 1
+check 'v=; echo ${v:?}; echo after' '' 1
+check 'echo ${u?msg} after; echo after' '' 1
+check 'u=x; echo ${u:?msg}' x
+script=$(mktemp)
+printf 'echo ${u:?msg}\necho after\n' > "$script"
+out=$(timeout 10 "$shell" "$script" 2>/dev/null)
+status=$?
+if [ "$status" -eq 0 ] || [ -n "$out" ]; then
+  printf '%s\n' "FAIL ($status): script with \${u:?msg} printed '$out'"
+  failed=1
+fi
+rm -f "$script"
+
+exit $failed
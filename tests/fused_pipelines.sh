@@ -0,0 +1,48 @@
+#!/bin/sh
+# Fused pipeline stages (the streaming builtins run on threads of the shell)
+# get no SIGPIPE, so each must stop once the stage after it has gone. Every
+# pipeline below runs forever if one does not. Usage: fused_pipelines.sh SHELL
+
+shell="$1"
+failed=0
+
+check() {
+  out=$(timeout 10 "$shell" -c "$1" 2>&1)
+  status=$?
+  if [ "$status" -ne 0 ] || [ "$out" != "$2" ]; then
+    echo "FAIL ($status): $1 printed '$out', expected '$2'"
+    failed=1
+  fi
+}
+
+# One pipeline per builtin in the fusable set in main.cpp. Each input comes
+# from the builtin yes (a fused stage itself) and from env yes (a separate
+# process writing a real pipe).
+for yes in yes "env yes"; do
+  check "$yes | cat | head -n1" y
+  check "$yes | tee /dev/null | head -n1" y
+  check "$yes | pv -q | head -n1" y
+  check "$yes | grep y | head -n1" y
+  check "$yes | cut -c1 | head -n1" y
+  check "$yes | head -n 100000000 | head -n1" y
+  check "$yes | tail -n +1 | head -n1" y
+  check "$yes | echo done | head -n1" done
+  check "$yes | seq 1 1000000000 | head -n1" 1
+  check "$yes | yes | head -n1" y
+done
+
+# tail -f never reaches the end of its input; it must notice on its own
+# that its reader has gone
+follow=$(mktemp)
+trap 'rm -f "$follow"' EXIT
+seq 1 5 > "$follow"
+check "tail -f $follow | head -n1" 1
+check "tail -n2 -f $follow | grep 5 | head -n1" 5
+
+# wc and sort read all their input before writing, so they are checked
+# behind a stage that never reads it. Only a fused stage upstream can be
+# stopped that way; a process would read on, as in any other shell.
+check "yes | wc -l | echo done" done
+check "yes | sort | echo done" done
+
+exit $failed
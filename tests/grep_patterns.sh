@@ -0,0 +1,29 @@
+#!/bin/sh
+# Regex constructs the builtin grep does not implement (word boundaries,
+# back-references) must be handed to the PATH grep, never matched as
+# literals or rejected. Usage: grep_patterns.sh SHELL
+
+shell="$1"
+failed=0
+
+check() {
+  out=$(timeout 10 "$shell" -c "$1" 2>&1)
+  status=$?
+  if [ "$status" -ne 0 ] || [ "$out" != "$2" ]; then
+    printf '%s\n' "FAIL ($status): $1 printed '$out', expected '$2'"
+    failed=1
+  fi
+}
+
+check "echo 'a pie b' | grep -E '\\bpie\\b'" "a pie b"
+check "echo 'a pie b' | grep '\\<pie\\>'" "a pie b"
+check "printf 'a pies\\na pie\\n' | grep -c '\\bpie\\b'" 1
+check "echo abab | grep -E '(ab)\\1'" abab
+check "echo abab | grep '\\(ab\\)\\1'" abab
+# Also from a fused stage
+check "printf 'pies\\npie\\n' | cat | grep -w pie | head -n1" pie
+check "printf 'abab\\nabba\\n' | cat | grep -E '(ab)\\1' | head -n1" abab
+# Escaped punctuation is still a literal
+check "echo 'a.b' | grep 'a\\.b'" a.b
+
+exit $failed